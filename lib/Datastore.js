@@ -171,7 +171,8 @@ class Entangld extends EventEmitter {
      * Call this function with the data that was sent via the transmit()
      * callback.
      *
-     * @param {Entangld_Message} msg the message to process.
+     * @param {(Entangld_Message|Entangld_Message[])} msg the message to process.
+     * An array of messages is processed as a batch.
      * @param {object} obj the attach() object where the message originted.
      *
      * @throws {ReferenceError} if event object was not provided.
@@ -179,7 +180,16 @@ class Entangld extends EventEmitter {
      */
     receive(msg, obj) {
 
-        if (msg.type == "set" || msg.type == "push") {
+        if (Array.isArray(msg)) {
+            // Batch frame, an array of messages
+            msg = Entangld_Message.batch(msg);
+        }
+
+        if (msg.type == "batch") {
+            // Several messages sent together
+            for (let m of msg.value) this.receive(m, obj);
+
+        } else if (msg.type == "set" || msg.type == "push") {
             // Remote "set" request
             this.set(msg.path, msg.value, msg.type, msg.params);
 
@@ -130,6 +130,22 @@ class Entangld_Message {
     }
 
 
+    /**
+     * Create a `batch` message holding several messages
+     *
+     * Batches let a datastore send many messages in a single frame.  A
+     * receiver processes the contained messages in order.
+     *
+     * @param {Entangld_Message[]} messages - the messages to send together
+     * @return {Entangld_Message} the `batch` message
+     */
+    static batch(messages) {
+        return new this({
+            type : "batch",
+            value : messages
+        });
+    }
+
     /**
      * Create an unsubscribe message for a subscription uuid
      *
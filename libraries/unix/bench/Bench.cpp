@@ -0,0 +1,248 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Bench.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <regex>
+#include <vector>
+
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+#include "Bench.h"
+
+/** Returns the CPU time used by the process in nanoseconds. */
+static int64_t cpu_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/** A registered benchmark with one of its arguments. */
+typedef struct {
+    std::string name;
+    entangld::bench::function_t function;
+    int64_t arg;
+} case_t;
+
+/** Registered benchmarks, built by static initializers. */
+static std::vector<case_t> &cases()
+{
+    static std::vector<case_t> registered;
+    return registered;
+}
+
+/** Returns the value of a --flag=value argument, or null. */
+static const char *flag(const char *arg, const char *name)
+{
+    size_t length = strlen(name);
+    if(strncmp(arg, name, length) == 0 && arg[length] == '=')
+        return arg + length + 1;
+
+    return nullptr;
+}
+
+namespace entangld
+{
+    namespace bench
+    {
+        bool State::keep_running()
+        {
+            if(m_done == 0 && !m_running)
+                resume_timing();
+
+            if(m_done < m_target) {
+                m_done += 1;
+                return true;
+            }
+
+            pause_timing();
+            return false;
+        }
+
+        void State::pause_timing()
+        {
+            if(!m_running)
+                return;
+
+            m_real += std::chrono::steady_clock::now() - m_start;
+            m_cpu += cpu_now() - m_cpu_start;
+            m_running = false;
+        }
+
+        void State::resume_timing()
+        {
+            if(m_running)
+                return;
+
+            m_running = true;
+            m_cpu_start = cpu_now();
+            m_start = std::chrono::steady_clock::now();
+        }
+
+        int add(const char *name, function_t function, std::initializer_list<int64_t> args)
+        {
+            if(args.size() == 0)
+                cases().push_back({name, function, 0});
+
+            for(int64_t arg : args)
+                cases().push_back({std::string(name) + "/" + std::to_string(arg), function, arg});
+
+            return 0;
+        }
+
+        int run(int argc, char *argv[])
+        {
+            std::string filter = ".";
+            double min_time = 0.5;
+            bool json_format = false;
+            std::string out_path;
+
+            for(int i = 1; i < argc; ++i) {
+                const char *value;
+                if((value = flag(argv[i], "--benchmark_filter")) != nullptr) {
+                    filter = value;
+                }
+                else if((value = flag(argv[i], "--benchmark_min_time")) != nullptr) {
+                    min_time = atof(value);
+                }
+                else if((value = flag(argv[i], "--benchmark_format")) != nullptr) {
+                    json_format = (strcmp(value, "json") == 0);
+                }
+                else if((value = flag(argv[i], "--benchmark_out")) != nullptr) {
+                    out_path = value;
+                }
+                else {
+                    fprintf(stderr, "Usage: %s [--benchmark_filter=<regex>] [--benchmark_min_time=<seconds>]"
+                        " [--benchmark_format=<console|json>] [--benchmark_out=<file>]\n", argv[0]);
+                    return EXIT_FAILURE;
+                }
+            }
+
+            std::regex pattern;
+            try {
+                pattern = std::regex(filter);
+            }
+            catch(const std::regex_error &e) {
+                fprintf(stderr, "Invalid filter %s: %s\n", filter.c_str(), e.what());
+                return EXIT_FAILURE;
+            }
+
+            std::vector<case_t> selected;
+            for(const case_t &entry : cases()) {
+                if(std::regex_search(entry.name, pattern))
+                    selected.push_back(entry);
+            }
+
+            std::stable_sort(selected.begin(), selected.end(), [](const case_t &a, const case_t &b) {
+                return a.name.substr(0, a.name.find('/')) < b.name.substr(0, b.name.find('/'));
+            });
+
+            char host[256] = "";
+            gethostname(host, sizeof(host) - 1);
+
+            char date[64] = "";
+            time_t now = time(nullptr);
+            strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+
+            nlohmann::json report = {
+                {"context", {
+                    {"date", date},
+                    {"host_name", host},
+                    {"executable", argv[0]},
+                    {"num_cpus", sysconf(_SC_NPROCESSORS_ONLN)},
+#ifdef NDEBUG
+                    {"library_build_type", "release"},
+#else
+                    {"library_build_type", "debug"},
+#endif
+                }},
+                {"benchmarks", nlohmann::json::array()}
+            };
+
+            if(!json_format)
+                printf("%-40s %15s %15s %12s\n", "Benchmark", "Time", "CPU", "Iterations");
+
+            for(const case_t &entry : selected) {
+                // Grow the iteration count until a run lasts min_time
+                uint64_t iterations = 1;
+                for(;;) {
+                    State state(entry.arg, iterations);
+                    entry.function(state);
+
+                    double seconds = std::chrono::duration<double>(state.m_real).count();
+                    if(seconds < min_time && iterations < 1000000000) {
+                        double scale = (seconds > 0) ? 1.4 * min_time / seconds : 100;
+                        scale = std::min(100.0, std::max(2.0, scale));
+                        iterations = static_cast<uint64_t>(iterations * scale);
+                        continue;
+                    }
+
+                    double real = double(state.m_real.count()) / state.m_done;
+                    double cpu = double(state.m_cpu) / state.m_done;
+
+                    nlohmann::json result = {
+                        {"name", entry.name},
+                        {"run_name", entry.name},
+                        {"run_type", "iteration"},
+                        {"iterations", state.m_done},
+                        {"real_time", real},
+                        {"cpu_time", cpu},
+                        {"time_unit", "ns"}
+                    };
+
+                    if(state.m_items > 0)
+                        result["items_per_second"] = state.m_items / seconds;
+
+                    if(state.m_bytes > 0)
+                        result["bytes_per_second"] = state.m_bytes / seconds;
+
+                    if(!json_format) {
+                        printf("%-40s %12.0f ns %12.0f ns %12llu", entry.name.c_str(), real, cpu,
+                            static_cast<unsigned long long>(state.m_done));
+
+                        if(state.m_items > 0)
+                            printf(" %10.3fM items/s", state.m_items / seconds / 1e6);
+
+                        if(state.m_bytes > 0)
+                            printf(" %10.3fMB/s", state.m_bytes / seconds / 1e6);
+
+                        printf("\n");
+                        fflush(stdout);
+                    }
+
+                    report["benchmarks"].push_back(std::move(result));
+                    break;
+                }
+            }
+
+            if(json_format)
+                printf("%s\n", report.dump(2).c_str());
+
+            if(!out_path.empty()) {
+                std::ofstream out(out_path);
+                out << report.dump(2) << std::endl;
+                if(!out) {
+                    fprintf(stderr, "Could not write %s\n", out_path.c_str());
+                    return EXIT_FAILURE;
+                }
+            }
+
+            return EXIT_SUCCESS;
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    return entangld::bench::run(argc, argv);
+}
@@ -0,0 +1,106 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Bench.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_BENCH_H_
+#define _ENTANGLD_BENCH_H_
+
+#include <chrono>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+
+namespace entangld
+{
+    namespace bench
+    {
+        /** Timing state handed to a benchmark.
+         *
+         * Accepts the flags and writes the JSON of Google Benchmark, so
+         * existing tooling can compare results.  A case does its setup,
+         * then loops on keep_running():
+         *
+         *     static void local_get(bench::State &state)
+         *     {
+         *         Datastore store;
+         *         while(state.keep_running())
+         *             store.get("name", callback);
+         *     }
+         *     ENTANGLD_BENCHMARK(local_get, 1, 10, 100);
+         */
+        class State {
+            public:
+                State(int64_t arg, uint64_t iterations)
+                : m_arg(arg), m_target(iterations) {};
+
+                /** Returns true until the requested number of iterations ran.
+                 *
+                 * The timer starts on the first call and stops on the last.
+                 */
+                bool keep_running();
+
+                /** Returns the argument the case was registered with. */
+                inline int64_t range() const { return m_arg; }
+
+                /** Stops the timer, e.g. around per-iteration setup. */
+                void pause_timing();
+
+                /** Restarts the timer after pause_timing(). */
+                void resume_timing();
+
+                /** Reports items handled in total, shown as items per second. */
+                inline void set_items_processed(uint64_t items) { m_items = items; }
+
+                /** Reports bytes handled in total, shown as bytes per second. */
+                inline void set_bytes_processed(uint64_t bytes) { m_bytes = bytes; }
+
+                /** Returns the number of iterations requested. */
+                inline uint64_t iterations() const { return m_target; }
+
+            private:
+                friend int run(int argc, char *argv[]);
+
+                int64_t m_arg;
+                uint64_t m_target;
+                uint64_t m_done = 0;
+                uint64_t m_items = 0;
+                uint64_t m_bytes = 0;
+                bool m_running = false;
+
+                std::chrono::steady_clock::time_point m_start;
+                std::chrono::nanoseconds m_real = std::chrono::nanoseconds(0);
+                int64_t m_cpu_start = 0;
+                int64_t m_cpu = 0;
+        };
+
+        /** Benchmark function. */
+        typedef void (*function_t)(State &state);
+
+        /** Registers a benchmark once for every argument.
+         *
+         * @param [in] name case name, reported as "name/arg".
+         * @param [in] function case to run.
+         * @param [in] args arguments, or none to run it once as "name".
+         * @return a value to initialize a static with.
+         */
+        int add(const char *name, function_t function, std::initializer_list<int64_t> args);
+
+        /** Runs every registered benchmark matching the command line.
+         *
+         * Understands --benchmark_filter=<regex>, --benchmark_min_time=<seconds>,
+         * --benchmark_format=<console|json> and --benchmark_out=<file>.
+         *
+         * @return process exit code.
+         */
+        int run(int argc, char *argv[]);
+    }
+}
+
+/** Registers a benchmark function with an optional list of arguments. */
+#define ENTANGLD_BENCHMARK(function, ...) \
+    static int function##_registered = entangld::bench::add(#function, function, {__VA_ARGS__})
+
+#endif /* _ENTANGLD_BENCH_H_ */
@@ -0,0 +1,97 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file bench_codec.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <algorithm>
+#include <vector>
+
+#include "Bench.h"
+#include "Codec.h"
+#include "FrameReader.h"
+
+using namespace entangld;
+
+/** Returns an event holding a device record with range() samples. */
+static Message sample_message(int64_t samples)
+{
+    Message msg;
+    msg.type = "event";
+    msg.path = "devices.device0";
+    msg.uuid = "6c1f4c1e-8f53-4b36-a1a5-2d1b8e3f9a10";
+    msg.value = {
+        {"name", "thermal camera"},
+        {"online", true},
+        {"temperature", 21.5},
+        {"samples", nlohmann::json::array()}
+    };
+
+    for(int64_t i = 0; i < samples; ++i)
+        msg.value["samples"].push_back(i * 0.25);
+
+    return msg;
+}
+
+/** Encodes a Message, one case per Format and size. */
+static void encode_message(bench::State &state, Format format)
+{
+    Message msg = sample_message(state.range());
+    std::vector<uint8_t> out;
+    while(state.keep_running()) {
+        out.clear();
+        encode(msg, format, out);
+    }
+
+    state.set_bytes_processed(out.size() * state.iterations());
+}
+
+/** Decodes a Message, one case per Format and size. */
+static void decode_message(bench::State &state, Format format)
+{
+    std::vector<uint8_t> data = encode(sample_message(state.range()), format);
+    size_t total = 0;
+    while(state.keep_running())
+        total += decode(data.data(), data.size(), format).type.size();
+
+    state.set_bytes_processed(data.size() * state.iterations());
+}
+
+/** Reads a stream of JSON frames in socket sized chunks, range() frames per stream. */
+static void read_frames(bench::State &state)
+{
+    std::vector<uint8_t> stream;
+    for(int64_t i = 0; i < state.range(); ++i)
+        frame(sample_message(10), Format::JSON, stream);
+
+    const size_t chunk = 1500;
+    FrameReader reader;
+    Message msg;
+    size_t total = 0;
+    while(state.keep_running()) {
+        for(size_t offset = 0; offset < stream.size(); offset += chunk) {
+            reader.append(stream.data() + offset, std::min(chunk, stream.size() - offset));
+            while(reader.next(msg))
+                total += msg.type.size();
+        }
+    }
+
+    state.set_items_processed(state.range() * state.iterations());
+    state.set_bytes_processed(stream.size() * state.iterations());
+}
+
+static void encode_json(bench::State &state) { encode_message(state, Format::JSON); }
+static void encode_cbor(bench::State &state) { encode_message(state, Format::CBOR); }
+static void encode_msgpack(bench::State &state) { encode_message(state, Format::MSGPACK); }
+static void decode_json(bench::State &state) { decode_message(state, Format::JSON); }
+static void decode_cbor(bench::State &state) { decode_message(state, Format::CBOR); }
+static void decode_msgpack(bench::State &state) { decode_message(state, Format::MSGPACK); }
+
+ENTANGLD_BENCHMARK(encode_json, 0, 100);
+ENTANGLD_BENCHMARK(encode_cbor, 0, 100);
+ENTANGLD_BENCHMARK(encode_msgpack, 0, 100);
+ENTANGLD_BENCHMARK(decode_json, 0, 100);
+ENTANGLD_BENCHMARK(decode_cbor, 0, 100);
+ENTANGLD_BENCHMARK(decode_msgpack, 0, 100);
+ENTANGLD_BENCHMARK(read_frames, 1, 100);
@@ -0,0 +1,94 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file bench_local.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <string>
+
+#include "Bench.h"
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Returns a dotted path with depth segments. */
+static std::string nested_path(int64_t depth)
+{
+    std::string path = "level0";
+    for(int64_t i = 1; i < depth; ++i)
+        path += ".level" + std::to_string(i);
+
+    return path;
+}
+
+/** Get of a value at increasing depths, with a parsed Path. */
+static void local_get(bench::State &state)
+{
+    Datastore store;
+    Path path(nested_path(state.range()));
+    store.set(path, 42);
+
+    int64_t sum = 0;
+    Datastore::callback_t callback = [&](const Message &msg){ sum += msg.value.get<int64_t>(); };
+    while(state.keep_running())
+        store.get(path, callback);
+
+    state.set_items_processed(state.iterations());
+}
+ENTANGLD_BENCHMARK(local_get, 1, 4, 16);
+
+/** Get of a value at increasing depths, parsing the path every time. */
+static void local_get_string(bench::State &state)
+{
+    Datastore store;
+    std::string path = nested_path(state.range());
+    store.set(path, 42);
+
+    int64_t sum = 0;
+    Datastore::callback_t callback = [&](const Message &msg){ sum += msg.value.get<int64_t>(); };
+    while(state.keep_running())
+        store.get(path, callback);
+
+    state.set_items_processed(state.iterations());
+}
+ENTANGLD_BENCHMARK(local_get_string, 1, 4, 16);
+
+/** Set of a value at increasing depths, with a parsed Path. */
+static void local_set(bench::State &state)
+{
+    Datastore store;
+    Path path(nested_path(state.range()));
+
+    int64_t value = 0;
+    while(state.keep_running())
+        store.set(path, value++);
+
+    state.set_items_processed(state.iterations());
+}
+ENTANGLD_BENCHMARK(local_set, 1, 4, 16);
+
+/** Set of an object with a fixed layout, as a sensor update would be. */
+static void local_set_object(bench::State &state)
+{
+    Datastore store;
+    Path path("sensors.thermal");
+
+    nlohmann::json reading = {
+        {"label", "thermal camera, north facing wall"},
+        {"samples", nlohmann::json::array()},
+        {"unit", "celsius"}
+    };
+
+    for(int64_t i = 0; i < state.range(); ++i)
+        reading["samples"].push_back(20.0 + i);
+
+    nlohmann::json &first = reading["samples"][0];
+    while(state.keep_running()) {
+        first = first.get<double>() + 1;
+        store.set(path, reading);
+    }
+
+    state.set_items_processed(state.iterations());
+}
+ENTANGLD_BENCHMARK(local_set_object, 4, 64);
@@ -0,0 +1,104 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file bench_remote.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <cstdint>
+
+#include "Bench.h"
+#include "Codec.h"
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** A pair of stores attached to each other. */
+typedef struct {
+    Datastore near;
+    Datastore far;
+} link_t;
+
+/** Passes Messages straight to the other store. */
+static void loopback_near(const Message &msg, void *ctx)
+{
+    static_cast<link_t*>(ctx)->far.receive(msg, "near");
+}
+
+static void loopback_far(const Message &msg, void *ctx)
+{
+    static_cast<link_t*>(ctx)->near.receive(msg, "far");
+}
+
+/** Passes encoded frames straight to the other store. */
+static int wire_near(const uint8_t *data, size_t size, void *ctx)
+{
+    static_cast<link_t*>(ctx)->far.receive(data, size, "near");
+    return 0;
+}
+
+static int wire_far(const uint8_t *data, size_t size, void *ctx)
+{
+    static_cast<link_t*>(ctx)->near.receive(data, size, "far");
+    return 0;
+}
+
+/** Remote get round trip over an in-process handler. */
+static void remote_get(bench::State &state)
+{
+    link_t link;
+    link.near.attach("far", loopback_near, &link);
+    link.far.attach("near", loopback_far, &link);
+    link.far.set("status", "idle");
+
+    Path path("far.status");
+    int64_t replies = 0;
+    Datastore::callback_t callback = [&](const Message&){ replies += 1; };
+    while(state.keep_running())
+        link.near.get(path, callback);
+
+    state.set_items_processed(replies);
+}
+ENTANGLD_BENCHMARK(remote_get);
+
+/** Remote get round trip through encoded frames, one case per Format. */
+static void remote_get_encoded(bench::State &state)
+{
+    Format format = static_cast<Format>(state.range());
+
+    link_t link;
+    link.near.attach("far", wire_near, &link, Datastore::remote_opts_t(0, 0, format));
+    link.far.attach("near", wire_far, &link, Datastore::remote_opts_t(0, 0, format));
+    link.far.set("status", "idle");
+
+    Path path("far.status");
+    int64_t replies = 0;
+    Datastore::callback_t callback = [&](const Message&){ replies += 1; };
+    while(state.keep_running())
+        link.near.get(path, callback);
+
+    state.set_items_processed(replies);
+}
+ENTANGLD_BENCHMARK(remote_get_encoded,
+    static_cast<int64_t>(Format::JSON),
+    static_cast<int64_t>(Format::CBOR),
+    static_cast<int64_t>(Format::MSGPACK));
+
+/** Remote set to a subscribed path, delivered back as an event. */
+static void remote_event(bench::State &state)
+{
+    link_t link;
+    link.near.attach("far", loopback_near, &link);
+    link.far.attach("near", loopback_far, &link);
+
+    int64_t events = 0;
+    link.near.subscribe("far.status", [&](const Message&){ events += 1; });
+
+    Path path("far.status");
+    int64_t value = 0;
+    while(state.keep_running())
+        link.near.set(path, value++);
+
+    state.set_items_processed(events);
+}
+ENTANGLD_BENCHMARK(remote_event);
@@ -0,0 +1,96 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file bench_sub.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <string>
+#include <vector>
+
+#include "Bench.h"
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Set of one path, with range() subscriptions on other paths. */
+static void set_sparse_subs(bench::State &state)
+{
+    Datastore store;
+    int64_t events = 0;
+    for(int64_t i = 0; i < state.range(); ++i)
+        store.subscribe("devices.device" + std::to_string(i) + ".status", [&](const Message&){ events += 1; });
+
+    Path path("devices.device0.status");
+    int64_t value = 0;
+    while(state.keep_running())
+        store.set(path, value++);
+
+    state.set_items_processed(state.iterations());
+}
+ENTANGLD_BENCHMARK(set_sparse_subs, 1, 10, 100, 1000, 10000);
+
+/** Set of one path with range() subscriptions on it. */
+static void set_fanout(bench::State &state)
+{
+    Datastore store;
+    int64_t events = 0;
+    for(int64_t i = 0; i < state.range(); ++i)
+        store.subscribe("devices.device0.status", [&](const Message&){ events += 1; });
+
+    Path path("devices.device0.status");
+    int64_t value = 0;
+    while(state.keep_running())
+        store.set(path, value++);
+
+    state.set_items_processed(events);
+}
+ENTANGLD_BENCHMARK(set_fanout, 1, 10, 100, 1000, 10000);
+
+/** Sets to range() subscribed paths, each delivering one event. */
+static void event_storm(bench::State &state)
+{
+    Datastore store;
+    std::vector<Path> paths;
+    int64_t events = 0;
+    for(int64_t i = 0; i < state.range(); ++i) {
+        paths.push_back("devices.device" + std::to_string(i) + ".status");
+        store.subscribe(paths.back(), [&](const Message&){ events += 1; });
+    }
+
+    int64_t value = 0;
+    while(state.keep_running()) {
+        for(const Path &path : paths)
+            store.set(path, value);
+
+        value += 1;
+    }
+
+    state.set_items_processed(events);
+}
+ENTANGLD_BENCHMARK(event_storm, 100, 10000);
+
+/** A batch of sets to range() subscribed paths, delivered on commit. */
+static void event_storm_batch(bench::State &state)
+{
+    Datastore store;
+    std::vector<Path> paths;
+    int64_t events = 0;
+    for(int64_t i = 0; i < state.range(); ++i) {
+        paths.push_back("devices.device" + std::to_string(i) + ".status");
+        store.subscribe(paths.back(), [&](const Message&){ events += 1; });
+    }
+
+    int64_t value = 0;
+    while(state.keep_running()) {
+        store.begin();
+        for(const Path &path : paths)
+            store.set(path, value);
+
+        store.commit();
+        value += 1;
+    }
+
+    state.set_items_processed(events);
+}
+ENTANGLD_BENCHMARK(event_storm_batch, 100, 10000);
@@ -0,0 +1,125 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Codec.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_CODEC_H_
+#define _ENTANGLD_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Message.h"
+
+namespace entangld
+{
+    /** Wire encodings for Message objects. */
+    enum class Format {
+        JSON,       /**< Text json, compatible with the NodeJS library. */
+        CBOR,       /**< RFC 7049 Concise Binary Object Representation. */
+        MSGPACK     /**< MessagePack. */
+    };
+
+    /** Defines a callback that writes encoded bytes to a transport.
+     *
+     * @param [in] data bytes to write.
+     * @param [in] size number of bytes.
+     * @param [in] ctx user context.
+     * @return 0 on success, negative on error, or the number of trailing
+     * bytes that were not written because the transport would block.  The
+     * store keeps those bytes and retries them from Datastore::poll().
+     */
+    typedef int (*writer_t)(const uint8_t *data, size_t size, void *ctx);
+
+    /** Encodes a Message and appends it to a buffer.
+     *
+     * @param [in] msg Message to encode.
+     * @param [in] format wire encoding.
+     * @param [out] out buffer to append to.
+     */
+    void encode(const Message &msg, Format format, std::vector<uint8_t> &out);
+
+    /** Encodes a Message.
+     *
+     * @param [in] msg Message to encode.
+     * @param [in] format wire encoding.
+     * @return the encoded bytes.
+     */
+    std::vector<uint8_t> encode(const Message &msg, Format format);
+
+    /** Decodes a Message.
+     *
+     * @param [in] data encoded bytes.
+     * @param [in] size number of bytes.
+     * @param [in] format wire encoding.
+     * @return the decoded Message.
+     * @throws nlohmann::json::exception if the data is malformed.
+     */
+    Message decode(const uint8_t *data, size_t size, Format format);
+
+    /** Decodes a Message in place.
+     *
+     * The envelope is parsed straight into the fields of msg, only path,
+     * value and params are built as json.  Reusing msg keeps the capacity
+     * of its strings.
+     *
+     * @param [in] data encoded bytes.
+     * @param [in] size number of bytes.
+     * @param [in] format wire encoding.
+     * @param [out] msg decoded Message.
+     * @throws nlohmann::json::exception if the data is malformed.
+     */
+    void decode(const uint8_t *data, size_t size, Format format, Message &msg);
+
+    /** Decodes a Message through a json document, as from_json(Message) does.
+     *
+     * Slower than decode(), which reports its errors through it.
+     *
+     * @param [in] data encoded bytes.
+     * @param [in] size number of bytes.
+     * @param [in] format wire encoding.
+     * @return the decoded Message.
+     * @throws nlohmann::json::exception if the data is malformed.
+     */
+    Message decode_dom(const uint8_t *data, size_t size, Format format);
+
+    /** Encodes a Message as a frame and appends it to a buffer.
+     *
+     * JSON frames are terminated by a newline, as expected by the NodeJS
+     * library's socket examples.  Binary frames are prefixed by their
+     * length as a 32-bit big endian integer.
+     *
+     * @param [in] msg Message to encode.
+     * @param [in] format wire encoding.
+     * @param [out] out buffer to append to.
+     */
+    void frame(const Message &msg, Format format, std::vector<uint8_t> &out);
+
+    /** Finds the first complete frame in a buffer.
+     *
+     * @param [in] data received bytes.
+     * @param [in] size number of bytes.
+     * @param [in] format wire encoding.
+     * @param [out] payload offset of the encoded Message within data.
+     * @param [out] length size of the encoded Message.
+     * @return size of the frame including delimiters, or 0 if incomplete.
+     */
+    size_t next_frame(
+        const uint8_t *data, size_t size, Format format, size_t &payload, size_t &length);
+
+    /** Decodes the first complete frame in a buffer.
+     *
+     * @param [in] data received bytes.
+     * @param [in] size number of bytes.
+     * @param [in] format wire encoding.
+     * @param [out] msg decoded Message.
+     * @return bytes consumed, or 0 if the buffer does not hold a complete frame.
+     * @throws nlohmann::json::exception if the frame is malformed.
+     */
+    size_t unframe(const uint8_t *data, size_t size, Format format, Message &msg);
+}
+
+#endif /* _ENTANGLD_CODEC_H_ */
@@ -8,25 +8,255 @@
 #ifndef _ENTANGLD_DATASTORE_H_
 #define _ENTANGLD_DATASTORE_H_
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <utility>
 
 #include <nlohmann/json.hpp>
+#include "Codec.h"
+#include "Executor.h"
 #include "Message.h"
+#include "Path.h"
+
+#ifdef ENTANGLD_CONCURRENT
+#include <pthread.h>
+#include "Queue.h"
+#endif
 
 namespace entangld
 {
-    /** Syncronized event store. */
+    /** Syncronized event store.
+     *
+     * When built with ENTANGLD_CONCURRENT every method may be called from
+     * any thread.  Local gets share a reader/writer lock, everything else
+     * takes it exclusively.  Callbacks, handlers and writers are queued
+     * while the lock is held and run once it is released, by whichever
+     * calling thread gets to the queue first, in the order they were
+     * queued.  Path caches are not used in this mode.
+     */
     class Datastore {
         public:
+            /** Clock used for subscription rate limits. */
+            typedef std::chrono::steady_clock clock;
+
+            /** Callable alternative to a callback function and context. */
+            typedef std::function<void(const Message &msg)> callback_t;
+
+            /** Delivery policy for a subscription.
+             *
+             * When both every and interval are set, a change must pass the
+             * every count before the rate limit is checked.
+             */
+            struct policy_t {
+                /** Deliver every Nth change. Zero and one deliver every change. */
+                unsigned int every;
+
+                /** Minimum time between callbacks. Zero disables the rate limit. */
+                std::chrono::milliseconds interval;
+
+                /** Deliver the latest value from poll() once interval expires. */
+                bool trailing;
+
+                /** Send changes as patches instead of the whole value.
+                 *
+                 * The first event is a snapshot, later events carry an
+                 * RFC 6902 patch in params["patch"] relative to the
+                 * subscribed path: "replace" for a set, and "add" to "/-"
+                 * for a push.  Changes skipped by every or interval are
+                 * followed by a snapshot.  Subscriptions on a remote keep a
+                 * mirror that the patches are applied to, so callbacks still
+                 * receive the whole value in msg.value.
+                 */
+                bool delta;
+
+                policy_t(
+                    unsigned int every = 0,
+                    std::chrono::milliseconds interval = std::chrono::milliseconds(0),
+                    bool trailing = true,
+                    bool delta = false)
+                : every(every), interval(interval), trailing(trailing), delta(delta) {};
+            };
+
+            /** What happens to Messages for a blocked remote whose queue is full. */
+            enum class overflow_t {
+                /** Drop the oldest queued Message. */
+                DROP_OLDEST,
+
+                /** Keep only the latest event of each subscription.  Queued
+                 * events are replaced by later ones with the same uuid, and
+                 * their patches are merged.  Other Messages drop the oldest.
+                 */
+                COALESCE,
+
+                /** Drop the queue and detach the remote on the next poll().
+                 * Requests received from it afterwards are ignored.
+                 */
+                DISCONNECT
+            };
+
+            /** Outbound options for an attached remote. */
+            struct remote_opts_t {
+                /** Queue up to this many Messages before sending them as one
+                 * "batch" Message.  Queued Messages are also sent by flush()
+                 * and poll().  Zero and one send every Message immediately.
+                 */
+                unsigned int max_batch;
+
+                /** Queue up to this many encoded bytes before writing them.
+                 * Only applies to remotes attached with a writer_t.  Zero
+                 * disables the byte budget.
+                 */
+                size_t max_bytes;
+
+                /** Wire encoding used with a writer_t. */
+                Format format;
+
+                /** Keep a local copy of the remote store and serve get from it.
+                 *
+                 * attach() subscribes to the whole remote store in delta
+                 * mode, and set writes through to the copy as well as the
+                 * remote.  Gets go to the remote until the first snapshot
+                 * arrives.
+                 */
+                bool mirror;
+
+                /** How long the mirror is served after the remote was last
+                 * heard from.  Once exceeded, gets go to the remote again and
+                 * its replies renew the mirror.  Zero serves it indefinitely.
+                 */
+                std::chrono::milliseconds max_stale;
+
+                /** Messages held while the remote is blocked, before overflow
+                 * applies.  A remote blocks when its writer_t would block or
+                 * through set_blocked().  Zero is unbounded.
+                 */
+                size_t max_queue;
+
+                /** Policy once max_queue is reached. */
+                overflow_t overflow;
+
+                /** Called by poll() after a remote that overflowed with
+                 * overflow_t::DISCONNECT is detached, so that its transport
+                 * can be closed.  Receives the remote name and the ctx given
+                 * to attach().  Runs with the lock held, so it must not call
+                 * back into the store.  May be null.
+                 */
+                void (*on_disconnect)(const std::string &name, void *ctx);
+
+                remote_opts_t(
+                    unsigned int max_batch = 0,
+                    size_t max_bytes = 0,
+                    Format format = Format::JSON,
+                    bool mirror = false,
+                    std::chrono::milliseconds max_stale = std::chrono::milliseconds(0),
+                    size_t max_queue = 0,
+                    overflow_t overflow = overflow_t::DROP_OLDEST,
+                    void (*on_disconnect)(const std::string &name, void *ctx) = nullptr)
+                : max_batch(max_batch), max_bytes(max_bytes), format(format),
+                  mirror(mirror), max_stale(max_stale), max_queue(max_queue),
+                  overflow(overflow), on_disconnect(on_disconnect) {};
+            };
+
+            /** Format of generated request identifiers. */
+            enum class id_format_t {
+                /** Random RFC 4122 UUIDs, as generated by the JS library. */
+                UUID,
+
+                /** A random per-store prefix followed by a counter.  Much
+                 * cheaper to generate, but only unique while prefixes are.
+                 */
+                COUNTER
+            };
+
+            /** Options for requests made by this store. */
+            struct request_opts_t {
+                /** Give up on a request if no reply arrives within timeout.
+                 * The callback is then called from poll() with a "timeout"
+                 * Message.  Zero waits forever.
+                 */
+                std::chrono::milliseconds timeout;
+
+                /** Maximum number of requests waiting on remotes.  Further
+                 * requests are answered immediately with a "timeout" Message.
+                 * Zero is unbounded.
+                 */
+                size_t max_pending;
+
+                /** Format of identifiers generated for get and subscribe. */
+                id_format_t ids;
+
+                request_opts_t(
+                    std::chrono::milliseconds timeout = std::chrono::milliseconds(0),
+                    size_t max_pending = 0,
+                    id_format_t ids = id_format_t::UUID)
+                : timeout(timeout), max_pending(max_pending), ids(ids) {};
+            };
+
+            /** Shape of the value returned by a get.
+             *
+             * Options are sent along with remote gets in params, as
+             * "max_depth", "fields", "keys_only" and "revision", and applied
+             * by the store holding the data.
+             */
+            struct get_opts_t {
+                /** Levels of the value to return.  Objects and arrays below
+                 * the limit are returned empty.  One returns the children of
+                 * the path without their contents.  Zero is unlimited.
+                 */
+                unsigned int max_depth;
+
+                /** Return only these dot separated paths, relative to the
+                 * requested path, at their place in the value.  Missing
+                 * fields are left out.  Empty returns every field.
+                 */
+                std::vector<std::string> fields;
+
+                /** Return an array of the keys of an object, or the indices
+                 * of an array, instead of the value.  Overrides max_depth and
+                 * fields.
+                 */
+                bool keys_only;
+
+                /** Revision the caller already holds.  If the value still
+                 * has it, the reply carries no value and has
+                 * params["not_modified"] set.  Zero always returns the value.
+                 * Gets with a revision bypass mirrors.
+                 */
+                uint64_t revision;
+
+                get_opts_t(
+                    unsigned int max_depth = 0,
+                    std::vector<std::string> fields = std::vector<std::string>(),
+                    bool keys_only = false,
+                    uint64_t revision = 0)
+                : max_depth(max_depth), fields(std::move(fields)), keys_only(keys_only),
+                  revision(revision) {};
+            };
+
             /** Initializes the local store with data.
              *
              * @param [in] data json to store.
+             * @param [in] opts options for requests made by this store.
              */
-            explicit Datastore(const nlohmann::json &data = nlohmann::json::object())
-            : m_local_data(data) {};
+            explicit Datastore(
+                const nlohmann::json &data = nlohmann::json::object(),
+                const request_opts_t &opts = request_opts_t());
+
+            ~Datastore();
+
+#ifdef ENTANGLD_CONCURRENT
+            Datastore(const Datastore&) = delete;
+            Datastore &operator=(const Datastore&) = delete;
+#endif
 
             /** Delete all subscriptions and detach from namespaces. */
             void reset();
@@ -37,20 +267,172 @@ namespace entangld
              * @param [in] callback function to call when data is ready.
              * @param [in] callback_ctx user context passed to callback. May be null.
              * @param [in] uuid unique request identifier. Will be generated if empty.
+             * @param [in] opts shape of the returned value.
              */
             void get(
-                std::string path,
+                const Path &path,
                 void (*callback)(const Message &msg, void *ctx),
                 void *callback_ctx = nullptr,
-                std::string uuid = "");
+                const std::string &uuid = "",
+                const get_opts_t &opts = get_opts_t());
+
+            /** Asyncronously retrieves a value from the store.
+             *
+             * A remote get made while an identical one is waiting shares its
+             * reply, or its timeout, instead of sending another request.
+             *
+             * @param [in] path location of the data to be retrieved.
+             * @param [in] callback callable to call when data is ready.
+             * @param [in] uuid unique request identifier. Will be generated if empty.
+             * @param [in] opts shape of the returned value.
+             */
+            void get(
+                const Path &path,
+                callback_t callback,
+                const std::string &uuid = "",
+                const get_opts_t &opts = get_opts_t());
+
+            /** Returns the number of get requests waiting on remotes. */
+            size_t pending_requests() const;
+
+            /** Returns the revision of a local path.
+             *
+             * Every local write takes the next revision of the store, which
+             * becomes the revision of the written path, its parents and
+             * everything beneath it.  "value" and "event" Messages carry the
+             * revision of their path.
+             *
+             * @param [in] path local path.
+             * @return revision of the last write affecting path, zero if
+             * it was never written.
+             */
+            uint64_t revision(const Path &path) const;
+
+            /** Completes an RPC with its result.
+             *
+             * May be called from inside the handler or later, but only once
+             * and before the store is destroyed.  With ENTANGLD_CONCURRENT
+             * it may be called from any thread.
+             */
+            typedef std::function<void(const nlohmann::json &result)> reply_t;
+
+            /** Handles calls to an RPC.
+             *
+             * @param [in] args arguments of the call, null for a get.
+             * @param [in] reply function to call with the result.
+             */
+            typedef std::function<void(const nlohmann::json &args, reply_t reply)> rpc_t;
+
+            /** Registers a procedure at a path.
+             *
+             * A call or get of the exact path runs rpc instead of reading the
+             * data there, both locally and for remotes.  The handler runs like
+             * any other callback, without the lock and on the executor if one
+             * is set, so a long running handler should reply from elsewhere
+             * instead of blocking.
+             *
+             * @param [in] path location of the procedure.
+             * @param [in] rpc handler to call, or null to remove it.
+             */
+            void set_rpc(const Path &path, rpc_t rpc);
+
+            /** Computes the value of a path on demand. */
+            typedef std::function<nlohmann::json()> provider_t;
+
+            /** Registers a provider that computes the value at a path.
+             *
+             * The provider is only run when its value is needed: by a get of
+             * its path, a parent or a child once the cached value is older
+             * than ttl, and by poll() while a subscription covers the path.
+             * Subscribers are notified when the computed value changes.
+             * Providers run with the lock held, so they must not call back
+             * into the store, and are not observed by the write hook.
+             *
+             * @param [in] path location of the computed value.
+             * @param [in] provider function computing the value, or null to
+             * remove it.  The last computed value is left in place.
+             * @param [in] ttl how long a computed value is served.  Zero
+             * computes it for every get and poll.
+             */
+            void set_provider(
+                const Path &path,
+                provider_t provider,
+                std::chrono::milliseconds ttl = std::chrono::milliseconds(0));
+
+            /** Asyncronously calls a procedure.
+             *
+             * Local calls hand args to the handler without encoding them.
+             * Remote calls are sent as a "call" Message with args in params,
+             * and share the timeout and max_pending of gets.  Paths without
+             * a procedure answer with their value, like a get.
+             *
+             * @param [in] path location of the procedure.
+             * @param [in] args arguments passed to the handler.
+             * @param [in] callback function to call with a "value" Message
+             * holding the result, or a "timeout" Message.
+             * @param [in] callback_ctx user context passed to callback. May be null.
+             * @param [in] uuid unique request identifier. Will be generated if empty.
+             */
+            void call(
+                const Path &path,
+                nlohmann::json args,
+                void (*callback)(const Message &msg, void *ctx),
+                void *callback_ctx = nullptr,
+                const std::string &uuid = "");
+
+            /** Asyncronously calls a procedure.
+             *
+             * @param [in] path location of the procedure.
+             * @param [in] args arguments passed to the handler.
+             * @param [in] callback callable to call with a "value" Message
+             * holding the result, or a "timeout" Message.
+             * @param [in] uuid unique request identifier. Will be generated if empty.
+             */
+            void call(
+                const Path &path,
+                nlohmann::json args,
+                callback_t callback,
+                const std::string &uuid = "");
 
             /** Sets a value in a store.
              *
              * @param [in] path location of the data to be modified.
              * @param [in] value new data to be set.
              * @param [in] push append value instead of overwriting.
+             * @param [in] limit keep at most this many elements after a push,
+             * dropping the oldest.  Zero is unbounded.
              */
-            void set(std::string path, nlohmann::json value, bool push=false);
+            void set(const Path &path, const nlohmann::json &value, bool push=false, size_t limit=0);
+
+            /** Sets a value in a store, taking ownership of the value.
+             *
+             * The value is moved into the local store or outgoing Message
+             * instead of being copied.
+             *
+             * @param [in] path location of the data to be modified.
+             * @param [in] value new data to be set.
+             * @param [in] push append value instead of overwriting.
+             * @param [in] limit keep at most this many elements after a push,
+             * dropping the oldest.  Zero is unbounded.
+             */
+            void set(const Path &path, nlohmann::json &&value, bool push=false, size_t limit=0);
+
+            /** Starts a batch of writes.
+             *
+             * Until the matching commit(), set and push still modify the local
+             * store immediately but subscriptions are not notified, and writes
+             * to remote stores are held back.  Batches may be nested, only the
+             * outermost commit() takes effect.
+             */
+            void begin();
+
+            /** Ends a batch of writes.
+             *
+             * Every subscription affected by the batch is notified once with
+             * its final value, and the writes held back for each remote are
+             * sent as a single "batch" Message.
+             */
+            void commit();
 
             /** Registers a function to be called when a path changes.
              *
@@ -58,61 +440,382 @@ namespace entangld
              * @param [in] callback function to call when new data is ready.
              * @param [in] callback_ctx user context passed to callback. May be null.
              * @param [in] uuid unique request identifier.  Will be generated if empty.
+             * @param [in] policy delivery policy.  For remote paths the policy
+             * is forwarded and applied by the remote.
              */
             void subscribe(
-                std::string path,
+                const Path &path,
                 void (*callback)(const Message &msg, void *ctx),
                 void *callback_ctx = nullptr,
-                std::string uuid = "");
+                const std::string &uuid = "",
+                const policy_t &policy = policy_t());
+
+            /** Registers a callable to be called when a path changes.
+             *
+             * Remote subscriptions with the same path and policy share one
+             * subscription on the remote, which is unsubscribed when the last
+             * of them is.  Each still receives events with its own uuid.
+             *
+             * @param [in] path highest level that should trigger the callback.
+             * @param [in] callback callable to call when new data is ready.
+             * @param [in] uuid unique request identifier.  Will be generated if empty.
+             * @param [in] policy delivery policy.  For remote paths the policy
+             * is forwarded and applied by the remote.
+             */
+            void subscribe(
+                const Path &path,
+                callback_t callback,
+                const std::string &uuid = "",
+                const policy_t &policy = policy_t());
 
             /** Unsubscribe from a path.
              *
              * @param [in] path subscription path to unsubscribe.
              * @param [in] uuid original subscription identifier if known.
              */
-            int unsubscribe(std::string path, std::string uuid="");
+            int unsubscribe(const Path &path, const std::string &uuid="");
+
+            /** Runs callbacks, handlers and writers on an executor.
+             *
+             * Subscriber and get callbacks keep their order, as does the
+             * output of each remote.  Replies to the requests of remotes are
+             * sent from these tasks, so executors that run tasks on other
+             * threads, such as ThreadExecutor and PoolExecutor, are only
+             * accepted with ENTANGLD_CONCURRENT.
+             *
+             * @param [in] executor executor to use, or null to run inline.
+             * Must outlive the store and every task it was given.
+             * @return false if the executor was rejected, leaving the
+             * previous one in place.
+             */
+            bool set_executor(Executor *executor);
+
+            /** Defines a callback that observes writes to the local store.
+             *
+             * @param [in] path location that was written.
+             * @param [in] value value written, or the element appended by a push.
+             * @param [in] push true if value was appended to path.
+             * @param [in] limit limit of a push, zero if unbounded.
+             * @param [in] ctx user context.
+             */
+            typedef void (*write_hook_t)(
+                const Path &path, const nlohmann::json &value, bool push, size_t limit, void *ctx);
+
+            /** Observes every set and push applied to the local store.
+             *
+             * A push is observed with its limit, so repeating it with
+             * push(path, value, limit) drops the same elements.
+             *
+             * The hook runs inline with the lock held, in the order the writes
+             * were applied, so it must be quick and must not call back into
+             * the store.  Writes forwarded to remotes are not observed.
+             *
+             * @param [in] hook callback to call, or null to remove it.
+             * @param [in] ctx user context passed to hook.
+             */
+            void set_write_hook(write_hook_t hook, void *ctx = nullptr);
+
+            /** Only notify subscribers of writes that change a value.
+             *
+             * Each local set is compared with the value it replaces as it is
+             * copied in.  A set that changes nothing is dropped: subscribers
+             * are not called, remote subscribers are not sent an event and
+             * the write hook does not see it.  Subscriptions beneath the
+             * written path are only called if their part of the value
+             * changed.  Pushes always count as a change, and writes inside a
+             * batch notify every subscription beneath a changed path.
+             *
+             * @param [in] enabled true to compare writes, false to notify on every write.
+             */
+            void set_change_detection(bool enabled);
+
+            /** Calls visitor with the local data.
+             *
+             * No write is applied while visitor runs, so what it sees is
+             * consistent with the writes seen by the write hook so far.
+             * visitor must not call back into the store.
+             *
+             * @param [in] visitor function to call.
+             */
+            void visit(const std::function<void(const nlohmann::json &data)> &visitor) const;
+
+#ifdef ENTANGLD_STATS
+            /** Latency histogram with power of two buckets.
+             *
+             * Bucket 0 counts durations under 1us and bucket i those under
+             * 2^i us, the last bucket also takes everything longer.
+             */
+            struct histogram_t {
+                /** Number of buckets. */
+                static const size_t BUCKETS = 24;
+
+                uint64_t buckets[BUCKETS] = {}; /**< Samples per bucket. */
+                uint64_t count = 0;             /**< Number of samples. */
+                uint64_t sum_ns = 0;            /**< Total of every sample. */
+                uint64_t max_ns = 0;            /**< Longest sample. */
+
+                /** Adds a sample. */
+                void record(uint64_t ns);
+
+                /** Returns an upper bound of the pth percentile, in nanoseconds.
+                 *
+                 * @param [in] p percentile between 0 and 100.
+                 * @return the upper edge of the bucket holding it, or max_ns
+                 * if that is lower.  Zero without samples.
+                 */
+                uint64_t percentile(double p) const;
+            };
+
+            /** Traffic exchanged with one remote. */
+            struct remote_stats_t {
+                std::string name;       /**< Namespace of the remote. */
+                uint64_t msgs_in = 0;   /**< Messages received. */
+                uint64_t msgs_out = 0;  /**< Messages sent, batched Messages count once each. */
+                uint64_t bytes_in = 0;  /**< Bytes consumed by receive(data, size, name). */
+                uint64_t bytes_out = 0; /**< Bytes framed for a writer_t. */
+            };
+
+            /** Time spent in the local callbacks of one event path. */
+            struct sub_stats_t {
+                std::string path;       /**< Path events were delivered for. */
+                histogram_t latency;    /**< Callback durations. */
+            };
+
+            /** Counters returned by stats(). */
+            struct stats_t {
+                uint64_t gets = 0;          /**< Calls to get. */
+                uint64_t sets = 0;          /**< Calls to set, excluding pushes. */
+                uint64_t pushes = 0;        /**< Calls to set with push. */
+                uint64_t events = 0;        /**< Events delivered to local callbacks. */
+                uint64_t received = 0;      /**< Messages received from remotes. */
+                uint64_t transmitted = 0;   /**< Messages sent to remotes. */
+                size_t subscriptions = 0;   /**< Active subscriptions. */
+                size_t pending_requests = 0;/**< Gets waiting on remotes. */
+
+                /** Duration of every local get and event callback. */
+                histogram_t callback_latency;
+
+                /** Time taken to notify subscribers of a local write. */
+                histogram_t fanout_latency;
+
+                /** Traffic of each remote seen since the last reset, by name. */
+                std::vector<remote_stats_t> remotes;
+
+                /** Event paths by total callback time, slowest first. */
+                std::vector<sub_stats_t> subscribers;
+            };
+
+            /** Returns the counters collected since construction or reset_stats().
+             *
+             * Only available when built with ENTANGLD_STATS.  Timed callbacks
+             * include any time spent queued on an executor.
+             */
+            stats_t stats() const;
+
+            /** Zeroes every counter and histogram. */
+            void reset_stats();
+#endif
+
+            /** Sends Messages queued for remotes.
+             *
+             * Should be called once per event loop iteration when remotes are
+             * attached with max_batch set.  Also retries writers that would
+             * block and sends the Messages held for them.
+             *
+             * @param [in] name remote to flush.  Flushes every remote if empty.
+             */
+            void flush(const std::string &name="");
+
+            /** Outbound queue of one remote, returned by queue_stats(). */
+            struct queue_stats_t {
+                size_t queued = 0;          /**< Messages held while blocked. */
+                size_t pending_bytes = 0;   /**< Bytes the writer_t has yet to take. */
+                uint64_t dropped = 0;       /**< Messages lost to overflow. */
+                uint64_t coalesced = 0;     /**< Events replaced by a later one. */
+                bool blocked = false;       /**< True while Messages are being held. */
+            };
+
+            /** Returns the outbound queue of a remote.
+             *
+             * @param [in] name namespace of the remote.
+             * @return queue depth and overflow counters. Zeroed if name is not attached.
+             */
+            queue_stats_t queue_stats(const std::string &name) const;
+
+            /** Blocks or unblocks a remote.
+             *
+             * While blocked, Messages for the remote are held in its queue
+             * and opts.overflow applies once max_queue is reached.  Meant for
+             * Message handlers, which cannot report that their transport
+             * would block: the handler keeps the Message it was given and
+             * later ones are held.  Unblocking sends the queue.
+             *
+             * @param [in] name namespace of the remote.
+             * @param [in] blocked true to hold Messages, false to send them.
+             */
+            void set_blocked(const std::string &name, bool blocked);
+
+            /** Services time based work.
+             *
+             * Delivers the trailing value of rate limited subscriptions whose
+             * interval has expired, times out get requests past their
+             * deadline and flushes queued Messages.  Writers that would
+             * block are retried, and remotes that overflowed with
+             * overflow_t::DISCONNECT are detached.  Should be called
+             * periodically, at least as often as the shortest subscription
+             * interval.
+             *
+             * @param [in] now current time.
+             */
+            void poll(clock::time_point now = clock::now());
 
             /** Attach to a remote store.
              *
              * @param [in] name namespace to use for this remote.
              * @param [in] handler function that handles sending a Message to the remote.
              * @param [in] ctx user context passed to handler. May be null.
+             * @param [in] opts outbound options for this remote.
+             */
+            void attach(
+                const std::string &name,
+                Message::handler_t handler,
+                void *ctx=nullptr,
+                const remote_opts_t &opts=remote_opts_t());
+
+            /** Attach to a remote store over a byte transport.
+             *
+             * Messages are encoded and framed with opts.format.  When
+             * queueing is enabled the frames are concatenated so that each
+             * flush is a single call to writer.  Received bytes should be
+             * passed to receive(data, size, name).
+             *
+             * @param [in] name namespace to use for this remote.
+             * @param [in] writer function that writes bytes to the remote.
+             * @param [in] ctx user context passed to writer. May be null.
+             * @param [in] opts outbound options for this remote.
              */
-            void attach(std::string name, Message::handler_t handler, void *ctx=nullptr);
+            void attach(
+                const std::string &name,
+                writer_t writer,
+                void *ctx=nullptr,
+                const remote_opts_t &opts=remote_opts_t());
 
             /** Detach from a remote store.
+             *
+             * Requests still waiting on the remote are called back with a
+             * "timeout" Message.  Subscriptions held on the remote, including
+             * a mirror, and those the remote made on this store, are removed.
              *
              * @param [in] name namespace to detach from.
              */
-            void detach(std::string name);
+            void detach(const std::string &name);
 
             /** Should be called on messages received from an attached remote.
              *
              * @param [in] msg Message object to process.
              * @param [in] name namespace of the remote where msg originated.
              */
-            void receive(const Message &msg, std::string name);
+            void receive(const Message &msg, const std::string &name);
+
+            /** Should be called on messages received from an attached remote.
+             *
+             * Moves the payload of set and push messages into the store.
+             *
+             * @param [in] msg Message object to process.
+             * @param [in] name namespace of the remote where msg originated.
+             */
+            void receive(Message &&msg, const std::string &name);
+
+            /** Should be called on bytes received from a remote attached with a writer_t.
+             *
+             * Decodes and processes every complete frame.  Bytes belonging
+             * to an incomplete trailing frame are not consumed and should be
+             * passed again once more data has arrived.
+             *
+             * @param [in] data received bytes.
+             * @param [in] size number of bytes.
+             * @param [in] name namespace of the remote where the data originated.
+             * @return number of bytes consumed.
+             * @throws nlohmann::json::exception if a frame is malformed.
+             */
+            size_t receive(const uint8_t *data, size_t size, const std::string &name);
 
             /** Push a value to an existing array.
+             *
+             * Equivalent to calling set with push=true.  With a limit the
+             * array holds a sliding window of the latest values: the oldest
+             * are dropped in place, so a full window does not reallocate,
+             * and subscribers and remotes are sent the window rather than an
+             * ever growing history.
+             *
+             * @param [in] path location of the data to be modified.
+             * @param [in] value new data to be pushed.
+             * @param [in] limit maximum number of elements to keep. Zero is unbounded.
+             */
+            inline void push(const Path &path, const nlohmann::json &value, size_t limit=0)
+            {
+                set(path, value, true, limit);
+            }
+
+            /** Push a value to an existing array, taking ownership of the value.
              *
              * Equivalent to calling set with push=true.
              *
              * @param [in] path location of the data to be modified.
              * @param [in] value new data to be pushed.
+             * @param [in] limit maximum number of elements to keep. Zero is unbounded.
              */
-            inline void push(std::string path, nlohmann::json value)
+            inline void push(const Path &path, nlohmann::json &&value, size_t limit=0)
             {
-                set(path, value, true);
+                set(path, std::move(value), true, limit);
             }
 
         protected:
+            /** Writer of a remote, shared with writes waiting to run. */
+            struct outlet_t {
+                writer_t writer;                /**< Write bytes to the remote. */
+                void *ctx;                      /**< User context passed to writer. */
+                std::mutex lock;                /**< Protects pending and orders writes. */
+                std::vector<uint8_t> pending;   /**< Bytes writer did not take. */
+                std::atomic<bool> would_block;  /**< True while pending is being retried. */
+
+                outlet_t(writer_t writer, void *ctx)
+                : writer(writer), ctx(ctx), would_block(false) {};
+            };
+
             /** Represents a remote store. */
             typedef struct {
                 std::string name;           /**< Namespace the store is mapped to. */
                 Message::handler_t handler; /**< Send a Message to this remote. */
                 void *handler_ctx;          /**< User context passed to handler. */
+                writer_t writer;            /**< Write bytes to this remote. Replaces handler. */
+                std::shared_ptr<outlet_t> outlet; /**< Flow state of writer. */
+                Datastore *owner;           /**< Store the remote is attached to. */
+                remote_opts_t opts;         /**< Outbound options. */
+                std::vector<Message> queue; /**< Messages waiting to be flushed. */
+                std::vector<uint8_t> buffer;/**< Frames waiting to be written. */
+                size_t frames;              /**< Number of frames in buffer. */
+                std::string mirror_uuid;    /**< Subscription updating mirror. Empty if not mirrored. */
+                nlohmann::json mirror;      /**< Local copy of the remote store. */
+                bool mirror_ready;          /**< True once mirror holds a snapshot. */
+                clock::time_point heard;    /**< Last event or reply from the remote. */
+                std::deque<Message> backlog;/**< Messages held while blocked. */
+                bool blocked;               /**< Blocked by set_blocked(). */
+                bool overflowed;            /**< Overflowed with DISCONNECT, detached by poll(). */
+                uint64_t dropped;           /**< Messages lost to overflow. */
+                uint64_t coalesced;         /**< Events replaced by a later one. */
             } remote_t;
 
+            /** A subscription held on a remote, shared by identical local subscriptions. */
+            typedef struct {
+                std::string key;            /**< Entry in m_upstreams. */
+                remote_t *remote;           /**< The remote that holds the data. */
+                Message msg;                /**< The subscribe Message sent to the remote. */
+                size_t refs;                /**< Local subscriptions sharing it. */
+                nlohmann::json mirror;      /**< Value rebuilt from patches in delta mode. */
+                bool ready;                 /**< True once mirror holds a snapshot. */
+            } upstream_t;
+
             /** Represents a request for data. */
             typedef struct {
                 /** The original Message that generated the request. */
@@ -121,51 +824,722 @@ namespace entangld
                 /** The remote that holds the data. If null, data is local. */
                 remote_t *remote;
 
+                /** The remote this subscription forwards events to, if it
+                 * was made on behalf of one.
+                 */
+                remote_t *origin;
+
                 /** The local data pointer.  Only valid if remote is null. */
                 nlohmann::json::json_pointer ptr;
 
                 /** Function to call when new data is available. */
-                void (*callback)(const Message &msg, void *ctx);
+                callback_t callback;
+
+                /** Delivery policy. Only applied to local subscriptions. */
+                policy_t policy;
+
+                /** Number of changes seen, used by policy.every. */
+                unsigned int count;
+
+                /** Time of the last delivery, used by policy.interval. */
+                clock::time_point last;
 
-                /** User context passed to callback. */
-                void *callback_ctx;
+                /** False once a delta subscription missed a change. */
+                bool synced;
+
+                /** Shared subscription on the remote.  Null if data is local. */
+                upstream_t *upstream;
+
+                /** Removed while subscribers were being called, erased once they return. */
+                bool dead;
             } request_t;
 
-            /** Returns the remote namespace of a path.
+            /** Node of the subscription index.
+             *
+             * Subscriptions are stored on the node matching their path, so a
+             * change only visits the ancestors and descendants of the path
+             * that was written.  Remote subscriptions are indexed under their
+             * namespace.
+             */
+            struct sub_node_t {
+                /** Parent node. Null for the root. */
+                sub_node_t *parent = nullptr;
+
+                /** Path segment of this node. */
+                std::string key;
+
+                /** Child nodes keyed by path segment. */
+                std::unordered_map<std::string, std::unique_ptr<sub_node_t>> children;
+
+                /** Subscriptions on this exact path. */
+                std::list<request_t> subs;
+
+                /** Last write stamp that changed the value at this node. */
+                unsigned long stamp = 0;
+            };
+
+            /** Returns the index node for a list of path segments.
+             *
+             * @param [in] segments path split on '.'.
+             * @param [in] create add missing nodes if true.
+             * @return the node, or null if it does not exist and create is false.
+             */
+            sub_node_t *find_node(const std::vector<std::string> &segments, bool create);
+
+            /** Removes a subscription from its index node.
+             *
+             * The last subscription sharing an upstream subscription
+             * unsubscribes it on the remote.
+             *
+             * @param [in] node node holding the subscription.
+             * @param [in] it subscription to remove.
+             * @param [in] detaching remote being detached, which is not sent
+             * an unsubscribe.
+             * @return iterator to the next subscription on node.  During a
+             * fan-out the subscription is marked dead instead of erased.
+             */
+            std::list<request_t>::iterator remove_sub(
+                sub_node_t *node,
+                std::list<request_t>::iterator it,
+                const remote_t *detaching = nullptr);
+
+            /** Frees a node and its ancestors once they hold no subscriptions.
+             *
+             * Deferred until the outermost fan-out ends.
+             *
+             * @param [in] node first node to check.
+             */
+            void prune(sub_node_t *node);
+
+            /** Scope in which subscription callbacks may run inline.
+             *
+             * Callbacks may unsubscribe while their list and index nodes are
+             * being walked, so removals only mark subscriptions dead and the
+             * outermost scope erases them and prunes their nodes.
+             */
+            class fanout_t;
+
+            /** Number of open fan-out scopes. */
+            unsigned int m_fanout_depth = 0;
+
+            /** Nodes holding dead subscriptions or waiting to be pruned. */
+            std::vector<sub_node_t*> m_swept;
+
+            /** Erases dead subscriptions and prunes the nodes left empty. */
+            void sweep();
+
+            /** Collects the index nodes affected by a write to a path.
+             *
+             * These are the nodes on the path, its ancestors and everything
+             * beneath it.
+             *
+             * @param [in] path location that was written.
+             * @param [out] nodes list to append affected nodes to.
+             * @param [in,out] seen if not null, nodes already collected by a
+             * previous call are skipped.
+             * @param [in] stamp if not zero, nodes beneath the path are only
+             * collected if the write stamped them as changed.
+             */
+            void collect(
+                const Path &path,
+                std::vector<sub_node_t*> &nodes,
+                std::unordered_set<sub_node_t*> *seen = nullptr,
+                unsigned long stamp = 0);
+
+            /** Notifies local subscriptions affected by a write.
+             *
+             * Deferred until commit() while a batch is open.
+             *
+             * @param [in] path location that was written.
+             * @param [in] push true if a value was appended to path.
+             * @param [in] stamp write stamp from assign(), or zero if every
+             * node beneath the path changed.
+             */
+            void notify_path(const Path &path, bool push = false, unsigned long stamp = 0);
+
+            /** Copies a value over another, stamping the index nodes whose value changed.
              *
-             * Checks all registered namespaces and returns if one matches the path.
+             * Works like overwrite(), walking the subscription index beneath
+             * the written path alongside the value, and reports whether
+             * anything differed.  Leaves are compared as they are copied, so
+             * no separate pass over the value is made.
              *
-             * @param [in] path string to search.
+             * @param [in,out] dst value in the local store.
+             * @param [in] src new value.
+             * @param [in] node index node of dst, or null.
+             * @param [in] stamp stamp to mark changed nodes with.
+             * @return true if dst changed.
              */
-            std::string parse_namespace(std::string path);
+            static bool assign(
+                nlohmann::json &dst, const nlohmann::json &src, sub_node_t *node, unsigned long stamp);
+
+            /** Stamps an index node and everything beneath it. */
+            static void stamp_all(sub_node_t *node, unsigned long stamp);
 
-            /** Send Message to remote.
+            /** Sends a Message to a remote, or holds it back while a batch is open.
              *
              * @param [in] remote handler to call.
              * @param [in] msg Message object to send.
              */
-            static inline void transmit(remote_t *remote, const Message &msg)
-            {
-                remote->handler(msg, remote->handler_ctx);
-            }
+            void send(remote_t *remote, Message &&msg);
+
+            /** Calls the local subscriptions on a node with its current value.
+             *
+             * The event is built once per node, so every subscriber on the
+             * same path receives the same Message rather than its own copy of
+             * the subtree, also when the calls are deferred.  Delta subscriptions share a patch built from the
+             * written paths instead.
+             *
+             * @param [in] node index node to notify.
+             * @param [in] changed paths that were written.
+             * @param [in] count number of paths in changed.
+             * @param [in] push true if the only path had a value appended.
+             * @param [in,out] msg storage for the event, reused between calls.
+             */
+            void notify(sub_node_t *node, const Path *changed, size_t count, bool push, Message &msg);
+
+            /** Buffers reused by notifications, so steady writes do not allocate. */
+            typedef struct {
+                std::vector<sub_node_t*> nodes; /**< Index nodes affected by a write. */
+                Message event;                  /**< Event shared by a node's subscribers. */
+            } scratch_t;
+
+            /** Scratch buffers, one per level of nested notifications.
+             *
+             * Callbacks may write to the store while a notification is still
+             * running, so every level keeps buffers of its own.
+             */
+            std::vector<std::unique_ptr<scratch_t>> m_scratch;
+
+            /** Number of scratch buffers in use. */
+            size_t m_scratch_depth = 0;
+
+            /** Claims the scratch buffers of the next nesting level. */
+            scratch_t &claim_scratch();
+
+            /** Releases the scratch buffers claimed last. */
+            void release_scratch();
+
+            /** Builds the patch a write makes to the subscriptions on a node.
+             *
+             * @param [in] node index node the patch is relative to.
+             * @param [in] changed paths that were written.
+             * @param [in] count number of paths in changed.
+             * @param [in] push true if the only path had a value appended.
+             * @return RFC 6902 operations.
+             */
+            nlohmann::json make_patch(sub_node_t *node, const Path *changed, size_t count, bool push);
+
+            /** Returns a patch replacing the whole value of a local subscription. */
+            nlohmann::json snapshot(const request_t &sub) const;
+
+            /** Calls a delta subscription with a patch.
+             *
+             * Subscriptions made for a remote only carry the patch, local
+             * callbacks also get the current value.
+             *
+             * @param [in] sub subscription to notify.
+             * @param [in] patch operations to send.
+             */
+            void deliver_patch(const request_t &sub, nlohmann::json patch);
+
+            /** Applies the delivery policy of a local subscription to a change.
+             *
+             * @param [in] sub subscription that matched the change.
+             * @param [in,out] now current time, read from the clock on first use.
+             * @return true if the subscription should be called.
+             */
+            bool admit(request_t &sub, clock::time_point &now);
+
+            /** Calls a single local subscription with its current value.
+             *
+             * Delta subscriptions are sent a snapshot.
+             *
+             * @param [in] sub subscription to notify.
+             */
+            void deliver(request_t &sub);
+
+            /** Subscribes to the whole store of a mirrored remote.
+             *
+             * @param [in] remote remote attached with opts.mirror set.
+             */
+            void start_mirror(remote_t *remote);
+
+            /** Unsubscribes from the store of a mirrored remote.
+             *
+             * @param [in] remote remote to stop mirroring.
+             */
+            void stop_mirror(remote_t *remote);
+
+            /** Answers a get from a remote's mirror if it is fresh.
+             *
+             * @param [in] remote remote holding the path.
+             * @param [in] path requested path.
+             * @param [in] depth number of segments in the remote namespace.
+             * @param [in] callback callable to call with the value.
+             * @param [in] uuid unique request identifier. Will be generated if empty.
+             * @param [in] opts shape of the returned value.
+             * @return false if the get must go to the remote.
+             */
+            bool get_mirror(
+                const remote_t *remote,
+                const Path &path,
+                size_t depth,
+                callback_t &callback,
+                const std::string &uuid,
+                const get_opts_t &opts);
+
+            /** Returns the remote that holds a path.
+             *
+             * Looks the path up in the routing table, preferring the longest
+             * matching namespace, and caches the match on the path until the
+             * namespaces change.
+             *
+             * @param [in] path path to resolve.
+             * @param [out] depth number of path segments naming the remote.
+             * @return the remote, or null if the path is local.
+             */
+            remote_t *resolve(const Path &path, size_t &depth);
+
+            /** Answers a get from the local store. */
+            void get_local(
+                const Path &path, callback_t &&callback, const std::string &uuid, const get_opts_t &opts);
+
+            /** Runs the procedure registered at a local path.
+             *
+             * @param [in] path location of the procedure.
+             * @param [in] args arguments passed to the handler.
+             * @param [in] callback callable to call with the result.
+             * @param [in] uuid unique request identifier. Will be generated if empty.
+             * @param [in] opts shape of the returned result.
+             * @return false if there is no procedure at path.
+             */
+            bool call_local(
+                const Path &path,
+                nlohmann::json &&args,
+                callback_t &&callback,
+                const std::string &uuid,
+                const get_opts_t &opts);
+
+            /** Sends a request to a remote and waits for its reply in a slot.
+             *
+             * @param [in] remote remote to send the request to.
+             * @param [in] type Message type, "get" or "call".
+             * @param [in] path path relative to the remote.
+             * @param [in] params Message params.
+             * @param [in] uuid unique request identifier. Will be generated if empty.
+             * @param [in] callback callable to call with the reply.
+             * @param [in] key entry in m_inflight that identical requests
+             * may share the reply through, or empty.
+             */
+            void request(
+                remote_t *remote,
+                const char *type,
+                std::string &&path,
+                nlohmann::json &&params,
+                const std::string &uuid,
+                callback_t &&callback,
+                std::string &&key);
+
+            /** Sends the answer to a remote's get or call back to it.
+             *
+             * May run after the remote was detached, which drops the reply.
+             *
+             * @param [in] name remote that asked.
+             * @param [in] msg local reply.
+             */
+            void respond(const std::string &name, const Message &msg);
+
+            /** Registers a subscription.
+             *
+             * @param [in] origin remote the subscription was made for, or null.
+             */
+            void add_sub(
+                const Path &path,
+                callback_t &&callback,
+                const std::string &uuid,
+                const policy_t &policy,
+                remote_t *origin);
+
+            /** Removes every subscription held on or made for a remote. */
+            void remove_subs(const remote_t *remote);
+
+            /** Calls a callback, or hands it to the executor.
+             *
+             * Queued until the lock is released in concurrent builds.
+             *
+             * @param [in] callback function to call.
+             * @param [in] msg Message to pass to callback.
+             * @param [in] key executor ordering key. Defaults to this store.
+             */
+            void dispatch(const callback_t &callback, const Message &msg, const void *key = nullptr);
+
+            /** Calls a callback, or hands it to the executor.
+             *
+             * @param [in] callback function to call.
+             * @param [in] msg Message to pass to callback, may be moved from.
+             * @param [in] key executor ordering key. Defaults to this store.
+             */
+            void dispatch(const callback_t &callback, Message &&msg, const void *key = nullptr);
+
+            /** Calls a callback with an event shared by several subscribers.
+             *
+             * Inline calls are passed msg.  Deferred calls share one copy of
+             * it, made by the first of them, and set uuid just before each
+             * call.  They are all ordered by this store, so never overlap.
+             *
+             * @param [in] callback function to call.
+             * @param [in,out] msg event to pass to callback, uuid is set.
+             * @param [in,out] shared copy of msg for deferred calls, made if null.
+             * @param [in] uuid subscription the event is for.
+             */
+            void dispatch(
+                const callback_t &callback,
+                Message &msg,
+                std::shared_ptr<Message> &shared,
+                const std::string &uuid);
+
+            /** Sets the uuid of a shared event and calls callback with it. */
+            static void call_shared(
+                const callback_t &callback, const std::shared_ptr<Message> &msg, const std::string &uuid);
+
+            /** Calls a writer, or hands it to the executor.
+             *
+             * @param [in] outlet writer to call.
+             * @param [in] data bytes to write, emptied if they were taken.
+             * @param [in] key executor ordering key.
+             */
+            void dispatch(const std::shared_ptr<outlet_t> &outlet, std::vector<uint8_t> &data, const void *key);
+
+            /** Writes bytes after those an earlier write left pending.
+             *
+             * A writer returning a positive count keeps that many trailing
+             * bytes pending and blocks the remote until a retry takes them.
+             *
+             * @param [in] outlet writer to call.
+             * @param [in] data bytes to write. May be empty to retry.
+             */
+            static void write(const std::shared_ptr<outlet_t> &outlet, const std::vector<uint8_t> &data);
+
+            /** Returns a callback that calls the handler of a remote. */
+            static callback_t handler_of(const remote_t *remote);
+
+            /** Executor for callbacks, or null to run them inline. */
+            Executor *m_executor = nullptr;
+
+            /** Observer of local writes. */
+            write_hook_t m_write_hook = nullptr;
+
+            /** Drop writes that leave the local store unchanged. */
+            bool m_only_changes = false;
+
+            /** Stamp of the last write made with m_only_changes. */
+            unsigned long m_write_stamp = 0;
+
+            /** Context passed to m_write_hook. */
+            void *m_write_hook_ctx = nullptr;
+
+            /** Scoped lock that lets methods of the same store nest. */
+            class guard_t;
+
+            /** Counts a Message received from a remote, when built with ENTANGLD_STATS. */
+            void count_received(const std::string &name);
+
+#ifdef ENTANGLD_STATS
+            /** Counters behind stats(), shared with callbacks queued on executors. */
+            struct counters_t;
+
+            /** Counters of this store. */
+            std::shared_ptr<counters_t> m_counters;
+
+            /** Calls a local callback and records how long it took.
+             *
+             * @param [in] counters counters to update.
+             * @param [in] callback callable to call.
+             * @param [in] msg Message passed to callback.
+             */
+            static void invoke(
+                const std::shared_ptr<counters_t> &counters, const callback_t &callback, const Message &msg);
+#endif
+
+            /** Send Message to remote, or hold it while the remote is blocked.
+             *
+             * @param [in] remote handler to call.
+             * @param [in] msg Message object to send.
+             */
+            static void transmit(remote_t *remote, const Message &msg);
+
+            /** Send Message to remote regardless of blocking.
+             *
+             * The Message is queued instead if the remote batches its output.
+             * Remotes attached with a writer_t get the Message encoded.
+             *
+             * @param [in] remote handler to call.
+             * @param [in] msg Message object to send.
+             */
+            static void emit(remote_t *remote, const Message &msg);
+
+            /** Adds a Message to the queue of a blocked remote, applying its overflow policy.
+             *
+             * @param [in] remote blocked remote.
+             * @param [in] msg Message object to hold.
+             */
+            static void hold(remote_t *remote, const Message &msg);
+
+            /** Retries pending bytes, then sends held Messages while the remote accepts them.
+             *
+             * @param [in] remote remote to resume.
+             */
+            static void resume(remote_t *remote);
+
+            /** Sends the Messages queued for a remote.
+             *
+             * A single Message is sent as is, several are wrapped in one
+             * "batch" Message.  Encoded frames are written all at once.
+             * Nothing is sent while the remote is blocked by set_blocked().
+             *
+             * @param [in] remote remote to flush.
+             */
+            static void flush(remote_t *remote);
 
             /** Local data. */
             nlohmann::json m_local_data;
 
-            /** Map of namespaces to remotes. */
+            /** Map of namespaces to remotes.
+             *
+             * Elements keep their address until detached, so requests and
+             * subscriptions may hold a remote_t pointer across rehashes.
+             */
             std::unordered_map<std::string, remote_t> m_remotes;
 
-            /** Map of request ids to data requests.
+            /** Node of the namespace routing table, one per name segment. */
+            struct ns_node_t {
+                /** Remote attached at this node. Null if none. */
+                remote_t *remote = nullptr;
+
+                /** Child nodes keyed by name segment. */
+                std::unordered_map<std::string, std::unique_ptr<ns_node_t>> children;
+            };
+
+            /** Namespace routing table of the attached remotes.
+             *
+             * Resolving a path walks its segments, so the cost scales with the
+             * path rather than the number of remotes.  Nested names resolve to
+             * the longest attached namespace.
+             */
+            ns_node_t m_routes;
+
+            /** Adds or removes a namespace in the routing table.
+             *
+             * @param [in] name namespace of the remote.
+             * @param [in] remote remote to route to, or null to remove the route.
+             */
+            void route(const std::string &name, remote_t *remote);
+
+            /** Changed whenever m_remotes changes to invalidate Path caches. */
+            unsigned long m_generation = next_generation();
+
+            /** Returns a namespace generation unique across all stores. */
+            static unsigned long next_generation();
+
+            /** Storage for a get request waiting on a remote. */
+            typedef struct {
+                request_t request;          /**< The request, reused between gets. */
+                clock::time_point deadline; /**< Time the request expires. */
+                uint32_t serial;            /**< Incremented each time the slot is released. */
+                bool active;                /**< Slot holds a waiting request. */
+                std::string key;            /**< Entry in m_inflight, empty if none. */
+                bool named;                 /**< Entry in m_named_slots, the uuid was supplied. */
+
+                /** Identical gets sharing the request, with their uuids. */
+                std::vector<std::pair<callback_t, std::string>> followers;
+            } slot_t;
+
+            /** Entry of the deadline queue. */
+            typedef struct {
+                clock::time_point deadline; /**< Time the request expires. */
+                uint32_t index;             /**< Slot holding the request. */
+                uint32_t serial;            /**< Serial of the slot when queued. */
+            } deadline_t;
+
+            /** Returns the index of a free slot, growing the table if needed. */
+            uint32_t acquire_slot();
+
+            /** Marks a slot free, invalidating its queued deadline. */
+            void release_slot(uint32_t index);
+
+            /** Calls a request and the gets coalesced onto it, then frees its slot.
+             *
+             * @param [in] index slot of the request.
+             * @param [in] msg reply or timeout Message.
+             */
+            void finish_slot(uint32_t index, const Message &msg);
+
+            /** Generates a request identifier, reusing the storage of out.
              *
-             * Used for one-shot requests generated by 'get'.
+             * @param [out] out receives the identifier.
+             * @param [in] slot index of the slot to embed in the last 8 hex
+             * digits, or -1 for identifiers that are not get requests.
              */
-            std::unordered_map<std::string, request_t> m_requests;
+            void generate_id(std::string &out, long slot = -1);
+
+            /** Returns the integer key used to index a request identifier. */
+            static uint64_t id_key(const std::string &uuid);
+
+            /** Finds the active slot holding the request with uuid.
+             *
+             * Generated identifiers end with the slot index so the lookup is
+             * direct; user supplied uuids are found through m_named_slots.
+             *
+             * @return the slot index, or -1 if there is no such request.
+             */
+            long find_slot(const std::string &uuid) const;
+
+            /** Releases the slot and calls back with a "timeout" Message. */
+            void expire_slot(uint32_t index);
+
+            /** Options for requests made by this store. */
+            request_opts_t m_request_opts;
+
+            /** Random prefix of id_format_t::COUNTER identifiers. */
+            uint32_t m_id_prefix = 0;
+
+            /** Counter of id_format_t::COUNTER identifiers. */
+#ifdef ENTANGLD_CONCURRENT
+            std::atomic<uint64_t> m_id_counter;
+#else
+            uint64_t m_id_counter = 0;
+#endif
+
+            /** Pooled one-shot requests generated by 'get'. */
+            std::vector<slot_t> m_slots;
+
+            /** Indices of unused entries in m_slots. */
+            std::vector<uint32_t> m_free_slots;
+
+            /** Request deadlines in expiry order. */
+            std::deque<deadline_t> m_deadlines;
+
+            /** Slots of remote gets waiting on a reply, by full path. */
+            std::unordered_map<std::string, uint32_t> m_inflight;
+
+            /** Slots of requests made with a user supplied uuid, by uuid. */
+            std::unordered_map<std::string, uint32_t> m_named_slots;
+
+            /** Node of the revision index, one per written path segment. */
+            struct rev_node_t {
+                /** Revision of the last write replacing this path. */
+                uint64_t own = 0;
+
+                /** Revision of the last write at or beneath this path. */
+                uint64_t latest = 0;
+
+                /** Child nodes keyed by path segment. */
+                std::unordered_map<std::string, std::unique_ptr<rev_node_t>> children;
+            };
+
+            /** Revisions of the local store, indexed by path.
+             *
+             * Writes only touch the nodes on their path, a path beneath
+             * inherits the own revision of its parents.
+             */
+            rev_node_t m_revisions;
+
+            /** Revision of the last local write. */
+            uint64_t m_revision = 0;
+
+            /** Gives a written path the next revision. */
+            void touch(const Path &path);
+
+            /** Returns the revision of a dotted local path, the lock must be held. */
+            uint64_t revision_of(const std::string &path) const;
+
+            /** Procedures registered with set_rpc, by path. */
+            std::unordered_map<std::string, rpc_t> m_rpcs;
 
-            /** Active subscriptions.
+            /** A computed value registered with set_provider. */
+            typedef struct {
+                Path path;                  /**< Location of the value. */
+                provider_t provider;        /**< Computes the value. */
+                std::chrono::milliseconds ttl; /**< How long a value is served. */
+                clock::time_point computed; /**< Time the value was last computed. */
+                bool ready;                 /**< True once the value was computed. */
+            } provided_t;
+
+            /** Registered providers. */
+            std::vector<provided_t> m_providers;
+
+            /** Returns true if a get of path needs a provider to run first. */
+            bool stale(const Path &path, clock::time_point now) const;
+
+            /** Runs the stale providers a get of path depends on. */
+            void refresh(const Path &path, clock::time_point now);
+
+            /** Runs a provider and stores its value, notifying subscribers if it changed. */
+            void provide(provided_t &entry, clock::time_point now);
+
+            /** Returns true if a subscription covers path, or a path beneath it. */
+            bool watched(const Path &path) const;
+
+            /** Subscriptions held on remotes, by path and policy. */
+            std::unordered_map<std::string, upstream_t> m_upstreams;
+
+            /** Active subscriptions indexed by path.
              *
              * Used for repeated requests generated by 'subscribe'.
              */
-            std::vector<request_t> m_subs;
+            sub_node_t m_subs;
+
+            /** Index nodes of active subscriptions by id_key(uuid).
+             *
+             * Keys may collide, so entries only narrow down the nodes to
+             * search.
+             */
+            std::unordered_multimap<uint64_t, sub_node_t*> m_subs_by_uuid;
+
+            /** Rate limited subscriptions holding back a trailing value. */
+            std::unordered_set<request_t*> m_pending;
+
+            /** Nesting depth of begin() calls. */
+            unsigned int m_batch_depth = 0;
+
+            /** Number of attached remotes with a mirror. */
+            unsigned int m_mirrors = 0;
+
+            /** Local paths written during the open batch. */
+            std::vector<Path> m_batch_paths;
+
+            /** Messages held back for each remote during the open batch. */
+            std::vector<std::pair<remote_t*, std::vector<Message>>> m_batch_msgs;
+
+#ifdef ENTANGLD_CONCURRENT
+            /** A callback or writer waiting for the lock to be released. */
+            typedef struct {
+                callback_t callback;
+                std::shared_ptr<outlet_t> outlet;
+                Message msg;
+                std::shared_ptr<Message> shared;    /**< Event shared with other callbacks, msg holds its uuid. */
+                std::vector<uint8_t> data;
+                const void *key;
+            } event_t;
+
+            /** Runs queued events until the queue is empty, or hands them
+             * to the executor.
+             *
+             * Only one thread drains at a time, others return immediately
+             * and leave their events to it.
+             */
+            void drain();
+
+            /** Guards everything but the event queue. */
+            pthread_rwlock_t m_lock;
+
+            /** Events queued while the lock was held. */
+            Queue<event_t> m_events;
+
+            /** Set while a thread is draining m_events. */
+            std::atomic<bool> m_draining;
+#endif
     };
 }
 
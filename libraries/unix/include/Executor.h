@@ -0,0 +1,110 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Executor.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_EXECUTOR_H_
+#define _ENTANGLD_EXECUTOR_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+namespace entangld
+{
+    /** Runs Datastore callbacks and remote handlers.
+     *
+     * Tasks posted with the same key must run one at a time in the order
+     * they were posted.  A Datastore uses each remote as the key for its
+     * handler, and itself as the key for subscriber callbacks, so output
+     * to one remote stays ordered while different remotes may run in
+     * parallel.
+     */
+    class Executor {
+        public:
+            /** Unit of work. */
+            typedef std::function<void()> task_t;
+
+            virtual ~Executor() {};
+
+            /** Schedules a task.
+             *
+             * @param [in] task function to run.
+             * @param [in] key tasks with the same key run in order.
+             */
+            virtual void post(task_t &&task, const void *key) = 0;
+
+            /** Returns true if tasks only run on the thread using the
+             * Datastore, whether immediately or later.  A Datastore built
+             * without ENTANGLD_CONCURRENT only accepts such executors.
+             */
+            virtual bool single_threaded() const { return false; };
+    };
+
+    /** Runs every task immediately on the posting thread. */
+    class InlineExecutor : public Executor {
+        public:
+            void post(task_t &&task, const void *key) override;
+
+            bool single_threaded() const override { return true; };
+    };
+
+    /** Runs every task in order on a dedicated dispatcher thread. */
+    class ThreadExecutor : public Executor {
+        public:
+            ThreadExecutor();
+
+            /** Runs the tasks already posted, then stops the thread. */
+            ~ThreadExecutor();
+
+            void post(task_t &&task, const void *key) override;
+
+        private:
+            /** Dispatcher thread body. */
+            void run();
+
+            std::mutex m_mutex;
+            std::condition_variable m_ready;
+            std::deque<task_t> m_tasks;
+            bool m_stop = false;
+            std::thread m_thread;
+    };
+
+    /** Runs tasks on a user supplied thread pool.
+     *
+     * Tasks are grouped by key into strands.  Each strand is submitted to
+     * the pool as a single job that runs its tasks in order, so tasks with
+     * the same key never run concurrently.
+     */
+    class PoolExecutor : public Executor {
+        public:
+            /** Function that runs a job on the pool. */
+            typedef std::function<void(task_t &&job)> submit_t;
+
+            /** Creates an executor for a thread pool.
+             *
+             * @param [in] submit function that queues a job on the pool.
+             * The executor must outlive every submitted job.
+             */
+            explicit PoolExecutor(submit_t submit) : m_submit(std::move(submit)) {};
+
+            void post(task_t &&task, const void *key) override;
+
+        private:
+            /** Runs the tasks of a strand until it is empty. */
+            void run(const void *key);
+
+            submit_t m_submit;
+            std::mutex m_mutex;
+
+            /** Pending tasks for each key.  The front task is running. */
+            std::unordered_map<const void*, std::deque<task_t>> m_strands;
+    };
+}
+
+#endif /* _ENTANGLD_EXECUTOR_H_ */
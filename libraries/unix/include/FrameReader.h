@@ -0,0 +1,108 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file FrameReader.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_FRAME_READER_H_
+#define _ENTANGLD_FRAME_READER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Codec.h"
+#include "Message.h"
+
+namespace entangld
+{
+    /** Splits a byte stream into Messages.
+     *
+     * Bytes are read straight into a buffer that grows to fit the largest
+     * frame, and frames may arrive split across any number of reads.  JSON
+     * frames end with a newline, blank lines between them are skipped.
+     * Binary frames are prefixed by their length, as written by frame().
+     *
+     *     FrameReader reader;
+     *     ssize_t count = read(fd, reader.prepare(4096), 4096);
+     *     if(count > 0) {
+     *         reader.commit(count);
+     *
+     *         Message msg;
+     *         while(reader.next(msg))
+     *             store.receive(std::move(msg), "remote");
+     *     }
+     */
+    class FrameReader {
+        public:
+            /** Creates a reader.
+             *
+             * @param [in] format wire encoding of the stream.
+             * @param [in] max_frame largest frame accepted, in bytes.
+             */
+            explicit FrameReader(Format format = Format::JSON, size_t max_frame = 16 << 20);
+
+            /** Returns space for at least size bytes at the end of the buffer.
+             *
+             * Read into it, then call commit() with the number of bytes read.
+             *
+             * @param [in] size number of bytes that will be written.
+             * @return space to write to, valid until the next call.
+             */
+            uint8_t *prepare(size_t size);
+
+            /** Adds bytes written to the space returned by prepare().
+             *
+             * @param [in] count number of bytes written.
+             */
+            void commit(size_t count);
+
+            /** Copies received bytes into the buffer.
+             *
+             * @param [in] data received bytes.
+             * @param [in] size number of bytes.
+             */
+            void append(const uint8_t *data, size_t size);
+
+            /** Decodes the next complete frame.
+             *
+             * A malformed frame is consumed before the exception is thrown,
+             * so reading can continue with the next one.
+             *
+             * @param [out] msg decoded Message, reused to keep its allocations.
+             * @return true if msg holds a Message, false until more bytes arrive.
+             * @throws nlohmann::json::exception if a frame is malformed.
+             * @throws std::length_error if a frame exceeds max_frame.  The
+             * stream cannot be resynchronized and should be closed.
+             */
+            bool next(Message &msg);
+
+            /** Returns the number of bytes not yet decoded. */
+            inline size_t buffered() const { return m_end - m_start; }
+
+            /** Discards buffered bytes, e.g. after a reconnect. */
+            void clear();
+
+        private:
+            /** Wire encoding of the stream. */
+            Format m_format;
+
+            /** Largest frame accepted. */
+            size_t m_max_frame;
+
+            /** Received bytes, those in use are between m_start and m_end. */
+            std::vector<uint8_t> m_buffer;
+
+            /** Offset of the first byte not yet decoded. */
+            size_t m_start = 0;
+
+            /** Offset of the end of the received bytes. */
+            size_t m_end = 0;
+
+            /** Bytes after m_start already searched for a newline. */
+            size_t m_scanned = 0;
+    };
+}
+
+#endif /* _ENTANGLD_FRAME_READER_H_ */
@@ -0,0 +1,174 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Journal.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_JOURNAL_H_
+#define _ENTANGLD_JOURNAL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Datastore.h"
+
+namespace entangld
+{
+    /** Persists the local data of a Datastore to a directory.
+     *
+     * Every set and push is appended to a write log as a CBOR frame with a
+     * checksum.  A background thread writes the log in groups, so a burst
+     * of writes costs one write and one fdatasync instead of one each.
+     * compact() saves the whole store as a CBOR snapshot and drops the log
+     * records it covers.
+     *
+     * open() memory maps the snapshot, decodes it straight from the mapping
+     * and replays the log written after it.  A record torn by a crash fails
+     * its checksum, and it and anything after it are discarded.
+     *
+     *     Datastore store;
+     *     Journal journal;
+     *     journal.open("/var/lib/entangld", store);
+     *     ...
+     *     if(journal.log_size() > 64 * 1024 * 1024)
+     *         journal.compact();
+     *
+     * Writes are durable once the next group is written, at most
+     * flush_interval after they were made, or when flush() returns.
+     */
+    class Journal {
+        public:
+            /** Journal options. */
+            struct opts_t {
+                /** Longest a write waits before it is written out. */
+                std::chrono::milliseconds flush_interval;
+
+                /** Call fdatasync after every group of writes. */
+                bool sync;
+
+                opts_t(
+                    std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10),
+                    bool sync = true)
+                : flush_interval(flush_interval), sync(sync) {};
+            };
+
+            Journal() {};
+
+            /** Writes out pending records and stops journaling. */
+            ~Journal();
+
+            Journal(const Journal&) = delete;
+            Journal &operator=(const Journal&) = delete;
+
+            /** Restores a store from a directory and journals its writes.
+             *
+             * If the directory holds a snapshot it replaces the local data,
+             * otherwise the log is replayed over the data the store already
+             * has.  The directory is created if it does not exist.  The store
+             * must outlive the journal, or the journal must be closed first.
+             *
+             * @param [in] dir directory holding the snapshot and log.
+             * @param [in] store store to restore and journal.
+             * @param [in] opts journal options.
+             * @return 0 on success, or a negative errno.
+             */
+            int open(const std::string &dir, Datastore &store, const opts_t &opts = opts_t());
+
+            /** Returns true if a store is being journaled. */
+            bool is_open() const;
+
+            /** Writes out every record so far and waits until it is durable.
+             *
+             * @return 0 on success, or the first write error as a negative errno.
+             */
+            int flush();
+
+            /** Saves a snapshot of the store and starts a new log after it.
+             *
+             * Writes are only held up while the data is copied, not while
+             * the snapshot is encoded and written.
+             *
+             * @return 0 on success, or a negative errno.
+             */
+            int compact();
+
+            /** Returns the size of the log in bytes, including pending records. */
+            size_t log_size() const;
+
+            /** Writes out pending records and stops journaling. */
+            void close();
+
+        private:
+            /** Appends a write to the pending records. */
+            static void on_write(
+                const Path &path, const nlohmann::json &value, bool push, size_t limit, void *ctx);
+
+            /** Writes pending records until close(). */
+            void run();
+
+            /** Loads the snapshot. Returns its sequence number, or a negative errno. */
+            int load_snapshot(uint64_t &seq);
+
+            /** Replays the log from a sequence number and opens it for appending. */
+            int replay_log(uint64_t seq);
+
+            /** Creates a log starting at a sequence number, holding the given records. */
+            int create_log(uint64_t base, const uint8_t *records, size_t size);
+
+            /** Directory holding the files. */
+            std::string m_dir;
+
+            /** Journaled store. */
+            Datastore *m_store = nullptr;
+
+            /** Journal options. */
+            opts_t m_opts;
+
+            /** Log file, opened for appending. */
+            int m_fd = -1;
+
+            /** Guards everything below. */
+            mutable std::mutex m_mutex;
+
+            /** Wakes the writer thread early. */
+            std::condition_variable m_wake;
+
+            /** Signalled whenever a group of records was written. */
+            std::condition_variable m_written;
+
+            /** Writer thread. */
+            std::thread m_thread;
+
+            /** Encoded records not yet given to the writer thread. */
+            std::vector<uint8_t> m_pending;
+
+            /** Sequence number of the next record. */
+            uint64_t m_seq = 0;
+
+            /** Records before this sequence number are durable. */
+            uint64_t m_durable = 0;
+
+            /** Size of the log including pending records. */
+            size_t m_log_size = 0;
+
+            /** True while the writer thread is writing a group. */
+            bool m_writing = false;
+
+            /** True if a caller is waiting for the next group. */
+            bool m_requested = false;
+
+            /** True once close() was called. */
+            bool m_stop = false;
+
+            /** First write error, as a negative errno. */
+            int m_error = 0;
+    };
+}
+
+#endif /* _ENTANGLD_JOURNAL_H_ */
@@ -8,6 +8,7 @@
 #ifndef _ENTANGLD_MESSAGE_H_
 #define _ENTANGLD_MESSAGE_H_
 
+#include <cstdint>
 #include <string>
 #include <nlohmann/json.hpp>
 
@@ -23,6 +24,9 @@ namespace entangld
             nlohmann::json path;    /**< Datastore path that the message is referencing. */
             std::string uuid;       /**< Unique identifier for request tracking. */
             nlohmann::json value;   /**< Message payload. */
+            nlohmann::json params;  /**< Additional parameters. May be null. */
+            unsigned int every = 0; /**< Subscription throttle, deliver every Nth change. */
+            uint64_t revision = 0;  /**< Revision of the value in "value" and "event" Messages. Zero if unknown. */
     };
 
     /** Allows embedding of a Message object into json.
@@ -38,20 +42,57 @@ namespace entangld
 
         if(!msg.value.empty())
             j["value"] = msg.value;
+
+        if(!msg.params.empty())
+            j["params"] = msg.params;
+
+        if(msg.every > 1)
+            j["every"] = msg.every;
+
+        if(msg.revision > 0)
+            j["revision"] = msg.revision;
     }
 
     /** Allows extraction of a Message object from json.
+     *
+     * A json array is read as a "batch" Message holding the array.
      *
      * @param [in] j source json.
      * @param [in] msg Message object to fill.
      */
     static void from_json(const nlohmann::json &j, Message &msg)
     {
+        if(j.is_array()) {
+            // An array of Messages is a batch frame
+            msg.type = "batch";
+            msg.path = nullptr;
+            msg.uuid.clear();
+            msg.value = j;
+            msg.params = nullptr;
+            msg.every = 0;
+            msg.revision = 0;
+            return;
+        }
+
         j.at("type").get_to(msg.type);
-        j.at("uuid").get_to(msg.uuid);
+
+        // JS peers omit the uuid of set and push messages
+        auto uuid = j.find("uuid");
+        msg.uuid = (uuid != j.end() && uuid->is_string())
+            ? uuid->get<std::string>() : "";
 
         msg.path = j.value("path", nlohmann::json(nullptr));
         msg.value = j.value("value", nlohmann::json(nullptr));
+        msg.params = j.value("params", nlohmann::json(nullptr));
+
+        // JS peers send "every": null when no throttle is requested
+        auto every = j.find("every");
+        msg.every = (every != j.end() && every->is_number_unsigned())
+            ? every->get<unsigned int>() : 0;
+
+        auto revision = j.find("revision");
+        msg.revision = (revision != j.end() && revision->is_number_unsigned())
+            ? revision->get<uint64_t>() : 0;
     }
 }
 
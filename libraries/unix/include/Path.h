@@ -0,0 +1,84 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Path.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_PATH_H_
+#define _ENTANGLD_PATH_H_
+
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace entangld
+{
+    class Datastore;
+
+    /** Pre-parsed Datastore path.
+     *
+     * Splits a dotted path into segments and builds its json pointer once.  A
+     * Path also caches the namespace it resolved to, so hot loops can resolve
+     * a path once and reuse it for every get, set or subscribe.
+     */
+    class Path {
+        public:
+            /** Parses a dotted path.
+             *
+             * @param [in] path dotted path, e.g. "system.fan.voltage".
+             */
+            Path(const std::string &path = "");
+
+            /** Parses a dotted path.
+             *
+             * @param [in] path dotted path, e.g. "system.fan.voltage".
+             */
+            Path(const char *path) : Path(std::string(path)) {};
+
+            /** Returns the original dotted path. */
+            inline const std::string &str() const { return m_path; }
+
+            /** Returns true if this is the root path. */
+            inline bool empty() const { return m_path.empty(); }
+
+            /** Returns the path split on '.'. */
+            inline const std::vector<std::string> &segments() const { return m_segments; }
+
+            /** Returns the json pointer to the path in a local store. */
+            inline const nlohmann::json::json_pointer &pointer() const { return m_ptr; }
+
+            /** Returns the dotted path with the leading segments removed.
+             *
+             * @param [in] depth number of segments to remove.
+             */
+            std::string relative(size_t depth) const;
+
+        private:
+            friend class Datastore;
+
+            /** Dotted path. */
+            std::string m_path;
+
+            /** Path segments. */
+            std::vector<std::string> m_segments;
+
+            /** Json pointer to the path. */
+            nlohmann::json::json_pointer m_ptr;
+
+            /** Store that resolved the cached namespace. */
+            mutable const Datastore *m_owner = nullptr;
+
+            /** Namespace generation of m_owner when the path was resolved. */
+            mutable unsigned long m_generation = 0;
+
+            /** Remote the path resolved to. Null if the path is local. */
+            mutable void *m_remote = nullptr;
+
+            /** Number of segments belonging to the namespace. */
+            mutable size_t m_ns_depth = 0;
+    };
+}
+
+#endif /* _ENTANGLD_PATH_H_ */
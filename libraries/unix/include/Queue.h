@@ -0,0 +1,95 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Queue.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_QUEUE_H_
+#define _ENTANGLD_QUEUE_H_
+
+#include <atomic>
+#include <utility>
+
+namespace entangld
+{
+    /** Unbounded lock-free multiple producer, single consumer queue.
+     *
+     * Any thread may push, but only one thread at a time may pop.  Based on
+     * Dmitry Vyukov's intrusive MPSC node queue: push is a single atomic
+     * exchange, and pop never touches the producer end.
+     */
+    template<typename T>
+    class Queue {
+        public:
+            Queue() : m_head(new node_t), m_tail(m_head.load()) {};
+
+            ~Queue()
+            {
+                T value;
+                while(pop(value)) {}
+                delete m_tail.load();
+            }
+
+            Queue(const Queue&) = delete;
+            Queue &operator=(const Queue&) = delete;
+
+            /** Adds a value to the queue.  Safe to call from any thread.
+             *
+             * @param [in] value value to add.
+             */
+            void push(T &&value)
+            {
+                node_t *node = new node_t;
+                node->value = std::move(value);
+
+                node_t *prev = m_head.exchange(node, std::memory_order_acq_rel);
+                prev->next.store(node, std::memory_order_release);
+            }
+
+            /** Removes the oldest value.  Only one thread may pop at a time.
+             *
+             * May briefly return false while a push is in progress.
+             *
+             * @param [out] value receives the oldest value.
+             * @return false if the queue was empty.
+             */
+            bool pop(T &value)
+            {
+                node_t *tail = m_tail.load(std::memory_order_relaxed);
+                node_t *next = tail->next.load(std::memory_order_acquire);
+                if(next == nullptr)
+                    return false;
+
+                // The popped node becomes the new stub
+                value = std::move(next->value);
+                m_tail.store(next, std::memory_order_release);
+                delete tail;
+                return true;
+            }
+
+            /** Returns true if nothing has been pushed since the last pop. */
+            bool empty() const
+            {
+                return m_head.load(std::memory_order_acquire)
+                    == m_tail.load(std::memory_order_acquire);
+            }
+
+        private:
+            /** Queue node. */
+            struct node_t {
+                std::atomic<node_t*> next;
+                T value;
+
+                node_t() : next(nullptr) {};
+            };
+
+            /** Most recently pushed node, written by producers. */
+            std::atomic<node_t*> m_head;
+
+            /** Stub node before the oldest value, written by the consumer. */
+            std::atomic<node_t*> m_tail;
+    };
+}
+
+#endif /* _ENTANGLD_QUEUE_H_ */
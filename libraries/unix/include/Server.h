@@ -0,0 +1,214 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Server.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_SERVER_H_
+#define _ENTANGLD_SERVER_H_
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Datastore.h"
+
+namespace entangld
+{
+    /** Serves a Datastore to many socket clients using epoll.
+     *
+     * Each client is attached to the store as its own namespace, so clients
+     * can subscribe to and modify the store, and the store can reach into
+     * each client.  Incoming frames are buffered per client until complete,
+     * and outgoing frames are queued and written with writev.  A client
+     * whose output queue grows past max_queued stops being read until it
+     * catches up.  When a client disconnects only its namespace is
+     * detached.
+     *
+     * Not thread safe, poll() should be called from a single thread.
+     */
+    class Server {
+        public:
+            /** Server options. */
+            struct opts_t {
+                /** Wire encoding used by clients. */
+                Format format;
+
+                /** Bytes queued for a client before it stops being read.
+                 * Output beyond it is held by the store, as Messages subject
+                 * to remote.max_queue and remote.overflow.
+                 */
+                size_t max_queued;
+
+                /** Largest frame accepted from a client. Larger frames disconnect it. */
+                size_t max_frame;
+
+                /** Clients are attached as prefix + a connection number. */
+                std::string prefix;
+
+                /** Outbound options for each client.  format and
+                 * on_disconnect are ignored, a client the store disconnects
+                 * is closed.
+                 */
+                Datastore::remote_opts_t remote;
+
+                opts_t(
+                    Format format = Format::JSON,
+                    size_t max_queued = 1 << 20,
+                    size_t max_frame = 16 << 20,
+                    const std::string &prefix = "client")
+                : format(format), max_queued(max_queued), max_frame(max_frame), prefix(prefix) {};
+            };
+
+            /** Creates a server for a store.
+             *
+             * @param [in] store store to serve.  Must outlive the server.
+             * @param [in] opts server options.
+             */
+            explicit Server(Datastore *store, const opts_t &opts = opts_t());
+
+            /** Disconnects every client and closes the listening sockets. */
+            virtual ~Server();
+
+            Server(const Server&) = delete;
+            Server &operator=(const Server&) = delete;
+
+            /** Waits for socket activity and services it.
+             *
+             * Accepts new clients, reads and processes complete frames,
+             * writes queued output, then calls Datastore::poll().  Rate
+             * limited subscriptions and request timeouts need the timeout to
+             * be no longer than their interval.
+             *
+             * @param [in] timeout_ms maximum time to wait, or -1 to block.
+             * @return 0 on success, or a negative errno.
+             */
+            int poll(int timeout_ms = -1);
+
+            /** Returns the epoll descriptor, to wait on it from another loop. */
+            inline int fd() const { return m_epoll_fd; }
+
+            /** Returns the number of connected clients. */
+            inline size_t clients() const { return m_clients.size(); }
+
+            /** Returns the namespaces of the connected clients. */
+            std::vector<std::string> names() const;
+
+            /** Returns the number of bytes queued for a client. */
+            size_t queued(const std::string &name) const;
+
+            /** Disconnects a client and detaches its namespace.
+             *
+             * @param [in] name namespace of the client.
+             */
+            void disconnect(const std::string &name);
+
+        protected:
+            /** Starts accepting clients on a listening socket.
+             *
+             * @param [in] fd bound and listening socket, owned by the server.
+             * @return 0 on success, or a negative errno.
+             */
+            int add_listener(int fd);
+
+        private:
+            /** A connected client. */
+            typedef struct {
+                Server *server;                 /**< Server the client belongs to. */
+                int fd;                         /**< Client socket. */
+                std::string name;               /**< Namespace of the client. */
+                std::vector<uint8_t> input;     /**< Bytes of incomplete frames. */
+                size_t received;                /**< Bytes of input in use. */
+                size_t scanned;                 /**< Input already searched for a frame end. */
+                std::deque<std::vector<uint8_t>> output; /**< Writes waiting for the socket. */
+                size_t offset;                  /**< Bytes of output.front() already written. */
+                size_t queued;                  /**< Bytes waiting in output. */
+                bool paused;                    /**< Input stopped by backpressure. */
+                bool closing;                   /**< Disconnect once it is safe. */
+            } client_t;
+
+            /** Accepts every pending client of a listening socket. */
+            void accept_clients(int listen_fd);
+
+            /** Reads from a client and processes complete frames. */
+            void read_client(client_t *client);
+
+            /** Writes as much queued output as the socket accepts. */
+            void write_client(client_t *client);
+
+            /** Updates the epoll events of a client. */
+            void update_events(client_t *client);
+
+            /** Closes a client and detaches its namespace. */
+            void drop_client(client_t *client);
+
+            /** Closes a client the store detached for overflowing. */
+            static void disconnected(const std::string &name, void *ctx);
+
+            /** writer_t used for every client. */
+            static int write_frames(const uint8_t *data, size_t size, void *ctx);
+
+            /** Served store. */
+            Datastore *m_store;
+
+            /** Server options. */
+            opts_t m_opts;
+
+            /** epoll instance. */
+            int m_epoll_fd;
+
+            /** Listening sockets. */
+            std::vector<int> m_listeners;
+
+            /** Connected clients by socket. */
+            std::unordered_map<int, std::unique_ptr<client_t>> m_clients;
+
+            /** Number given to the next client. */
+            unsigned long m_next_id = 1;
+    };
+
+    /** Serves a Datastore over TCP. */
+    class TcpServer : public Server {
+        public:
+            using Server::Server;
+
+            /** Listens for clients.
+             *
+             * @param [in] port port to listen on, or 0 to pick a free port.
+             * @param [in] host IPv4 address to bind.  Binds every address if empty.
+             * @return 0 on success, or a negative errno.
+             */
+            int listen(uint16_t port, const std::string &host = "");
+
+            /** Returns the port of the most recent listen(). */
+            inline uint16_t port() const { return m_port; }
+
+        private:
+            uint16_t m_port = 0;
+    };
+
+    /** Serves a Datastore over a Unix domain socket. */
+    class UnixSocketServer : public Server {
+        public:
+            using Server::Server;
+
+            /** Removes the socket files created by listen(). */
+            ~UnixSocketServer();
+
+            /** Listens for clients.
+             *
+             * @param [in] path filesystem path of the socket.  An existing
+             * socket file is replaced.
+             * @return 0 on success, or a negative errno.
+             */
+            int listen(const std::string &path);
+
+        private:
+            std::vector<std::string> m_paths;
+    };
+}
+
+#endif /* _ENTANGLD_SERVER_H_ */
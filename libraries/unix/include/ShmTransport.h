@@ -0,0 +1,181 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file ShmTransport.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_SHM_TRANSPORT_H_
+#define _ENTANGLD_SHM_TRANSPORT_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Datastore.h"
+
+namespace entangld
+{
+    /** Connects two processes on one host through shared memory.
+     *
+     * A POSIX shared memory object holds one ring of bytes for each
+     * direction.  Each ring has a single writer and a single reader, so
+     * neither side takes a lock, and a sleeping reader is woken with a
+     * futex on the shared mapping.  Readers spin briefly before sleeping,
+     * which keeps round trips in the microseconds while both sides are busy.
+     *
+     * One process calls create() and the other calls open() with the same
+     * name.  Each side attaches the other as a writer remote and feeds its
+     * own store with pump():
+     *
+     *     ShmTransport shm;
+     *     shm.create("/entangld");
+     *     store.attach("peer", ShmTransport::write, &shm, Datastore::remote_opts_t(0, 0, Format::CBOR));
+     *     while(running)
+     *         shm.pump(store, "peer", 100);
+     *
+     * Frames larger than a ring are written in pieces as the reader drains
+     * it, so both sides must be serviced independently.
+     */
+    class ShmTransport {
+        public:
+            /** Transport options. */
+            struct opts_t {
+                /** Bytes in each ring, rounded up to a power of two. */
+                size_t capacity;
+
+                /** Times the reader checks for data before sleeping. */
+                unsigned int spin;
+
+                /** Milliseconds a write waits for space, or -1 to wait forever. */
+                int write_timeout_ms;
+
+                opts_t(size_t capacity = 1 << 20, unsigned int spin = 2000, int write_timeout_ms = 1000)
+                : capacity(capacity), spin(spin), write_timeout_ms(write_timeout_ms) {};
+            };
+
+            ShmTransport() {};
+
+            /** Unmaps the rings, and removes the object if we created it. */
+            ~ShmTransport();
+
+            ShmTransport(const ShmTransport&) = delete;
+            ShmTransport &operator=(const ShmTransport&) = delete;
+
+            /** Creates the shared memory object and maps it.
+             *
+             * An existing object with the same name is replaced.
+             *
+             * @param [in] name shared memory name, such as "/entangld".
+             * @param [in] opts transport options.
+             * @return 0 on success, or a negative errno.
+             */
+            int create(const std::string &name, const opts_t &opts = opts_t());
+
+            /** Maps a shared memory object made by create() in another process.
+             *
+             * @param [in] name shared memory name.
+             * @param [in] opts transport options.  capacity is ignored.
+             * @return 0 on success, -EAGAIN if the creator has not finished, or a negative errno.
+             */
+            int open(const std::string &name, const opts_t &opts = opts_t());
+
+            /** Unmaps the rings and wakes anything waiting on them. */
+            void close();
+
+            /** Returns true once create() or open() has succeeded. */
+            inline bool is_open() const { return m_base != nullptr; }
+
+            /** writer_t that sends bytes to the other process.
+             *
+             * Only one thread may write to a transport at a time.
+             *
+             * @param [in] data bytes to write.
+             * @param [in] size number of bytes.
+             * @param [in] ctx the ShmTransport.
+             * @return 0 on success, -ETIMEDOUT if the reader stopped draining, or -ENOTCONN.
+             * If part of the data was written first, the number of trailing
+             * bytes that were not, so that the store retries them.
+             */
+            static int write(const uint8_t *data, size_t size, void *ctx);
+
+            /** Reads bytes sent by the other process.
+             *
+             * @param [out] data buffer to read into.
+             * @param [in] size size of the buffer.
+             * @param [in] timeout_ms time to wait for data, or -1 to wait forever.
+             * @return number of bytes read, 0 on timeout, or a negative errno.
+             */
+            long read(uint8_t *data, size_t size, int timeout_ms = 0);
+
+            /** Reads what the other process sent and passes it to a store.
+             *
+             * Incomplete frames are kept until the rest arrives.
+             *
+             * @param [in] store store to receive with.
+             * @param [in] name namespace the other process is attached as.
+             * @param [in] timeout_ms time to wait for data, or -1 to wait forever.
+             * @return number of bytes read, 0 on timeout, or a negative errno.
+             */
+            long pump(Datastore &store, const std::string &name, int timeout_ms = 0);
+
+        private:
+            /** One direction of the transport, laid out in shared memory. */
+            typedef struct {
+                alignas(64) std::atomic<uint64_t> head;     /**< Bytes written, advanced by the writer. */
+                alignas(64) std::atomic<uint64_t> tail;     /**< Bytes read, advanced by the reader. */
+                alignas(64) std::atomic<uint32_t> data_seq; /**< Futex bumped after each write. */
+                std::atomic<uint32_t> readers;              /**< Readers sleeping on data_seq. */
+                std::atomic<uint32_t> space_seq;            /**< Futex bumped after each read. */
+                std::atomic<uint32_t> writers;              /**< Writers sleeping on space_seq. */
+            } ring_t;
+
+            /** Start of the shared memory object. */
+            typedef struct {
+                std::atomic<uint32_t> magic;    /**< Set last by create(). */
+                uint32_t version;               /**< Layout version. */
+                uint64_t capacity;              /**< Bytes in each ring. */
+                std::atomic<uint32_t> closed;   /**< Set when either side closes. */
+            } header_t;
+
+            /** Maps an open descriptor and finds the rings. */
+            int map(int fd, size_t size, bool creator);
+
+            /** Returns the data area of a ring. */
+            inline uint8_t *ring_data(ring_t *ring) const
+            {
+                return reinterpret_cast<uint8_t*>(ring) + sizeof(ring_t);
+            }
+
+            /** Transport options. */
+            opts_t m_opts;
+
+            /** Name of the shared memory object. */
+            std::string m_name;
+
+            /** Mapped object. */
+            void *m_base = nullptr;
+
+            /** Size of the mapping. */
+            size_t m_size = 0;
+
+            /** Bytes in each ring. */
+            uint64_t m_capacity = 0;
+
+            /** True if we created the object and must remove it. */
+            bool m_creator = false;
+
+            /** Ring we write to. */
+            ring_t *m_tx = nullptr;
+
+            /** Ring we read from. */
+            ring_t *m_rx = nullptr;
+
+            /** Received bytes of an incomplete frame. */
+            std::vector<uint8_t> m_input;
+    };
+}
+
+#endif /* _ENTANGLD_SHM_TRANSPORT_H_ */
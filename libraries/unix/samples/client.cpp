@@ -8,6 +8,7 @@
 
 #include "Message.h"
 #include "Datastore.h"
+#include "FrameReader.h"
 #include "debug.h"
 
 using json = nlohmann::json;
@@ -17,6 +18,7 @@ using namespace std::chrono;
 constexpr char DEFAULT_HOST[] = "127.0.0.1";    /**< Default host address. */
 constexpr int DEFAULT_PORT = 50001;             /**< Default host port. */
 constexpr int DEFAULT_TIMEOUT = 2000;           /**< Default timeout. */
+constexpr size_t READ_SIZE = 4096;              /**< Bytes requested per read. */
 
 /** Set to trigger shutdown. */
 volatile bool g_shutdown_flag = false;
@@ -198,33 +200,26 @@ int main(int argc, char *argv[])
         );
     }
 
-    // Wait for response
-    char buffer[2048];
-    memset(buffer, 0, sizeof(buffer));
+    // Wait for response, frames may span several reads
+    FrameReader reader;
+    Message msg;
 
     const auto start = steady_clock::now();
     while(!g_shutdown_flag) {
-        int count = read(fd, buffer, sizeof(buffer));
+        int count = read(fd, reader.prepare(READ_SIZE), READ_SIZE);
 
         if(count > 0) {
-            char *start = buffer;
-            int size = count;
-            while(size > 1) {
-                // Split buffer on newlines
-                char *end = static_cast<char *>(memchr(start+1, '\n', size-1));
-                if(end == nullptr)
-                    break;
-
-                json j = json::parse(start, end);
-                DEBUG_VERBOSE("RX: %s", j.dump().c_str());
-
-                if(j["type"] == "Entangld_Message") {
-                    Message msg = j.get<Message>();
-                    store->receive(msg, "remote");
-                }
+            reader.commit(count);
 
-                size -= (end - start);
-                start = end;
+            try {
+                while(reader.next(msg)) {
+                    DEBUG_VERBOSE("RX: %s", json(msg).dump().c_str());
+                    store->receive(std::move(msg), "remote");
+                }
+            }
+            catch(std::exception &e) {
+                DEBUG_ERROR("malformed frame: %s", e.what());
+                break;
             }
         }
         else if(count == 0) {
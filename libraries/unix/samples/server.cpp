@@ -1,11 +1,11 @@
-#include <fcntl.h>
-#include <unistd.h>
+#include <poll.h>
 #include <signal.h>
-#include <netinet/ip.h>
+#include <string.h>
 #include <getopt.h>
 
 #include "Message.h"
 #include "Datastore.h"
+#include "Server.h"
 #include "debug.h"
 
 using json = nlohmann::json;
@@ -27,6 +27,7 @@ static struct option long_shared[] = {
     {"silent",  0, nullptr, 's'},
     {"verbose", 0, nullptr, 'v'},
     {"port",    1, nullptr, 'p'},
+    {"socket",  1, nullptr, 'u'},
 
     {nullptr,   0, nullptr, 0},
 };
@@ -46,6 +47,7 @@ static void print_help(const char *name)
     printf("  -s, --silent          Disables all printed messages\n");
     printf("  -v, --verbose         Increase the verbosity of printed messages\n");
     printf("  -p, --port            Server listen port, e.g. --port=%d\n", DEFAULT_PORT);
+    printf("  -u, --socket          Also listen on a Unix socket, e.g. --socket=/tmp/entangld\n");
     printf("\n");
 }
 
@@ -54,10 +56,10 @@ int main(int argc, char *argv[])
     unsigned int port = DEFAULT_PORT;
     int print_level = 1;
     bool silent = false;
-    int flags = 0;
+    const char *socket_path = nullptr;
 
     while(1) {
-        int c = getopt_long(argc, argv, "Hsvp:", long_shared, NULL);
+        int c = getopt_long(argc, argv, "Hsvp:u:", long_shared, NULL);
         if(c == -1)
             break;
 
@@ -78,6 +80,10 @@ int main(int argc, char *argv[])
             case 'p':
                 port = strtol(optarg, nullptr, 0);
                 break;
+
+            case 'u':
+                socket_path = optarg;
+                break;
         }
     }
 
@@ -87,44 +93,39 @@ int main(int argc, char *argv[])
 
     // Create Datastore
     DEBUG_VERBOSE("Creating store");
-    Datastore *store = new Datastore({
+    Datastore store({
         {"name", "Entangld server"},
         {"version", std::string(VERSION)},
         {"port", port}
     });
 
-    // Set up listen socket
-    DEBUG_VERBOSE("creating socket");
-    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if(listen_fd < 0) {
-        DEBUG_ERROR("socket creation error: %s", strerror(errno));
-        return EXIT_FAILURE;
-    }
-
-    flags = 1;
-    if(setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &flags, sizeof(int)) < 0) {
-        DEBUG_ERROR("setsockopt error: %s", strerror(errno));
-        return EXIT_FAILURE;
-    }
+    // Serve the store, each client gets its own namespace
+    DEBUG_VERBOSE("creating server");
+    Server::opts_t tcp_opts;
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(struct sockaddr_in));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr.s_addr = INADDR_ANY;
+    // A slow client only loses intermediate events of its own subscriptions
+    tcp_opts.remote.max_queue = 1024;
+    tcp_opts.remote.overflow = Datastore::overflow_t::COALESCE;
+    TcpServer server(&store, tcp_opts);
 
-    if(bind(listen_fd, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) < 0) {
-        DEBUG_ERROR("socket bind error: %s", strerror(errno));
+    int status = server.listen(port);
+    if(status < 0) {
+        DEBUG_ERROR("listen error: %s", strerror(-status));
         return EXIT_FAILURE;
     }
 
-    if(listen(listen_fd, 1) < 0) {
-        DEBUG_ERROR("socket listen error: %s", strerror(errno));
-        return EXIT_FAILURE;
-    }
+    Server::opts_t unix_opts = tcp_opts;
+    unix_opts.prefix = "local";
+    UnixSocketServer unix_server(&store, unix_opts);
+    if(socket_path) {
+        status = unix_server.listen(socket_path);
+        if(status < 0) {
+            DEBUG_ERROR("listen error: %s", strerror(-status));
+            return EXIT_FAILURE;
+        }
 
-    flags = fcntl(listen_fd, F_GETFL, 0);
-    fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK);
+        DEBUG_INFO("listening on %s", socket_path);
+    }
 
     // Capture SIGINT and set shutdown_flag for cleanup
     struct sigaction sa;
@@ -134,68 +135,25 @@ int main(int argc, char *argv[])
     sigaction(SIGINT, &sa, nullptr);
 
     DEBUG_INFO("listening on port %d", port);
+    size_t clients = 0;
     while(!g_shutdown_flag) {
-        int client_fd = accept(listen_fd, nullptr, nullptr);
-        if(client_fd > 0) {
-            DEBUG_INFO("new client connected");
-
-            // Set client socket non-blocking
-            int flags = fcntl(listen_fd, F_GETFL, 0);
-            fcntl(client_fd, F_SETFL, flags | O_NONBLOCK);
-
-            // Attach datastore to client
-            store->attach("client",
-                [](const Message &msg, void *ctx){
-                    int fd = *static_cast<int*>(ctx);
-                    std::string resp = json(msg).dump() + '\n';
-                    DEBUG_VERBOSE("TX: %s", resp.c_str());
-                    write(fd, resp.c_str(), resp.length());
-                },
-                &client_fd
-            );
-
-            // Read and parse Entangld_Message objects
-            char buffer[2048];
-            memset(buffer, 0, sizeof(buffer));
-
-            while(!g_shutdown_flag) {
-                int count = read(client_fd, buffer, sizeof(buffer));
-                buffer[count] = '\0';
-
-                if(count > 0) {
-                    char *start = buffer;
-                    int size = count;
-                    while(size > 1) {
-                        // Split buffer on newlines
-                        char *end = static_cast<char *>(memchr(start+1, '\n', size-1));
-                        if(end == nullptr)
-                            break;
-
-                        json j = json::parse(start, end);
-                        DEBUG_VERBOSE("RX: %s", j.dump().c_str());
-
-                        store->receive(j.get<Message>(), "client");
-
-                        size -= (end - start);
-                        start = end;
-                    }
-                }
-                else if(count == 0) {
-                    // Socket closed
-                    DEBUG_WARN("client closed connection");
-                    break;
-                }
-            }
-
-            // Clean up and disconnect client
-            store->reset();
-            close(client_fd);
-            client_fd = -1;
-
-            DEBUG_INFO("client disconnected");
+        // Wait on both servers, short waits keep rate limited subscriptions serviced
+        struct pollfd fds[2] = {
+            {server.fd(), POLLIN, 0},
+            {unix_server.fd(), POLLIN, 0}
+        };
+
+        ::poll(fds, (socket_path) ? 2 : 1, 100);
+        server.poll(0);
+        if(socket_path)
+            unix_server.poll(0);
+
+        size_t count = server.clients() + unix_server.clients();
+        if(count != clients) {
+            DEBUG_INFO("%zu clients connected", count);
+            clients = count;
         }
     }
 
-    delete store;
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -0,0 +1,369 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Codec.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <cstring>
+
+#include "Codec.h"
+
+/** Reads a Message straight from SAX events.
+ *
+ * Only path, value and params are built as json, the envelope is not.
+ * Anything from_json(Message) would reject makes the parse fail, so that
+ * the caller can report it through the DOM decoder.
+ */
+class message_sax_t : public nlohmann::json::json_sax_t {
+    public:
+        explicit message_sax_t(entangld::Message &msg) : m_msg(msg) {};
+
+        /** Returns true if a whole Message was read. */
+        inline bool complete() const { return m_batch || m_typed; }
+
+        bool null() override
+        {
+            return scalar(nlohmann::json(nullptr));
+        }
+
+        bool boolean(bool val) override
+        {
+            return scalar(nlohmann::json(val));
+        }
+
+        bool number_integer(number_integer_t val) override
+        {
+            return scalar(nlohmann::json(val));
+        }
+
+        bool number_unsigned(number_unsigned_t val) override
+        {
+            if(m_stack.empty() && m_field == field_t::EVERY) {
+                m_msg.every = static_cast<unsigned int>(val);
+                return true;
+            }
+
+            if(m_stack.empty() && m_field == field_t::REVISION) {
+                m_msg.revision = val;
+                return true;
+            }
+
+            return scalar(nlohmann::json(val));
+        }
+
+        bool number_float(number_float_t val, const string_t&) override
+        {
+            return scalar(nlohmann::json(val));
+        }
+
+        bool string(string_t &val) override
+        {
+            if(m_stack.empty() && m_field == field_t::TYPE) {
+                m_msg.type = std::move(val);
+                m_typed = true;
+                return true;
+            }
+
+            if(m_stack.empty() && m_field == field_t::UUID) {
+                m_msg.uuid = std::move(val);
+                return true;
+            }
+
+            return scalar(nlohmann::json(std::move(val)));
+        }
+
+        bool binary(binary_t &val) override
+        {
+            return scalar(nlohmann::json(std::move(val)));
+        }
+
+        bool start_object(std::size_t) override
+        {
+            if(!m_started) {
+                m_started = true;
+                reset();
+                return true;
+            }
+
+            return open(nlohmann::json::object());
+        }
+
+        bool key(string_t &val) override
+        {
+            if(!m_stack.empty()) {
+                m_key = std::move(val);
+                return true;
+            }
+
+            // Fields of the envelope, as read by from_json(Message)
+            m_field = field_t::JSON;
+            if(val == "type") {
+                m_field = field_t::TYPE;
+            }
+            else if(val == "uuid") {
+                m_field = field_t::UUID;
+            }
+            else if(val == "every") {
+                m_field = field_t::EVERY;
+            }
+            else if(val == "revision") {
+                m_field = field_t::REVISION;
+            }
+            else if(val == "path") {
+                m_target = &m_msg.path;
+            }
+            else if(val == "value") {
+                m_target = &m_msg.value;
+            }
+            else if(val == "params") {
+                m_target = &m_msg.params;
+            }
+            else {
+                m_target = &m_ignored;
+            }
+
+            // A later duplicate replaces the earlier value
+            if(m_field == field_t::UUID)
+                m_msg.uuid.clear();
+            else if(m_field == field_t::EVERY)
+                m_msg.every = 0;
+            else if(m_field == field_t::REVISION)
+                m_msg.revision = 0;
+
+            return true;
+        }
+
+        bool end_object() override
+        {
+            if(!m_stack.empty())
+                m_stack.pop_back();
+
+            return true;
+        }
+
+        bool start_array(std::size_t) override
+        {
+            // An array of Messages is a batch frame
+            if(!m_started) {
+                m_started = true;
+                m_batch = true;
+                reset();
+                m_msg.type = "batch";
+                m_field = field_t::JSON;
+                m_target = &m_msg.value;
+            }
+
+            return open(nlohmann::json::array());
+        }
+
+        bool end_array() override
+        {
+            m_stack.pop_back();
+            return true;
+        }
+
+        bool parse_error(std::size_t, const std::string&, const nlohmann::json::exception&) override
+        {
+            return false;
+        }
+
+    private:
+        /** Envelope field being read. */
+        enum class field_t { TYPE, UUID, EVERY, REVISION, JSON };
+
+        /** Clears the Message, missing fields take their from_json(Message) defaults. */
+        void reset()
+        {
+            m_msg.type.clear();
+            m_msg.path = nullptr;
+            m_msg.uuid.clear();
+            m_msg.value = nullptr;
+            m_msg.params = nullptr;
+            m_msg.every = 0;
+            m_msg.revision = 0;
+        }
+
+        /** Stores a value in the field being read, or in the container holding it. */
+        nlohmann::json *store(nlohmann::json &&value)
+        {
+            if(m_stack.empty()) {
+                *m_target = std::move(value);
+                return m_target;
+            }
+
+            nlohmann::json &parent = *m_stack.back();
+            if(parent.is_array()) {
+                parent.push_back(std::move(value));
+                return &parent.back();
+            }
+
+            nlohmann::json &slot = parent[m_key];
+            slot = std::move(value);
+            return &slot;
+        }
+
+        /** Handles a scalar, which may be a whole envelope field. */
+        bool scalar(nlohmann::json &&value)
+        {
+            if(!m_started || (m_stack.empty() && m_field == field_t::TYPE))
+                return false;
+
+            // Values of the wrong type are ignored, as by from_json(Message)
+            if(m_stack.empty() && m_field != field_t::JSON)
+                return true;
+
+            store(std::move(value));
+            return true;
+        }
+
+        /** Starts a container. */
+        bool open(nlohmann::json &&container)
+        {
+            if(m_stack.empty()) {
+                if(m_field == field_t::TYPE)
+                    return false;
+
+                if(m_field != field_t::JSON)
+                    m_target = &m_ignored;
+            }
+
+            m_stack.push_back(store(std::move(container)));
+            return true;
+        }
+
+        entangld::Message &m_msg;
+        std::vector<nlohmann::json*> m_stack;   /**< Containers being filled. */
+        nlohmann::json *m_target = nullptr;     /**< Destination of the JSON field. */
+        nlohmann::json m_ignored;               /**< Destination of unknown fields. */
+        std::string m_key;                      /**< Key of the next value in an object. */
+        field_t m_field = field_t::JSON;
+        bool m_started = false;
+        bool m_typed = false;
+        bool m_batch = false;
+};
+
+namespace entangld
+{
+    void encode(const Message &msg, Format format, std::vector<uint8_t> &out)
+    {
+        nlohmann::json j = msg;
+        switch(format) {
+            case Format::JSON: {
+                std::string text = j.dump();
+                out.insert(out.end(), text.begin(), text.end());
+                break;
+            }
+            case Format::CBOR:
+                nlohmann::json::to_cbor(j, out);
+                break;
+
+            case Format::MSGPACK:
+                nlohmann::json::to_msgpack(j, out);
+                break;
+        }
+    }
+
+    std::vector<uint8_t> encode(const Message &msg, Format format)
+    {
+        std::vector<uint8_t> out;
+        encode(msg, format, out);
+        return out;
+    }
+
+    Message decode(const uint8_t *data, size_t size, Format format)
+    {
+        Message msg;
+        decode(data, size, format, msg);
+        return msg;
+    }
+
+    void decode(const uint8_t *data, size_t size, Format format, Message &msg)
+    {
+        nlohmann::json::input_format_t input = nlohmann::json::input_format_t::json;
+        if(format == Format::CBOR)
+            input = nlohmann::json::input_format_t::cbor;
+        else if(format == Format::MSGPACK)
+            input = nlohmann::json::input_format_t::msgpack;
+
+        message_sax_t sax(msg);
+        if(nlohmann::json::sax_parse(data, data + size, &sax, input) && sax.complete())
+            return;
+
+        // Parse again to throw the error from_json(Message) would
+        msg = decode_dom(data, size, format);
+    }
+
+    Message decode_dom(const uint8_t *data, size_t size, Format format)
+    {
+        switch(format) {
+            case Format::CBOR:
+                return nlohmann::json::from_cbor(data, data + size).get<Message>();
+
+            case Format::MSGPACK:
+                return nlohmann::json::from_msgpack(data, data + size).get<Message>();
+
+            default:
+                return nlohmann::json::parse(data, data + size).get<Message>();
+        }
+    }
+
+    void frame(const Message &msg, Format format, std::vector<uint8_t> &out)
+    {
+        if(format == Format::JSON) {
+            encode(msg, format, out);
+            out.push_back('\n');
+            return;
+        }
+
+        // Reserve the length prefix and fill it in once the size is known
+        size_t start = out.size();
+        out.resize(start + 4);
+        encode(msg, format, out);
+
+        uint32_t length = out.size() - start - 4;
+        out[start+0] = (length >> 24) & 0xff;
+        out[start+1] = (length >> 16) & 0xff;
+        out[start+2] = (length >> 8) & 0xff;
+        out[start+3] = length & 0xff;
+    }
+
+    size_t next_frame(
+        const uint8_t *data, size_t size, Format format, size_t &payload, size_t &length)
+    {
+        if(format == Format::JSON) {
+            const void *end = memchr(data, '\n', size);
+            if(end == nullptr)
+                return 0;
+
+            payload = 0;
+            length = static_cast<const uint8_t*>(end) - data;
+            return length + 1;
+        }
+
+        if(size < 4)
+            return 0;
+
+        uint32_t prefix = (uint32_t(data[0]) << 24)
+            | (uint32_t(data[1]) << 16)
+            | (uint32_t(data[2]) << 8)
+            | uint32_t(data[3]);
+
+        if(size - 4 < prefix)
+            return 0;
+
+        payload = 4;
+        length = prefix;
+        return length + 4;
+    }
+
+    size_t unframe(const uint8_t *data, size_t size, Format format, Message &msg)
+    {
+        size_t payload, length;
+        size_t count = next_frame(data, size, format, payload, length);
+        if(count > 0)
+            decode(data + payload, length, format, msg);
+
+        return count;
+    }
+}
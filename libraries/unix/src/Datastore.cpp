@@ -5,13 +5,100 @@
  * @copyright 2019 Nova Dynamics LLC
  */
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <random>
 #include <stdexcept>
 #include <uuid/uuid.h>
 
 #include "Datastore.h"
+#include "Trace.h"
 
-/** Generates a UUID and returns it in a std::string. */
-static std::string get_uuidstring()
+/** Wraps several Messages in a single "batch" Message. */
+static entangld::Message make_batch(const std::vector<entangld::Message> &msgs)
+{
+    entangld::Message batch;
+    batch.type = "batch";
+    batch.value = nlohmann::json::array();
+    for(const entangld::Message &msg : msgs)
+        batch.value.push_back(msg);
+
+    return batch;
+}
+
+/** Holds a batch open for its lifetime, and closes it even on unwind. */
+class batch_scope_t {
+    public:
+        explicit batch_scope_t(entangld::Datastore *store) : m_store(store)
+        {
+            m_store->begin();
+        }
+
+        /** Commits the batch, letting exceptions from callbacks through. */
+        void commit()
+        {
+            m_store->commit();
+            m_store = nullptr;
+        }
+
+        ~batch_scope_t()
+        {
+            if(!m_store)
+                return;
+
+            // Already unwinding, so a second exception cannot be raised
+            try {
+                m_store->commit();
+            }
+            catch(...) {}
+        }
+
+        batch_scope_t(const batch_scope_t&) = delete;
+        batch_scope_t &operator=(const batch_scope_t&) = delete;
+
+    private:
+        entangld::Datastore *m_store;
+};
+
+static const char HEX_DIGITS[] = "0123456789abcdef";
+
+/** Writes the low digits * 4 bits of value as lowercase hex. */
+static void to_hex(uint64_t value, char *out, int digits)
+{
+    for(int i = digits - 1; i >= 0; --i) {
+        out[i] = HEX_DIGITS[value & 0xf];
+        value >>= 4;
+    }
+}
+
+/** Parses digits hex characters, returning false if any is not hex. */
+static bool from_hex(const char *in, int digits, uint64_t &value)
+{
+    value = 0;
+    for(int i = 0; i < digits; ++i) {
+        char c = in[i];
+        uint64_t nibble;
+        if(c >= '0' && c <= '9')
+            nibble = c - '0';
+        else if(c >= 'a' && c <= 'f')
+            nibble = c - 'a' + 10;
+        else
+            return false;
+
+        value = (value << 4) | nibble;
+    }
+
+    return true;
+}
+
+/** Generates a UUID into out.
+ *
+ * A slot takes the place of the last 8 digits, so only the digits around
+ * it are filled from the random UUID.
+ */
+static void format_uuid(std::string &out, long slot = -1)
 {
     union {
         uuid_t raw;
@@ -20,313 +107,3006 @@ static std::string get_uuidstring()
 
     uuid_generate(uuid.raw);
 
-    char buffer[37];
-    sprintf(buffer, "%04x%04x-%04x-%04x-%04x-%04x%04x%04x",
-        uuid.u16[0],
-        uuid.u16[1],
-        uuid.u16[2],
-        uuid.u16[3],
-        uuid.u16[4],
-        uuid.u16[5],
-        uuid.u16[6],
-        uuid.u16[7]
-    );
-
-    return std::string(buffer);
+    // Same layout as "%04x%04x-%04x-%04x-%04x-%04x%04x%04x"
+    char buffer[36];
+    char *p = buffer;
+    int random = (slot >= 0) ? 6 : 8;
+    for(int i = 0; i < random; ++i) {
+        if(i >= 2 && i <= 5)
+            *p++ = '-';
+
+        to_hex(uuid.u16[i], p, 4);
+        p += 4;
+    }
+
+    if(slot >= 0)
+        to_hex(slot, p, 8);
+
+    out.assign(buffer, sizeof(buffer));
+}
+
+/** Wraps a callback function and context in a callable. */
+static entangld::Datastore::callback_t bind_callback(
+    void (*callback)(const entangld::Message &msg, void *ctx), void *ctx)
+{
+    return [callback, ctx](const entangld::Message &msg) { callback(msg, ctx); };
+}
+
+/** Number of trailing hex digits holding the slot of a get request. */
+static const size_t SLOT_DIGITS = 8;
+
+/** Appends path segments to a json pointer, escaped as in RFC 6901. */
+static void append_pointer(std::string &out, const std::vector<std::string> &segments, size_t first)
+{
+    for(size_t i = first; i < segments.size(); ++i) {
+        out += '/';
+        for(char c : segments[i]) {
+            if(c == '~')
+                out += "~0";
+            else if(c == '/')
+                out += "~1";
+            else
+                out += c;
+        }
+    }
+}
+
+/** Returns the value at a pointer, or null if there is none.
+ *
+ * Unlike json::value() the value is not copied, and a missing path does not
+ * throw.
+ */
+static const nlohmann::json &lookup(const nlohmann::json &doc, const nlohmann::json::json_pointer &ptr)
+{
+    static const nlohmann::json missing;
+    return (doc.contains(ptr)) ? doc.at(ptr) : missing;
+}
+
+/** Returns the value at a pointer, creating it and its parents if missing.
+ *
+ * json::operator[] builds a map node for every segment before finding out
+ * that it already exists, so existing paths are looked up first.
+ */
+static nlohmann::json &locate(nlohmann::json &doc, const nlohmann::json::json_pointer &ptr)
+{
+    return (doc.contains(ptr)) ? doc.at(ptr) : doc[ptr];
+}
+
+/** Copies a value over another, reusing the storage the target already has.
+ *
+ * Strings keep their buffers and containers their nodes wherever the old and
+ * new values have the same shape, so writing a structure of the same layout
+ * over and over does not allocate.
+ *
+ * @return true if dst changed.
+ */
+static bool overwrite(nlohmann::json &dst, const nlohmann::json &src)
+{
+    if(dst.type() != src.type()) {
+        dst = src;
+        return true;
+    }
+
+    bool changed = false;
+    switch(src.type()) {
+        case nlohmann::json::value_t::string: {
+            nlohmann::json::string_t &to = *dst.get_ptr<nlohmann::json::string_t*>();
+            const nlohmann::json::string_t &from = *src.get_ptr<const nlohmann::json::string_t*>();
+            if(to != from) {
+                to = from;
+                changed = true;
+            }
+            break;
+        }
+
+        case nlohmann::json::value_t::array: {
+            nlohmann::json::array_t &to = *dst.get_ptr<nlohmann::json::array_t*>();
+            const nlohmann::json::array_t &from = *src.get_ptr<const nlohmann::json::array_t*>();
+            if(to.size() > from.size()) {
+                to.erase(to.begin() + from.size(), to.end());
+                changed = true;
+            }
+
+            for(size_t i = 0; i < to.size(); ++i)
+                changed |= overwrite(to[i], from[i]);
+
+            for(size_t i = to.size(); i < from.size(); ++i) {
+                to.push_back(from[i]);
+                changed = true;
+            }
+
+            break;
+        }
+
+        case nlohmann::json::value_t::object: {
+            nlohmann::json::object_t &to = *dst.get_ptr<nlohmann::json::object_t*>();
+            const nlohmann::json::object_t &from = *src.get_ptr<const nlohmann::json::object_t*>();
+            for(auto it = to.begin(); it != to.end();) {
+                if(from.count(it->first) == 0) {
+                    it = to.erase(it);
+                    changed = true;
+                }
+                else {
+                    ++it;
+                }
+            }
+
+            for(const auto &entry : from) {
+                auto it = to.find(entry.first);
+                if(it == to.end()) {
+                    to.emplace(entry.first, entry.second);
+                    changed = true;
+                }
+                else {
+                    changed |= overwrite(it->second, entry.second);
+                }
+            }
+
+            break;
+        }
+
+        default:
+            if(dst != src) {
+                dst = src;
+                changed = true;
+            }
+            break;
+    }
+
+    return changed;
+}
+
+/** Appends a value to an array, first dropping the oldest elements past limit.
+ *
+ * Elements are dropped before the append so a full window keeps its
+ * allocation.
+ *
+ * @return true if elements were dropped.
+ */
+template<typename T>
+static bool append(nlohmann::json &target, T &&value, size_t limit)
+{
+    bool trimmed = false;
+    if(limit > 0 && target.is_array() && target.size() >= limit) {
+        nlohmann::json::array_t &items = *target.get_ptr<nlohmann::json::array_t*>();
+        items.erase(items.begin(), items.begin() + (items.size() - limit + 1));
+        trimmed = true;
+    }
+
+    target.push_back(std::forward<T>(value));
+    return trimmed;
+}
+
+/** Returns the push limit carried in the params of a Message. */
+static size_t limit_of(const entangld::Message &msg)
+{
+    return (msg.params.is_object()) ? msg.params.value("limit", size_t(0)) : 0;
+}
+
+/** Applies a set or push to the mirror of a remote store. */
+static void write_mirror(
+    nlohmann::json &mirror, const entangld::Path &path, size_t depth,
+    const nlohmann::json &value, bool push, size_t limit)
+{
+    std::string pointer;
+    append_pointer(pointer, path.segments(), depth);
+
+    nlohmann::json &target = (pointer.empty())
+        ? mirror : locate(mirror, nlohmann::json::json_pointer(pointer));
+
+    if(push)
+        append(target, value, limit);
+    else
+        overwrite(target, value);
+}
+
+/** Applies a patch from a delta subscription to a mirror.
+ *
+ * Writes are replayed the way set and push made them, so missing parents
+ * are created rather than rejected as RFC 6902 would.
+ */
+static void apply_patch(nlohmann::json &doc, const nlohmann::json &patch)
+{
+    for(const nlohmann::json &op : patch) {
+        const std::string &type = op.at("op").get_ref<const std::string&>();
+        const std::string &path = op.at("path").get_ref<const std::string&>();
+        const nlohmann::json &value = op.at("value");
+
+        if(type == "add" && path.size() >= 2 && path.compare(path.size() - 2, 2, "/-") == 0) {
+            std::string parent = path.substr(0, path.size() - 2);
+            nlohmann::json &target = (parent.empty()) ? doc : locate(doc, nlohmann::json::json_pointer(parent));
+            target.push_back(value);
+        }
+        else if(type == "add" || type == "replace") {
+            if(path.empty())
+                overwrite(doc, value);
+            else
+                overwrite(locate(doc, nlohmann::json::json_pointer(path)), value);
+        }
+        else {
+            doc = doc.patch(nlohmann::json::array({op}));
+        }
+    }
+}
+
+/** Copies a value down to a number of levels, leaving deeper containers empty. */
+static void copy_levels(const nlohmann::json &src, nlohmann::json &dst, unsigned int levels)
+{
+    if(src.is_object()) {
+        dst = nlohmann::json::object();
+        if(levels == 0)
+            return;
+
+        for(auto it = src.begin(); it != src.end(); ++it)
+            copy_levels(it.value(), dst[it.key()], levels - 1);
+    }
+    else if(src.is_array()) {
+        dst = nlohmann::json::array();
+        if(levels == 0)
+            return;
+
+        for(const nlohmann::json &item : src) {
+            dst.push_back(nullptr);
+            copy_levels(item, dst.back(), levels - 1);
+        }
+    }
+    else {
+        dst = src;
+    }
+}
+
+/** Returns true if one path is the other or one of its parents. */
+static bool overlaps(const entangld::Path &a, const entangld::Path &b)
+{
+    const std::vector<std::string> &x = a.segments();
+    const std::vector<std::string> &y = b.segments();
+    return std::equal(x.begin(), x.begin() + std::min(x.size(), y.size()), y.begin());
+}
+
+/** Returns true if get options ask for the whole value. */
+static bool is_whole(const entangld::Datastore::get_opts_t &opts)
+{
+    return opts.max_depth == 0 && opts.fields.empty() && !opts.keys_only && opts.revision == 0;
+}
+
+/** Copies the part of a value selected by get options. */
+static void shape(
+    const nlohmann::json &value, const entangld::Datastore::get_opts_t &opts, nlohmann::json &out)
+{
+    if(opts.keys_only) {
+        out = nlohmann::json::array();
+        if(value.is_object()) {
+            for(auto it = value.begin(); it != value.end(); ++it)
+                out.push_back(it.key());
+        }
+        else if(value.is_array()) {
+            for(size_t i = 0; i < value.size(); ++i)
+                out.push_back(i);
+        }
+        return;
+    }
+
+    if(opts.fields.empty()) {
+        if(opts.max_depth == 0)
+            out = value;
+        else
+            copy_levels(value, out, opts.max_depth);
+        return;
+    }
+
+    // Fields count towards the depth limit from the requested path
+    out = nlohmann::json::object();
+    for(const std::string &field : opts.fields) {
+        entangld::Path path(field);
+        if(!value.contains(path.pointer()))
+            continue;
+
+        size_t levels = path.segments().size();
+        nlohmann::json &target = out[path.pointer()];
+        if(opts.max_depth == 0)
+            target = value.at(path.pointer());
+        else if(levels < opts.max_depth)
+            copy_levels(value.at(path.pointer()), target, opts.max_depth - levels);
+        else
+            copy_levels(value.at(path.pointer()), target, 0);
+    }
+}
+
+/** Encodes get options as the params of a "get" Message. */
+static nlohmann::json params_of(const entangld::Datastore::get_opts_t &opts)
+{
+    nlohmann::json params = nlohmann::json::object();
+    if(opts.max_depth > 0)
+        params["max_depth"] = opts.max_depth;
+
+    if(!opts.fields.empty())
+        params["fields"] = opts.fields;
+
+    if(opts.keys_only)
+        params["keys_only"] = true;
+
+    if(opts.revision > 0)
+        params["revision"] = opts.revision;
+
+    return params;
 }
 
-namespace entangld
-{
-    void Datastore::reset()
+/** Decodes get options from the params of a "get" Message. */
+static entangld::Datastore::get_opts_t opts_of(const nlohmann::json &params)
+{
+    entangld::Datastore::get_opts_t opts;
+    if(!params.is_object())
+        return opts;
+
+    opts.max_depth = params.value("max_depth", 0u);
+    opts.keys_only = params.value("keys_only", false);
+    opts.revision = params.value("revision", uint64_t(0));
+
+    auto fields = params.find("fields");
+    if(fields != params.end() && fields->is_array()) {
+        for(const nlohmann::json &field : *fields) {
+            if(field.is_string())
+                opts.fields.push_back(field.get<std::string>());
+        }
+    }
+
+    return opts;
+}
+
+namespace entangld
+{
+#ifdef ENTANGLD_CONCURRENT
+    /** Store locked by this thread, lets public methods call each other. */
+    static thread_local const Datastore *tls_locked = nullptr;
+
+    /** True if this thread holds tls_locked exclusively. */
+    static thread_local bool tls_exclusive = false;
+
+    class Datastore::guard_t {
+        public:
+            guard_t(const Datastore *store, bool exclusive)
+            : m_store(const_cast<Datastore*>(store)), m_owner(tls_locked != store)
+            {
+                if(!m_owner) {
+                    assert(tls_exclusive || !exclusive);
+                    return;
+                }
+
+                if(exclusive)
+                    pthread_rwlock_wrlock(&m_store->m_lock);
+                else
+                    pthread_rwlock_rdlock(&m_store->m_lock);
+
+                tls_locked = m_store;
+                tls_exclusive = exclusive;
+            }
+
+            ~guard_t()
+            {
+                if(!m_owner)
+                    return;
+
+                tls_locked = nullptr;
+                tls_exclusive = false;
+                pthread_rwlock_unlock(&m_store->m_lock);
+
+                m_store->drain();
+            }
+
+            guard_t(const guard_t&) = delete;
+            guard_t &operator=(const guard_t&) = delete;
+
+        private:
+            Datastore *m_store;
+            bool m_owner;
+    };
+#else
+    class Datastore::guard_t {
+        public:
+            guard_t(const Datastore*, bool) {};
+    };
+#endif
+
+    class Datastore::fanout_t {
+        public:
+            fanout_t(Datastore *store) : m_store(store)
+            {
+                m_store->m_fanout_depth += 1;
+            }
+
+            ~fanout_t()
+            {
+                if(--m_store->m_fanout_depth == 0 && !m_store->m_swept.empty())
+                    m_store->sweep();
+            }
+
+            fanout_t(const fanout_t&) = delete;
+            fanout_t &operator=(const fanout_t&) = delete;
+
+        private:
+            Datastore *m_store;
+    };
+
+#ifdef ENTANGLD_STATS
+    struct Datastore::counters_t {
+        std::atomic<uint64_t> gets;
+        std::atomic<uint64_t> sets;
+        std::atomic<uint64_t> pushes;
+        std::atomic<uint64_t> received;
+        std::atomic<uint64_t> transmitted;
+
+        /** Guards the members below, callbacks may run on executor threads. */
+        std::mutex lock;
+        uint64_t events = 0;
+        histogram_t callback_latency;
+        histogram_t fanout_latency;
+        std::unordered_map<std::string, remote_stats_t> remotes;
+        std::unordered_map<std::string, histogram_t> subscribers;
+
+        counters_t() : gets(0), sets(0), pushes(0), received(0), transmitted(0) {};
+
+        /** Returns the traffic counters of a remote, lock must be held. */
+        remote_stats_t &remote(const std::string &name)
+        {
+            auto it = remotes.find(name);
+            if(it == remotes.end()) {
+                it = remotes.emplace(name, remote_stats_t()).first;
+                it->second.name = name;
+            }
+            return it->second;
+        }
+    };
+
+    /** Returns the nanoseconds elapsed since start. */
+    static uint64_t elapsed_ns(Datastore::clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Datastore::clock::now() - start).count();
+    }
+
+    void Datastore::histogram_t::record(uint64_t ns)
+    {
+        size_t index = 0;
+        for(uint64_t us = ns / 1000; us > 0 && index < BUCKETS - 1; us >>= 1)
+            index += 1;
+
+        buckets[index] += 1;
+        count += 1;
+        sum_ns += ns;
+        max_ns = std::max(max_ns, ns);
+    }
+
+    uint64_t Datastore::histogram_t::percentile(double p) const
+    {
+        if(count == 0)
+            return 0;
+
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * count);
+        uint64_t seen = 0;
+        for(size_t i = 0; i < BUCKETS - 1; ++i) {
+            seen += buckets[i];
+            if(seen > rank)
+                return std::min(max_ns, (uint64_t(1) << i) * 1000);
+        }
+
+        return max_ns;
+    }
+
+    void Datastore::invoke(
+        const std::shared_ptr<counters_t> &counters, const callback_t &callback, const Message &msg)
+    {
+        clock::time_point start = clock::now();
+        callback(msg);
+        uint64_t ns = elapsed_ns(start);
+
+        std::lock_guard<std::mutex> lock(counters->lock);
+        counters->callback_latency.record(ns);
+        if(msg.type != "event")
+            return;
+
+        counters->events += 1;
+
+        static const std::string unnamed;
+        const std::string &path = msg.path.is_string() ? msg.path.get_ref<const std::string&>() : unnamed;
+        auto it = counters->subscribers.find(path);
+        if(it == counters->subscribers.end())
+            it = counters->subscribers.emplace(path, histogram_t()).first;
+
+        it->second.record(ns);
+    }
+
+    Datastore::stats_t Datastore::stats() const
+    {
+        stats_t result;
+        {
+            guard_t guard(this, false);
+            result.subscriptions = m_subs_by_uuid.size();
+            result.pending_requests = m_slots.size() - m_free_slots.size();
+        }
+
+        const counters_t &counters = *m_counters;
+        result.gets = counters.gets.load(std::memory_order_relaxed);
+        result.sets = counters.sets.load(std::memory_order_relaxed);
+        result.pushes = counters.pushes.load(std::memory_order_relaxed);
+        result.received = counters.received.load(std::memory_order_relaxed);
+        result.transmitted = counters.transmitted.load(std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(m_counters->lock);
+        result.events = counters.events;
+        result.callback_latency = counters.callback_latency;
+        result.fanout_latency = counters.fanout_latency;
+
+        for(const auto &entry : counters.remotes)
+            result.remotes.push_back(entry.second);
+
+        std::sort(result.remotes.begin(), result.remotes.end(),
+            [](const remote_stats_t &a, const remote_stats_t &b) { return a.name < b.name; });
+
+        for(const auto &entry : counters.subscribers) {
+            sub_stats_t sub;
+            sub.path = entry.first;
+            sub.latency = entry.second;
+            result.subscribers.push_back(std::move(sub));
+        }
+
+        std::sort(result.subscribers.begin(), result.subscribers.end(),
+            [](const sub_stats_t &a, const sub_stats_t &b) { return a.latency.sum_ns > b.latency.sum_ns; });
+
+        return result;
+    }
+
+    void Datastore::reset_stats()
+    {
+        counters_t &counters = *m_counters;
+        counters.gets = 0;
+        counters.sets = 0;
+        counters.pushes = 0;
+        counters.received = 0;
+        counters.transmitted = 0;
+
+        std::lock_guard<std::mutex> lock(counters.lock);
+        counters.events = 0;
+        counters.callback_latency = histogram_t();
+        counters.fanout_latency = histogram_t();
+        counters.remotes.clear();
+        counters.subscribers.clear();
+    }
+
+    inline void Datastore::count_received(const std::string &name)
+    {
+        m_counters->received.fetch_add(1, std::memory_order_relaxed);
+
+        std::lock_guard<std::mutex> lock(m_counters->lock);
+        m_counters->remote(name).msgs_in += 1;
+    }
+#else
+    inline void Datastore::count_received(const std::string&) {}
+#endif
+
+    Datastore::Datastore(const nlohmann::json &data, const request_opts_t &opts)
+    : m_local_data(data), m_request_opts(opts)
+    {
+#ifdef ENTANGLD_STATS
+        m_counters = std::make_shared<counters_t>();
+#endif
+
+        if(opts.ids == id_format_t::COUNTER) {
+            std::random_device random;
+            while(m_id_prefix == 0)
+                m_id_prefix = random();
+        }
+
+#ifdef ENTANGLD_CONCURRENT
+        m_id_counter = 0;
+        m_draining = false;
+        pthread_rwlock_init(&m_lock, nullptr);
+#endif
+    }
+
+    Datastore::~Datastore()
+    {
+#ifdef ENTANGLD_CONCURRENT
+        pthread_rwlock_destroy(&m_lock);
+#endif
+    }
+
+    void Datastore::reset()
+    {
+        guard_t guard(this, true);
+
+        m_remotes.clear();
+        m_routes.children.clear();
+        m_mirrors = 0;
+        m_generation = next_generation();
+        m_slots.clear();
+        m_free_slots.clear();
+        m_deadlines.clear();
+        m_inflight.clear();
+        m_upstreams.clear();
+        m_subs.children.clear();
+        m_subs.subs.clear();
+        m_subs_by_uuid.clear();
+        m_pending.clear();
+        m_batch_depth = 0;
+        m_batch_paths.clear();
+        m_batch_msgs.clear();
+    }
+
+    void Datastore::get(
+        const Path &path,
+        void (*callback)(const Message &msg, void *ctx),
+        void *callback_ctx,
+        const std::string &uuid,
+        const get_opts_t &opts)
+    {
+        assert(callback != nullptr);
+        get(path, bind_callback(callback, callback_ctx), uuid, opts);
+    }
+
+    void Datastore::get(
+        const Path &path, callback_t callback, const std::string &uuid, const get_opts_t &opts)
+    {
+        assert(callback);
+        ENTANGLD_TRACE_SCOPE(get, path.str().c_str(), 0L);
+
+#ifdef ENTANGLD_STATS
+        m_counters->gets.fetch_add(1, std::memory_order_relaxed);
+#endif
+
+        size_t depth;
+        {
+            // Local gets only need to share the lock, unless a provider must run
+            guard_t guard(this, false);
+            remote_t *remote = resolve(path, depth);
+            if(remote == nullptr) {
+                if(m_providers.empty() || !stale(path, clock::now())) {
+                    get_local(path, std::move(callback), uuid, opts);
+                    return;
+                }
+            }
+            else if(get_mirror(remote, path, depth, callback, uuid, opts)) {
+                return;
+            }
+        }
+
+        guard_t guard(this, true);
+        remote_t *remote = resolve(path, depth);
+        if(remote == nullptr) {
+            // Stale, or detached since the path was resolved
+            if(!m_providers.empty())
+                refresh(path, clock::now());
+
+            get_local(path, std::move(callback), uuid, opts);
+            return;
+        }
+
+        // Gets of a different shape get different replies
+        std::string key = path.str();
+        nlohmann::json params;
+        if(!is_whole(opts)) {
+            params = params_of(opts);
+            key += '?';
+            key += params.dump();
+        }
+
+        // Data is in remote store, share a reply that is already on its way
+        auto inflight = m_inflight.find(key);
+        if(inflight != m_inflight.end()) {
+            m_slots[inflight->second].followers.emplace_back(std::move(callback), uuid);
+            return;
+        }
+
+        request(remote, "get", path.relative(depth), std::move(params), uuid, std::move(callback), std::move(key));
+    }
+
+    void Datastore::request(
+        remote_t *remote,
+        const char *type,
+        std::string &&path,
+        nlohmann::json &&params,
+        const std::string &uuid,
+        callback_t &&callback,
+        std::string &&key)
+    {
+        if(m_request_opts.max_pending > 0 && m_slots.size() - m_free_slots.size() >= m_request_opts.max_pending) {
+            Message msg;
+            msg.type = "timeout";
+            msg.path = std::move(path);
+            msg.uuid = uuid;
+
+            dispatch(callback, std::move(msg));
+            return;
+        }
+
+        uint32_t index = acquire_slot();
+        slot_t &slot = m_slots[index];
+
+        request_t &request = slot.request;
+        request.msg.type = type;
+        request.msg.path = std::move(path);
+        request.msg.params = std::move(params);
+        request.remote = remote;
+        request.callback = std::move(callback);
+
+        if(!key.empty()) {
+            slot.key = std::move(key);
+            m_inflight[slot.key] = index;
+        }
+
+        // Tag the uuid with the slot so the reply finds it directly
+        if(uuid.empty()) {
+            generate_id(request.msg.uuid, index);
+        }
+        else {
+            request.msg.uuid = uuid;
+            m_named_slots[uuid] = index;
+            slot.named = true;
+        }
+
+        if(m_request_opts.timeout.count() > 0) {
+            slot.deadline = clock::now() + m_request_opts.timeout;
+            m_deadlines.push_back({slot.deadline, index, slot.serial});
+        }
+
+        transmit(remote, request.msg);
+    }
+
+    bool Datastore::get_mirror(
+        const remote_t *remote,
+        const Path &path,
+        size_t depth,
+        callback_t &callback,
+        const std::string &uuid,
+        const get_opts_t &opts)
+    {
+        // Mirrors do not know the revisions of the remote
+        if(!remote->mirror_ready || opts.revision > 0)
+            return false;
+
+        const std::chrono::milliseconds &max_stale = remote->opts.max_stale;
+        if(max_stale.count() > 0 && clock::now() - remote->heard > max_stale)
+            return false;
+
+        std::string pointer;
+        append_pointer(pointer, path.segments(), depth);
+
+        Message msg;
+        msg.type = "value";
+        msg.path = path.relative(depth);
+        if(uuid.empty())
+            generate_id(msg.uuid);
+        else
+            msg.uuid = uuid;
+
+        const nlohmann::json &mirror = remote->mirror;
+        if(mirror.is_object())
+            shape(lookup(mirror, nlohmann::json::json_pointer(pointer)), opts, msg.value);
+
+        dispatch(callback, std::move(msg));
+        return true;
+    }
+
+    void Datastore::get_local(
+        const Path &path, callback_t &&callback, const std::string &uuid, const get_opts_t &opts)
+    {
+        if(!m_rpcs.empty() && call_local(path, nullptr, std::move(callback), uuid, opts))
+            return;
+
+        Message msg;
+        msg.type = "value";
+        msg.path = path.str();
+        if(uuid.empty())
+            generate_id(msg.uuid);
+        else
+            msg.uuid = uuid;
+
+        msg.revision = revision_of(path.str());
+        if(opts.revision > 0 && opts.revision == msg.revision)
+            msg.params["not_modified"] = true;
+        else if(is_whole(opts))
+            msg.value = lookup(m_local_data, path.pointer());
+        else
+            shape(lookup(m_local_data, path.pointer()), opts, msg.value);
+
+        dispatch(callback, std::move(msg));
+    }
+
+    uint64_t Datastore::revision(const Path &path) const
+    {
+        guard_t guard(this, false);
+        return revision_of(path.str());
+    }
+
+    void Datastore::touch(const Path &path)
+    {
+        uint64_t revision = ++m_revision;
+
+        rev_node_t *node = &m_revisions;
+        node->latest = revision;
+        for(const std::string &segment : path.segments()) {
+            std::unique_ptr<rev_node_t> &child = node->children[segment];
+            if(!child)
+                child.reset(new rev_node_t);
+
+            node = child.get();
+            node->latest = revision;
+        }
+
+        node->own = revision;
+    }
+
+    uint64_t Datastore::revision_of(const std::string &path) const
+    {
+        // A write to a parent replaced the path, so it also counts
+        uint64_t revision = 0;
+        const rev_node_t *node = &m_revisions;
+        std::string segment;
+        size_t start = 0;
+        while(!path.empty()) {
+            revision = std::max(revision, node->own);
+
+            size_t end = path.find('.', start);
+            segment.assign(path, start, (end == std::string::npos) ? std::string::npos : end - start);
+
+            auto child = node->children.find(segment);
+            if(child == node->children.end())
+                return revision;
+
+            node = child->second.get();
+            if(end == std::string::npos)
+                break;
+
+            start = end + 1;
+        }
+
+        return std::max(revision, node->latest);
+    }
+
+    void Datastore::set_rpc(const Path &path, rpc_t rpc)
+    {
+        guard_t guard(this, true);
+        if(rpc)
+            m_rpcs[path.str()] = std::move(rpc);
+        else
+            m_rpcs.erase(path.str());
+    }
+
+    void Datastore::set_provider(const Path &path, provider_t provider, std::chrono::milliseconds ttl)
+    {
+        guard_t guard(this, true);
+
+        auto it = std::find_if(m_providers.begin(), m_providers.end(),
+            [&](const provided_t &entry) { return entry.path.str() == path.str(); });
+
+        if(!provider) {
+            if(it != m_providers.end())
+                m_providers.erase(it);
+
+            return;
+        }
+
+        if(it == m_providers.end())
+            it = m_providers.insert(m_providers.end(), provided_t());
+
+        it->path = path;
+        it->provider = std::move(provider);
+        it->ttl = ttl;
+        it->ready = false;
+    }
+
+    bool Datastore::stale(const Path &path, clock::time_point now) const
+    {
+        for(const provided_t &entry : m_providers) {
+            if(overlaps(entry.path, path) && (!entry.ready || now - entry.computed >= entry.ttl))
+                return true;
+        }
+
+        return false;
+    }
+
+    void Datastore::refresh(const Path &path, clock::time_point now)
+    {
+        // Subscribers may remove providers, so index rather than iterate
+        for(size_t i = 0; i < m_providers.size(); ++i) {
+            provided_t &entry = m_providers[i];
+            if(overlaps(entry.path, path) && (!entry.ready || now - entry.computed >= entry.ttl))
+                provide(entry, now);
+        }
+    }
+
+    void Datastore::provide(provided_t &entry, clock::time_point now)
+    {
+        nlohmann::json value = entry.provider();
+        entry.computed = now;
+        entry.ready = true;
+
+        nlohmann::json &target = locate(m_local_data, entry.path.pointer());
+        if(target == value)
+            return;
+
+        target = std::move(value);
+        touch(entry.path);
+
+        // Subscribers may remove the provider, so notify with a copy of its path
+        Path path = entry.path;
+        notify_path(path);
+    }
+
+    bool Datastore::watched(const Path &path) const
+    {
+        // Subscriptions on the path or its parents, then beneath it
+        const std::vector<std::string> &segments = path.segments();
+        const sub_node_t *node = &m_subs;
+        for(size_t i = 0; i < segments.size(); ++i) {
+            if(!node->subs.empty())
+                return true;
+
+            auto child = node->children.find(segments[i]);
+            if(child == node->children.end())
+                return false;
+
+            node = child->second.get();
+        }
+
+        // Empty nodes are pruned, so any node left beneath holds a subscription
+        return !node->subs.empty() || !node->children.empty();
+    }
+
+    void Datastore::call(
+        const Path &path,
+        nlohmann::json args,
+        void (*callback)(const Message &msg, void *ctx),
+        void *callback_ctx,
+        const std::string &uuid)
+    {
+        assert(callback != nullptr);
+        call(path, std::move(args), bind_callback(callback, callback_ctx), uuid);
+    }
+
+    void Datastore::call(
+        const Path &path, nlohmann::json args, callback_t callback, const std::string &uuid)
+    {
+        assert(callback);
+        guard_t guard(this, true);
+
+        size_t depth;
+        remote_t *remote = resolve(path, depth);
+        if(remote == nullptr) {
+            if(!call_local(path, std::move(args), std::move(callback), uuid, get_opts_t()))
+                get_local(path, std::move(callback), uuid, get_opts_t());
+
+            return;
+        }
+
+        // Calls have side effects, so they are never shared
+        request(remote, "call", path.relative(depth), std::move(args), uuid, std::move(callback), std::string());
+    }
+
+    bool Datastore::call_local(
+        const Path &path,
+        nlohmann::json &&args,
+        callback_t &&callback,
+        const std::string &uuid,
+        const get_opts_t &opts)
+    {
+        auto it = m_rpcs.find(path.str());
+        if(it == m_rpcs.end())
+            return false;
+
+        Message msg;
+        msg.type = "call";
+        msg.path = path.str();
+        msg.params = std::move(args);
+        if(uuid.empty())
+            generate_id(msg.uuid);
+        else
+            msg.uuid = uuid;
+
+        // Run the handler like a callback, it replies through a closure
+        Datastore *store = this;
+        rpc_t rpc = it->second;
+        dispatch([store, rpc, callback, opts](const Message &call) {
+            Message reply;
+            reply.type = "value";
+            reply.path = call.path;
+            reply.uuid = call.uuid;
+
+            rpc(call.params, [store, callback, opts, reply](const nlohmann::json &result) mutable {
+                if(is_whole(opts))
+                    reply.value = result;
+                else
+                    shape(result, opts, reply.value);
+
+                guard_t guard(store, true);
+                store->dispatch(callback, std::move(reply));
+            });
+        }, std::move(msg));
+
+        return true;
+    }
+
+    size_t Datastore::pending_requests() const
+    {
+        guard_t guard(this, false);
+        return m_slots.size() - m_free_slots.size();
+    }
+
+    void Datastore::set(const Path &path, const nlohmann::json &value, bool push, size_t limit)
+    {
+        ENTANGLD_TRACE_SCOPE(set, path.str().c_str(), push);
+        guard_t guard(this, true);
+
+#ifdef ENTANGLD_STATS
+        (push ? m_counters->pushes : m_counters->sets).fetch_add(1, std::memory_order_relaxed);
+#endif
+
+        size_t depth;
+        remote_t *remote = resolve(path, depth);
+        if(remote == nullptr) {
+            // Data is in local store
+            nlohmann::json &target = locate(m_local_data, path.pointer());
+            bool trimmed = false;
+            unsigned long stamp = 0;
+            if(push) {
+                trimmed = append(target, value, limit);
+            }
+            else if(m_only_changes) {
+                stamp = ++m_write_stamp;
+                if(!assign(target, value, find_node(path.segments(), false), stamp))
+                    return;
+            }
+            else {
+                overwrite(target, value);
+            }
+
+            touch(path);
+
+            if(m_write_hook)
+                m_write_hook(path, value, push, limit, m_write_hook_ctx);
+
+            notify_path(path, push && !trimmed, stamp);
+        }
+        else {
+            // Data is in remote store, keep its mirror current
+            if(remote->mirror_ready)
+                write_mirror(remote->mirror, path, depth, value, push, limit);
+
+            Message msg;
+            msg.type = (push) ? "push" : "set";
+            msg.path = path.relative(depth);
+            msg.value = value;
+            if(push && limit > 0)
+                msg.params["limit"] = limit;
+
+            send(remote, std::move(msg));
+        }
+    }
+
+    void Datastore::set(const Path &path, nlohmann::json &&value, bool push, size_t limit)
+    {
+        ENTANGLD_TRACE_SCOPE(set, path.str().c_str(), push);
+        guard_t guard(this, true);
+
+#ifdef ENTANGLD_STATS
+        (push ? m_counters->pushes : m_counters->sets).fetch_add(1, std::memory_order_relaxed);
+#endif
+
+        size_t depth;
+        remote_t *remote = resolve(path, depth);
+        if(remote == nullptr) {
+            // Data is in local store
+            nlohmann::json &target = locate(m_local_data, path.pointer());
+            bool trimmed = false;
+            unsigned long stamp = 0;
+            if(push) {
+                trimmed = append(target, std::move(value), limit);
+            }
+            else if(m_only_changes) {
+                // Copied rather than moved, comparing as it goes
+                stamp = ++m_write_stamp;
+                if(!assign(target, value, find_node(path.segments(), false), stamp))
+                    return;
+            }
+            else {
+                target = std::move(value);
+            }
+
+            touch(path);
+
+            // The pushed element is the last one, even once the window is trimmed
+            if(m_write_hook)
+                m_write_hook(path, (push) ? target.back() : target, push, limit, m_write_hook_ctx);
+
+            notify_path(path, push && !trimmed, stamp);
+        }
+        else {
+            // Data is in remote store, keep its mirror current
+            if(remote->mirror_ready)
+                write_mirror(remote->mirror, path, depth, value, push, limit);
+
+            Message msg;
+            msg.type = (push) ? "push" : "set";
+            msg.path = path.relative(depth);
+            msg.value = std::move(value);
+            if(push && limit > 0)
+                msg.params["limit"] = limit;
+
+            send(remote, std::move(msg));
+        }
+    }
+
+    void Datastore::begin()
+    {
+        guard_t guard(this, true);
+        m_batch_depth += 1;
+    }
+
+    void Datastore::commit()
+    {
+        guard_t guard(this, true);
+        assert(m_batch_depth > 0);
+        if(--m_batch_depth > 0)
+            return;
+
+        // Callbacks may open a new batch, so take ownership of this one
+        std::vector<Path> paths;
+        std::swap(paths, m_batch_paths);
+
+        std::vector<std::pair<remote_t*, std::vector<Message>>> msgs;
+        std::swap(msgs, m_batch_msgs);
+
+        // Notify each affected subscription once
+        std::vector<sub_node_t*> nodes;
+        std::unordered_set<sub_node_t*> seen;
+        for(const Path &path : paths)
+            collect(path, nodes, &seen);
+
+#ifdef ENTANGLD_STATS
+        clock::time_point start = clock::now();
+#endif
+
+        fanout_t fanout(this);
+        Message event;
+        for(sub_node_t *node : nodes)
+            notify(node, paths.data(), paths.size(), false, event);
+
+#ifdef ENTANGLD_STATS
+        if(!nodes.empty()) {
+            uint64_t ns = elapsed_ns(start);
+            std::lock_guard<std::mutex> lock(m_counters->lock);
+            m_counters->fanout_latency.record(ns);
+        }
+#endif
+
+        // Send one Message per remote
+        for(auto &entry : msgs) {
+            std::vector<Message> &queue = entry.second;
+            if(queue.size() == 1) {
+                transmit(entry.first, queue.front());
+                continue;
+            }
+
+            transmit(entry.first, make_batch(queue));
+        }
+    }
+
+    void Datastore::subscribe(
+        const Path &path,
+        void (*callback)(const Message &msg, void *ctx),
+        void *callback_ctx,
+        const std::string &uuid,
+        const policy_t &policy)
+    {
+        assert(callback != nullptr);
+        subscribe(path, bind_callback(callback, callback_ctx), uuid, policy);
+    }
+
+    void Datastore::subscribe(
+        const Path &path,
+        callback_t callback,
+        const std::string &uuid,
+        const policy_t &policy)
+    {
+        assert(callback);
+        guard_t guard(this, true);
+        add_sub(path, std::move(callback), uuid, policy, nullptr);
+    }
+
+    void Datastore::add_sub(
+        const Path &path,
+        callback_t &&callback,
+        const std::string &uuid,
+        const policy_t &policy,
+        remote_t *origin)
+    {
+        request_t sub;
+        sub.msg.type = "subscribe";
+        if(uuid.empty())
+            generate_id(sub.msg.uuid);
+        else
+            sub.msg.uuid = uuid;
+
+        sub.callback = std::move(callback);
+        size_t depth;
+        sub.remote = resolve(path, depth);
+        sub.origin = origin;
+        sub.count = 0;
+        sub.synced = true;
+        sub.upstream = nullptr;
+        sub.dead = false;
+
+        if(sub.remote == nullptr) {
+            // Data is in local store
+            sub.policy = policy;
+            sub.ptr = path.pointer();
+            sub.msg.path = {
+                {"path", path.str()},
+                {"uuid", sub.msg.uuid}
+            };
+        }
+        else {
+            // Data is in remote store
+            sub.msg.path = {
+                {"path", path.relative(depth)},
+                {"uuid", sub.msg.uuid}
+            };
+
+            // The remote applies the policy, events are delivered as received
+            sub.msg.every = policy.every;
+            if(policy.interval.count() > 0) {
+                sub.msg.params = {
+                    {"interval", policy.interval.count()},
+                    {"trailing", policy.trailing}
+                };
+            }
+
+            // Patches are applied to a mirror as they arrive
+            if(policy.delta) {
+                sub.msg.params["delta"] = true;
+                sub.policy.delta = true;
+            }
+
+            // Share the remote subscription of an identical request
+            std::string key = path.str() + '\n' + std::to_string(policy.every)
+                + '\n' + std::to_string(policy.interval.count())
+                + '\n' + std::to_string(policy.trailing) + std::to_string(policy.delta);
+
+            auto it = m_upstreams.find(key);
+            if(it == m_upstreams.end()) {
+                it = m_upstreams.insert(std::make_pair(key, upstream_t())).first;
+                upstream_t &upstream = it->second;
+                upstream.key = key;
+                upstream.remote = sub.remote;
+                upstream.msg = sub.msg;
+                upstream.refs = 0;
+                upstream.ready = false;
+            }
+
+            it->second.refs += 1;
+            sub.upstream = &it->second;
+        }
+
+        sub_node_t *node = find_node(path.segments(), true);
+        m_subs_by_uuid.insert(std::make_pair(id_key(sub.msg.uuid), node));
+        node->subs.push_back(std::move(sub));
+
+        // Index first, the remote may answer before transmit returns
+        const request_t &added = node->subs.back();
+        upstream_t *upstream = added.upstream;
+        if(upstream != nullptr && upstream->refs == 1) {
+            transmit(upstream->remote, upstream->msg);
+        }
+        else if(upstream != nullptr) {
+            // Joining a delta stream starts from the mirror it keeps
+            if(added.policy.delta && upstream->ready) {
+                Message msg;
+                msg.type = "event";
+                msg.path = upstream->msg.path.at("path");
+                msg.uuid = added.msg.uuid;
+                msg.value = upstream->mirror;
+                msg.params = {{"patch", nlohmann::json::array({{
+                    {"op", "replace"},
+                    {"path", ""},
+                    {"value", upstream->mirror}
+                }})}};
+
+                dispatch(added.callback, std::move(msg));
+            }
+        }
+        else if(added.policy.delta) {
+            deliver_patch(added, snapshot(added));
+        }
+    }
+
+    int Datastore::unsubscribe(const Path &path, const std::string &uuid)
+    {
+        guard_t guard(this, true);
+
+        remote_t *remote = nullptr;
+        std::vector<sub_node_t*> nodes;
+
+        if(!uuid.empty() && path.empty()) {
+            // Visit every node holding a subscription with this UUID
+            auto range = m_subs_by_uuid.equal_range(id_key(uuid));
+            for(auto it = range.first; it != range.second; ++it)
+                nodes.push_back(it->second);
+
+            // A node is listed once for every subscription it holds
+            std::sort(nodes.begin(), nodes.end());
+            nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+        }
+        else {
+            // Visit the path and its ancestors
+            size_t depth;
+            remote = resolve(path, depth);
+            const std::vector<std::string> &segments = path.segments();
+            sub_node_t *node = &m_subs;
+            for(size_t i = 0; node != nullptr; ++i) {
+                nodes.push_back(node);
+                if(i == segments.size())
+                    break;
+
+                auto child = node->children.find(segments[i]);
+                node = (child != node->children.end()) ? child->second.get() : nullptr;
+            }
+        }
+
+        int count = 0;
+        for(sub_node_t *node : nodes) {
+            for(auto it = node->subs.begin(); it != node->subs.end();) {
+                const request_t &sub = *it;
+                bool match = !sub.dead && (uuid.empty() || uuid == sub.msg.uuid);
+                if(match && !path.empty())
+                    match = (sub.remote == remote);
+
+                if(!match) {
+                    ++it;
+                    continue;
+                }
+
+                count += 1;
+                it = remove_sub(node, it);
+            }
+        }
+
+        // Prune ancestors first so that a freed node is never revisited
+        auto depth = [](const sub_node_t *node) {
+            size_t count = 0;
+            for(; node->parent != nullptr; node = node->parent)
+                count += 1;
+            return count;
+        };
+
+        std::sort(nodes.begin(), nodes.end(), [&](sub_node_t *a, sub_node_t *b) {
+            return depth(a) < depth(b);
+        });
+
+        for(sub_node_t *node : nodes)
+            prune(node);
+
+        return count;
+    }
+
+    void Datastore::flush(const std::string &name)
+    {
+        guard_t guard(this, true);
+
+        if(!name.empty()) {
+            auto it = m_remotes.find(name);
+            if(it != m_remotes.end())
+                resume(&it->second);
+
+            return;
+        }
+
+        for(auto it = m_remotes.begin(); it != m_remotes.end(); ++it)
+            resume(&it->second);
+    }
+
+    Datastore::queue_stats_t Datastore::queue_stats(const std::string &name) const
+    {
+        guard_t guard(this, false);
+
+        queue_stats_t stats;
+        auto it = m_remotes.find(name);
+        if(it == m_remotes.end())
+            return stats;
+
+        const remote_t &remote = it->second;
+        stats.queued = remote.backlog.size();
+        stats.dropped = remote.dropped;
+        stats.coalesced = remote.coalesced;
+        stats.blocked = remote.blocked;
+        if(remote.outlet) {
+            stats.blocked = stats.blocked || remote.outlet->would_block.load();
+            std::lock_guard<std::mutex> lock(remote.outlet->lock);
+            stats.pending_bytes = remote.outlet->pending.size();
+        }
+
+        return stats;
+    }
+
+    void Datastore::set_blocked(const std::string &name, bool blocked)
+    {
+        guard_t guard(this, true);
+
+        auto it = m_remotes.find(name);
+        if(it == m_remotes.end())
+            return;
+
+        it->second.blocked = blocked;
+        if(!blocked)
+            resume(&it->second);
+    }
+
+    void Datastore::transmit(remote_t *remote, const Message &msg)
+    {
+        // Held Messages go first, so keep holding until they are sent
+        if(remote->blocked || remote->outlet->would_block.load() || !remote->backlog.empty()) {
+            hold(remote, msg);
+            return;
+        }
+
+        emit(remote, msg);
+    }
+
+    void Datastore::hold(remote_t *remote, const Message &msg)
+    {
+        const remote_opts_t &opts = remote->opts;
+        if(remote->overflowed) {
+            remote->dropped += 1;
+            return;
+        }
+
+        if(opts.overflow == overflow_t::COALESCE && msg.type == "event") {
+            for(Message &queued : remote->backlog) {
+                if(queued.type != "event" || queued.uuid != msg.uuid)
+                    continue;
+
+                // Patches are relative to the one before, so apply both in order
+                bool patches = queued.params.is_object() && queued.params.count("patch")
+                    && msg.params.is_object() && msg.params.count("patch");
+
+                if(patches) {
+                    nlohmann::json &patch = queued.params["patch"];
+                    for(const nlohmann::json &op : msg.params.at("patch"))
+                        patch.push_back(op);
+
+                    queued.value = msg.value;
+                    queued.revision = msg.revision;
+                }
+                else {
+                    queued = msg;
+                }
+
+                remote->coalesced += 1;
+                return;
+            }
+        }
+
+        if(opts.max_queue > 0 && remote->backlog.size() >= opts.max_queue) {
+            // Detaching here would invalidate the callers, poll() does it instead
+            if(opts.overflow == overflow_t::DISCONNECT) {
+                remote->dropped += remote->backlog.size() + 1;
+                remote->backlog.clear();
+                remote->overflowed = true;
+                return;
+            }
+
+            remote->backlog.pop_front();
+            remote->dropped += 1;
+        }
+
+        remote->backlog.push_back(msg);
+    }
+
+    void Datastore::resume(remote_t *remote)
+    {
+        if(remote->blocked || remote->overflowed)
+            return;
+
+        // Retrying may unblock the writer
+        if(remote->outlet->would_block.load()) {
+            std::vector<uint8_t> retry;
+            remote->owner->dispatch(remote->outlet, retry, remote);
+        }
+
+        while(!remote->backlog.empty() && !remote->outlet->would_block.load()) {
+            Message msg = std::move(remote->backlog.front());
+            remote->backlog.pop_front();
+            emit(remote, msg);
+        }
+
+        flush(remote);
+    }
+
+    void Datastore::emit(remote_t *remote, const Message &msg)
+    {
+        ENTANGLD_TRACE_SCOPE(transmit, remote->name.c_str(), msg.type.c_str());
+
+#ifdef ENTANGLD_STATS
+        counters_t &counters = *remote->owner->m_counters;
+        counters.transmitted.fetch_add(1, std::memory_order_relaxed);
+        size_t framed = remote->buffer.size();
+#endif
+
+        const remote_opts_t &opts = remote->opts;
+        if(remote->writer) {
+            frame(msg, opts.format, remote->buffer);
+            remote->frames += 1;
+
+#ifdef ENTANGLD_STATS
+            {
+                std::lock_guard<std::mutex> lock(counters.lock);
+                remote_stats_t &traffic = counters.remote(remote->name);
+                traffic.msgs_out += 1;
+                traffic.bytes_out += remote->buffer.size() - framed;
+            }
+#endif
+
+            bool queued = (opts.max_batch > 1 || opts.max_bytes > 0);
+            if(!queued
+            || (opts.max_batch > 1 && remote->frames >= opts.max_batch)
+            || (opts.max_bytes > 0 && remote->buffer.size() >= opts.max_bytes))
+                flush(remote);
+
+            return;
+        }
+
+#ifdef ENTANGLD_STATS
+        {
+            std::lock_guard<std::mutex> lock(counters.lock);
+            counters.remote(remote->name).msgs_out += 1;
+        }
+#endif
+
+        if(opts.max_batch < 2) {
+            remote->owner->dispatch(handler_of(remote), msg, remote);
+            return;
+        }
+
+        remote->queue.push_back(msg);
+        if(remote->queue.size() >= remote->opts.max_batch)
+            flush(remote);
+    }
+
+    void Datastore::flush(remote_t *remote)
+    {
+        if(remote->blocked)
+            return;
+
+        if(remote->writer) {
+            if(remote->buffer.empty())
+                return;
+
+            // The writer may cause more frames to be queued, keep them separate
+            std::vector<uint8_t> buffer;
+            std::swap(buffer, remote->buffer);
+            remote->frames = 0;
+
+            remote->owner->dispatch(remote->outlet, buffer, remote);
+
+            // Keep the allocation for the next flush
+            if(remote->buffer.empty()) {
+                buffer.clear();
+                std::swap(buffer, remote->buffer);
+            }
+            return;
+        }
+
+        if(remote->queue.empty())
+            return;
+
+        // The handler may queue more Messages, so take ownership of these
+        std::vector<Message> queue;
+        std::swap(queue, remote->queue);
+
+        if(queue.size() == 1)
+            remote->owner->dispatch(handler_of(remote), std::move(queue.front()), remote);
+        else
+            remote->owner->dispatch(handler_of(remote), make_batch(queue), remote);
+    }
+
+    void Datastore::poll(clock::time_point now)
+    {
+        guard_t guard(this, true);
+
+        // Every request has the same timeout, so deadlines are in order
+        while(!m_deadlines.empty() && m_deadlines.front().deadline <= now) {
+            deadline_t entry = m_deadlines.front();
+            m_deadlines.pop_front();
+
+            const slot_t &slot = m_slots[entry.index];
+            if(slot.active && slot.serial == entry.serial)
+                expire_slot(entry.index);
+        }
+
+        // Callbacks may subscribe or unsubscribe, so work from a copy
+        std::vector<request_t*> expired;
+        for(request_t *sub : m_pending) {
+            if(now - sub->last >= sub->policy.interval)
+                expired.push_back(sub);
+        }
+
+        fanout_t fanout(this);
+        for(request_t *sub : expired) {
+            if(m_pending.erase(sub) == 0)
+                continue;
+
+            sub->last = now;
+            deliver(*sub);
+        }
+
+        // Computed values are only kept current while someone is listening
+        for(size_t i = 0; i < m_providers.size(); ++i) {
+            provided_t &entry = m_providers[i];
+            if((!entry.ready || now - entry.computed >= entry.ttl) && watched(entry.path))
+                provide(entry, now);
+        }
+
+        flush();
+
+        // Remotes that overflowed with DISCONNECT are dropped outside of transmit
+        std::vector<std::pair<std::string, remote_t*>> overflowed;
+        for(auto &entry : m_remotes) {
+            if(entry.second.overflowed)
+                overflowed.emplace_back(entry.first, &entry.second);
+        }
+
+        for(const auto &entry : overflowed) {
+            // Detaching frees the remote, so keep what the transport needs
+            void (*on_disconnect)(const std::string&, void*) = entry.second->opts.on_disconnect;
+            void *ctx = entry.second->handler_ctx;
+
+            detach(entry.first);
+            if(on_disconnect)
+                on_disconnect(entry.first, ctx);
+        }
+    }
+
+    void Datastore::attach(
+        const std::string &name,
+        void (*handler)(const Message &msg, void *ctx),
+        void *ctx,
+        const remote_opts_t &opts)
+    {
+        assert(handler != nullptr);
+        guard_t guard(this, true);
+
+        remote_t remote;
+        remote.name = name;
+        remote.handler = handler;
+        remote.handler_ctx = ctx;
+        remote.writer = nullptr;
+        remote.outlet = std::make_shared<outlet_t>(nullptr, ctx);
+        remote.owner = this;
+        remote.opts = opts;
+        remote.frames = 0;
+        remote.mirror_ready = false;
+        remote.blocked = false;
+        remote.overflowed = false;
+        remote.dropped = 0;
+        remote.coalesced = 0;
+
+        auto it = m_remotes.find(name);
+        if(it != m_remotes.end())
+            stop_mirror(&it->second);
+
+        remote_t &attached = m_remotes[name];
+        attached = std::move(remote);
+        route(name, &attached);
+        m_generation = next_generation();
+
+        if(opts.mirror)
+            start_mirror(&attached);
+    }
+
+    void Datastore::attach(
+        const std::string &name, writer_t writer, void *ctx, const remote_opts_t &opts)
+    {
+        assert(writer != nullptr);
+        guard_t guard(this, true);
+
+        remote_t remote;
+        remote.name = name;
+        remote.handler = nullptr;
+        remote.handler_ctx = ctx;
+        remote.writer = writer;
+        remote.outlet = std::make_shared<outlet_t>(writer, ctx);
+        remote.owner = this;
+        remote.opts = opts;
+        remote.frames = 0;
+        remote.mirror_ready = false;
+        remote.blocked = false;
+        remote.overflowed = false;
+        remote.dropped = 0;
+        remote.coalesced = 0;
+
+        auto it = m_remotes.find(name);
+        if(it != m_remotes.end())
+            stop_mirror(&it->second);
+
+        remote_t &attached = m_remotes[name];
+        attached = std::move(remote);
+        route(name, &attached);
+        m_generation = next_generation();
+
+        if(opts.mirror)
+            start_mirror(&attached);
+    }
+
+    void Datastore::detach(const std::string &name)
+    {
+        guard_t guard(this, true);
+
+        auto it = m_remotes.find(name);
+        if(it == m_remotes.end())
+            return;
+
+        remote_t *remote = &it->second;
+
+        // Nothing will answer requests waiting on this remote
+        for(uint32_t index = 0; index < m_slots.size(); ++index) {
+            if(m_slots[index].active && m_slots[index].request.remote == remote)
+                expire_slot(index);
+        }
+
+        stop_mirror(remote);
+        remove_subs(remote);
+
+        for(auto entry = m_batch_msgs.begin(); entry != m_batch_msgs.end(); ++entry) {
+            if(entry->first == remote) {
+                m_batch_msgs.erase(entry);
+                break;
+            }
+        }
+
+        route(name, nullptr);
+        m_remotes.erase(name);
+        m_generation = next_generation();
+    }
+
+    void Datastore::receive(Message &&msg, const std::string &name)
+    {
+        guard_t guard(this, true);
+
+        // Other types are counted and traced by receive(const Message&)
+        if(msg.type == "set") {
+            ENTANGLD_TRACE_SCOPE(receive, name.c_str(), msg.type.c_str());
+            count_received(name);
+            set(msg.path.get<std::string>(), std::move(msg.value));
+        }
+        else if(msg.type == "push") {
+            ENTANGLD_TRACE_SCOPE(receive, name.c_str(), msg.type.c_str());
+            count_received(name);
+            push(msg.path.get<std::string>(), std::move(msg.value), limit_of(msg));
+        }
+        else {
+            receive(static_cast<const Message&>(msg), name);
+        }
+    }
+
+    size_t Datastore::receive(const uint8_t *data, size_t size, const std::string &name)
+    {
+        Format format = Format::JSON;
+        {
+            guard_t guard(this, false);
+            auto it = m_remotes.find(name);
+            if(it != m_remotes.end())
+                format = it->second.opts.format;
+        }
+
+        size_t offset = 0;
+        while(offset < size) {
+            size_t payload, length;
+            size_t count = next_frame(data + offset, size - offset, format, payload, length);
+            if(count == 0)
+                break;
+
+            // Skip blank lines between JSON frames
+            if(length > 0)
+                receive(decode(data + offset + payload, length, format), name);
+
+            offset += count;
+        }
+
+#ifdef ENTANGLD_STATS
+        std::lock_guard<std::mutex> lock(m_counters->lock);
+        m_counters->remote(name).bytes_in += offset;
+#endif
+
+        return offset;
+    }
+
+    void Datastore::receive(const Message &msg, const std::string &name)
+    {
+        ENTANGLD_TRACE_SCOPE(receive, name.c_str(), msg.type.c_str());
+        guard_t guard(this, true);
+
+        count_received(name);
+
+        // Anything from a mirrored remote shows its mirror is still current
+        remote_t *mirrored = nullptr;
+        if(m_mirrors > 0) {
+            auto it = m_remotes.find(name);
+            if(it != m_remotes.end() && !it->second.mirror_uuid.empty()) {
+                mirrored = &it->second;
+                mirrored->heard = clock::now();
+            }
+        }
+
+        // Requests from a detached remote have nowhere to send their replies
+        auto attached = m_remotes.find(name);
+        bool replies = (attached != m_remotes.end());
+
+        if(msg.type == "set") {
+            set(msg.path.get<std::string>(), msg.value);
+        }
+        else if(msg.type == "push") {
+            push(msg.path.get<std::string>(), msg.value, limit_of(msg));
+        }
+        else if(msg.type == "get") {
+            if(replies)
+                get(msg.path.get<std::string>(), [this, name](const Message &reply) {
+                    respond(name, reply);
+                }, msg.uuid, opts_of(msg.params));
+        }
+        else if(msg.type == "call") {
+            if(replies)
+                call(msg.path.get<std::string>(), msg.params, [this, name](const Message &reply) {
+                    respond(name, reply);
+                }, msg.uuid);
+        }
+        else if(msg.type == "value") {
+            long index = find_slot(msg.uuid);
+            if(index >= 0) {
+                finish_slot(index, msg);
+            }
+            else {
+                fprintf(stderr, "Could not find mapped request: %s\n", msg.uuid.c_str());
+            }
+        }
+        else if(msg.type == "event" && mirrored && msg.uuid == mirrored->mirror_uuid) {
+            // Peers without delta support send the whole store
+            if(msg.params.is_object() && msg.params.count("patch"))
+                apply_patch(mirrored->mirror, msg.params["patch"]);
+            else
+                mirrored->mirror = msg.value;
+
+            mirrored->mirror_ready = true;
+        }
+        else if(msg.type == "event") {
+            // Walk the remote subscriptions on the event path and its ancestors
+            Path path(name + '.' + msg.path.get<std::string>());
+            const std::vector<std::string> &segments = path.segments();
+
+            // Subscriptions sharing the stream each see their own uuid
+            fanout_t fanout(this);
+            Message event;
+            Message rebuilt;
+            std::shared_ptr<Message> shared_event;
+            std::shared_ptr<Message> shared_rebuilt;
+            sub_node_t *node = &m_subs;
+            for(size_t i = 0; node != nullptr; ++i) {
+                for(request_t &sub : node->subs) {
+                    upstream_t *upstream = sub.upstream;
+                    if(sub.dead || !upstream || upstream->remote->name != name || upstream->msg.uuid != msg.uuid)
+                        continue;
+
+                    if(!sub.policy.delta || !msg.params.is_object() || !msg.params.count("patch")) {
+                        if(event.type.empty())
+                            event = msg;
+
+                        dispatch(sub.callback, event, shared_event, sub.msg.uuid);
+                        continue;
+                    }
+
+                    // Rebuild the value once for every subscription sharing the stream
+                    if(rebuilt.type.empty()) {
+                        apply_patch(upstream->mirror, msg.params["patch"]);
+                        upstream->ready = true;
+
+                        rebuilt = msg;
+                        rebuilt.value = upstream->mirror;
+                    }
+
+                    dispatch(sub.callback, rebuilt, shared_rebuilt, sub.msg.uuid);
+                }
+
+                if(i == segments.size())
+                    break;
+
+                auto child = node->children.find(segments[i]);
+                node = (child != node->children.end()) ? child->second.get() : nullptr;
+            }
+        }
+        else if(msg.type == "subscribe" && replies) {
+            // C++ peers send an object holding the path and uuid
+            bool nested = msg.path.is_object();
+            std::string path = (nested) ? msg.path.value("path", "") : msg.path.get<std::string>();
+            std::string uuid = (nested) ? msg.path.value("uuid", msg.uuid) : msg.uuid;
+
+            policy_t policy(msg.every);
+            if(msg.params.is_object()) {
+                policy.interval = std::chrono::milliseconds(msg.params.value("interval", 0));
+                policy.trailing = msg.params.value("trailing", true);
+                policy.delta = msg.params.value("delta", false);
+            }
+
+            // Events relayed from another remote carry the path and uuid it saw
+            add_sub(
+                path,
+                [this, name, path, uuid](const Message &msg) {
+                    // May run after the lock was released and the remote detached
+                    guard_t guard(this, true);
+                    auto it = m_remotes.find(name);
+                    if(it == m_remotes.end())
+                        return;
+
+                    remote_t *remote = &it->second;
+                    bool patch = msg.params.is_object() && msg.params.count("patch");
+                    bool same_uuid = uuid.empty() || msg.uuid == uuid;
+                    if(msg.path == path && same_uuid && !patch) {
+                        transmit(remote, msg);
+                        return;
+                    }
+
+                    // Relayed patches are sent without the mirror they were applied to
+                    Message relayed = msg;
+                    relayed.path = path;
+                    if(!same_uuid)
+                        relayed.uuid = uuid;
+
+                    if(patch)
+                        relayed.value = nullptr;
+
+                    transmit(remote, relayed);
+                },
+                uuid,
+                policy,
+                &attached->second
+            );
+        }
+        else if(msg.type == "batch") {
+            // Decode everything first, so a malformed batch changes nothing
+            std::vector<Message> msgs;
+            msgs.reserve(msg.value.size());
+            for(const nlohmann::json &j : msg.value)
+                msgs.push_back(j.get<Message>());
+
+            // Apply the batch as one, so local subscribers see a single change
+            batch_scope_t batch(this);
+            for(const Message &inner : msgs)
+                receive(inner, name);
+            batch.commit();
+        }
+        else if(msg.type == "unsubscribe") {
+            if(msg.path.is_string()) {
+                // Path is a string
+                unsubscribe(msg.path.get<std::string>(), msg.uuid);
+            }
+            else {
+                // Path is an object containing path and uuid
+                unsubscribe(msg.path.value("path", ""), msg.path.value("uuid", ""));
+            }
+        }
+    }
+
+    void Datastore::respond(const std::string &name, const Message &msg)
+    {
+        Message resp;
+        resp.type = "value";
+        resp.path = msg.path;
+        resp.uuid = msg.uuid;
+        resp.value = msg.value;
+        resp.params = msg.params;
+        resp.revision = msg.revision;
+
+        // May run after the lock was released and the remote detached
+        guard_t guard(this, true);
+        auto it = m_remotes.find(name);
+        if(it != m_remotes.end())
+            transmit(&it->second, resp);
+    }
+
+    unsigned long Datastore::next_generation()
+    {
+        static std::atomic<unsigned long> generation(1);
+        return generation++;
+    }
+
+    Datastore::remote_t *Datastore::resolve(const Path &path, size_t &depth)
+    {
+#ifndef ENTANGLD_CONCURRENT
+        if(path.m_owner == this && path.m_generation == m_generation) {
+            depth = path.m_ns_depth;
+            return static_cast<remote_t*>(path.m_remote);
+        }
+#endif
+
+        remote_t *remote = nullptr;
+        depth = 0;
+
+        // The last segment names data, a namespace on its own is local
+        const std::vector<std::string> &segments = path.segments();
+        const ns_node_t *node = &m_routes;
+        for(size_t i = 0; i + 1 < segments.size(); ++i) {
+            auto child = node->children.find(segments[i]);
+            if(child == node->children.end())
+                break;
+
+            node = child->second.get();
+            if(node->remote != nullptr) {
+                remote = node->remote;
+                depth = i + 1;
+            }
+        }
+
+#ifndef ENTANGLD_CONCURRENT
+        // Paths may be shared between threads, so only cache when single threaded
+        path.m_owner = this;
+        path.m_generation = m_generation;
+        path.m_remote = remote;
+        path.m_ns_depth = depth;
+#endif
+
+        return remote;
+    }
+
+    void Datastore::route(const std::string &name, remote_t *remote)
+    {
+        Path path(name);
+        const std::vector<std::string> &segments = path.segments();
+
+        std::vector<ns_node_t*> nodes(1, &m_routes);
+        for(const std::string &segment : segments) {
+            ns_node_t *node = nodes.back();
+            auto child = node->children.find(segment);
+            if(child == node->children.end()) {
+                if(remote == nullptr)
+                    return;
+
+                child = node->children.insert(std::make_pair(
+                    segment, std::unique_ptr<ns_node_t>(new ns_node_t))).first;
+            }
+
+            nodes.push_back(child->second.get());
+        }
+
+        nodes.back()->remote = remote;
+
+        // Prune nodes that no longer lead to a remote
+        for(size_t i = segments.size(); remote == nullptr && i > 0; --i) {
+            ns_node_t *node = nodes[i];
+            if(node->remote != nullptr || !node->children.empty())
+                break;
+
+            nodes[i - 1]->children.erase(segments[i - 1]);
+        }
+    }
+
+    void Datastore::dispatch(const callback_t &callback, const Message &msg, const void *key)
+    {
+#ifdef ENTANGLD_CONCURRENT
+        event_t event;
+        event.callback = callback;
+        event.msg = msg;
+        event.key = (key) ? key : this;
+        m_events.push(std::move(event));
+#else
+#ifdef ENTANGLD_STATS
+        if(!key) {
+            if(m_executor)
+                m_executor->post(std::bind(invoke, m_counters, callback, msg), this);
+            else
+                invoke(m_counters, callback, msg);
+            return;
+        }
+#endif
+        if(m_executor)
+            m_executor->post(std::bind(callback, msg), (key) ? key : this);
+        else
+            callback(msg);
+#endif
+    }
+
+    void Datastore::dispatch(const callback_t &callback, Message &&msg, const void *key)
+    {
+#ifdef ENTANGLD_CONCURRENT
+        event_t event;
+        event.callback = callback;
+        event.msg = std::move(msg);
+        event.key = (key) ? key : this;
+        m_events.push(std::move(event));
+#else
+#ifdef ENTANGLD_STATS
+        if(!key) {
+            if(m_executor)
+                m_executor->post(std::bind(invoke, m_counters, callback, std::move(msg)), this);
+            else
+                invoke(m_counters, callback, msg);
+            return;
+        }
+#endif
+        if(m_executor)
+            m_executor->post(std::bind(callback, std::move(msg)), (key) ? key : this);
+        else
+            callback(msg);
+#endif
+    }
+
+    void Datastore::dispatch(
+        const callback_t &callback,
+        Message &msg,
+        std::shared_ptr<Message> &shared,
+        const std::string &uuid)
+    {
+#ifdef ENTANGLD_CONCURRENT
+        if(!shared)
+            shared = std::make_shared<Message>(msg);
+
+        event_t event;
+        event.callback = callback;
+        event.msg.uuid = uuid;
+        event.shared = shared;
+        event.key = this;
+        m_events.push(std::move(event));
+#else
+        if(!m_executor) {
+            msg.uuid = uuid;
+#ifdef ENTANGLD_STATS
+            invoke(m_counters, callback, msg);
+#else
+            callback(msg);
+#endif
+            return;
+        }
+
+        if(!shared)
+            shared = std::make_shared<Message>(msg);
+
+#ifdef ENTANGLD_STATS
+        std::shared_ptr<counters_t> counters = m_counters;
+        m_executor->post([counters, callback, shared, uuid]() {
+            shared->uuid = uuid;
+            invoke(counters, callback, *shared);
+        }, this);
+#else
+        m_executor->post(std::bind(call_shared, callback, shared, uuid), this);
+#endif
+#endif
+    }
+
+    void Datastore::call_shared(
+        const callback_t &callback, const std::shared_ptr<Message> &msg, const std::string &uuid)
+    {
+        msg->uuid = uuid;
+        callback(*msg);
+    }
+
+    void Datastore::dispatch(
+        const std::shared_ptr<outlet_t> &outlet, std::vector<uint8_t> &data, const void *key)
+    {
+#ifdef ENTANGLD_CONCURRENT
+        event_t event;
+        event.outlet = outlet;
+        event.data = std::move(data);
+        event.key = key;
+        m_events.push(std::move(event));
+#else
+        if(m_executor)
+            m_executor->post(std::bind(write, outlet, std::move(data)), key);
+        else
+            write(outlet, data);
+#endif
+    }
+
+    void Datastore::write(const std::shared_ptr<outlet_t> &outlet, const std::vector<uint8_t> &data)
+    {
+        std::lock_guard<std::mutex> lock(outlet->lock);
+
+        // Bytes left by a blocked write go first
+        const std::vector<uint8_t> *bytes = &data;
+        if(!outlet->pending.empty()) {
+            outlet->pending.insert(outlet->pending.end(), data.begin(), data.end());
+            bytes = &outlet->pending;
+        }
+
+        if(bytes->empty()) {
+            outlet->would_block.store(false);
+            return;
+        }
+
+        // Errors are left to the transport, as before
+        int result = outlet->writer(bytes->data(), bytes->size(), outlet->ctx);
+        if(result <= 0 || size_t(result) > bytes->size()) {
+            outlet->pending.clear();
+            outlet->would_block.store(false);
+            return;
+        }
+
+        if(bytes == &outlet->pending)
+            outlet->pending.erase(outlet->pending.begin(), outlet->pending.end() - result);
+        else
+            outlet->pending.assign(data.end() - result, data.end());
+
+        outlet->would_block.store(true);
+    }
+
+    Datastore::callback_t Datastore::handler_of(const remote_t *remote)
+    {
+        // Copy the handler so queued calls survive detach
+        return bind_callback(remote->handler, remote->handler_ctx);
+    }
+
+    bool Datastore::set_executor(Executor *executor)
+    {
+#ifndef ENTANGLD_CONCURRENT
+        // Tasks reach into the store, which takes no lock in this build
+        if(executor && !executor->single_threaded())
+            return false;
+#endif
+
+        guard_t guard(this, true);
+        m_executor = executor;
+        return true;
+    }
+
+    void Datastore::set_change_detection(bool enabled)
+    {
+        guard_t guard(this, true);
+        m_only_changes = enabled;
+    }
+
+    void Datastore::set_write_hook(write_hook_t hook, void *ctx)
+    {
+        guard_t guard(this, true);
+        m_write_hook = hook;
+        m_write_hook_ctx = ctx;
+    }
+
+    void Datastore::visit(const std::function<void(const nlohmann::json &data)> &visitor) const
     {
-        m_remotes.clear();
-        m_requests.clear();
-        m_subs.clear();
+        guard_t guard(this, false);
+        visitor(m_local_data);
     }
 
-    void Datastore::get(
-        std::string path,
-        void (*callback)(const Message &msg, void *ctx),
-        void *callback_ctx,
-        std::string uuid)
+#ifdef ENTANGLD_CONCURRENT
+    void Datastore::drain()
     {
-        assert(callback != nullptr);
+        for(;;) {
+            bool expected = false;
+            if(!m_draining.compare_exchange_strong(expected, true, std::memory_order_acquire))
+                return;
 
-        std::string ns = parse_namespace(path);
-        if(ns.empty()) {
-            // Data is in local store
-            std::string local_path = path;
-            if(!local_path.empty()) {
-                replace(local_path.begin(), local_path.end(), '.', '/');
-                local_path = '/' + local_path;
-            }
+            try {
+                event_t event;
+                while(m_events.pop(event)) {
+                    if(event.shared) {
+#ifdef ENTANGLD_STATS
+                        std::shared_ptr<counters_t> counters = m_counters;
+                        callback_t callback = std::move(event.callback);
+                        std::shared_ptr<Message> shared = std::move(event.shared);
+                        std::string uuid = std::move(event.msg.uuid);
+                        auto task = [counters, callback, shared, uuid]() {
+                            shared->uuid = uuid;
+                            invoke(counters, callback, *shared);
+                        };
+#else
+                        auto task = std::bind(
+                            call_shared, std::move(event.callback), std::move(event.shared), std::move(event.msg.uuid));
+#endif
+                        if(m_executor)
+                            m_executor->post(std::move(task), this);
+                        else
+                            task();
+                        continue;
+                    }
 
-            auto ptr = nlohmann::json::json_pointer(local_path);
+#ifdef ENTANGLD_STATS
+                    // Local callbacks are keyed by the store itself
+                    if(!event.outlet && event.key == this) {
+                        if(m_executor)
+                            m_executor->post(std::bind(invoke, m_counters, std::move(event.callback), std::move(event.msg)), this);
+                        else
+                            invoke(m_counters, event.callback, event.msg);
+                        continue;
+                    }
+#endif
+                    if(m_executor && event.outlet)
+                        m_executor->post(std::bind(write, std::move(event.outlet), std::move(event.data)), event.key);
+                    else if(m_executor)
+                        m_executor->post(std::bind(event.callback, std::move(event.msg)), event.key);
+                    else if(event.outlet)
+                        write(event.outlet, event.data);
+                    else
+                        event.callback(event.msg);
+                }
+            }
+            catch(...) {
+                m_draining.store(false, std::memory_order_release);
+                throw;
+            }
 
-            Message msg;
-            msg.type = "value";
-            msg.path = path;
-            msg.uuid = (uuid.empty()) ? get_uuidstring() : uuid;
-            msg.value = m_local_data.value(ptr, nlohmann::json(nullptr));
+            m_draining.store(false, std::memory_order_release);
 
-            callback(msg, callback_ctx);
+            // Events pushed after the last pop would otherwise be stranded
+            if(m_events.empty())
+                return;
         }
-        else {
-            // Data is in remote store
-            request_t request;
-            request.msg.type = "get";
-            request.msg.path = path.substr(ns.size()+1, path.size()-ns.size()-1);
-            request.msg.uuid = (uuid.empty()) ? get_uuidstring() : uuid;
-            request.remote = &m_remotes[ns];
-            request.callback = callback;
-            request.callback_ctx = callback_ctx;
+    }
+#endif
+
+    Datastore::sub_node_t *Datastore::find_node(
+        const std::vector<std::string> &segments, bool create)
+    {
+        sub_node_t *node = &m_subs;
+        for(const std::string &key : segments) {
+            auto it = node->children.find(key);
+            if(it == node->children.end()) {
+                if(!create)
+                    return nullptr;
 
-            m_requests.insert(std::make_pair(request.msg.uuid, request));
-            transmit(request.remote, request.msg);
+                std::unique_ptr<sub_node_t> child(new sub_node_t);
+                child->parent = node;
+                child->key = key;
+                it = node->children.insert(std::make_pair(key, std::move(child))).first;
+            }
+            node = it->second.get();
         }
+        return node;
     }
 
-    void Datastore::set(std::string path, nlohmann::json value, bool push)
+    std::list<Datastore::request_t>::iterator Datastore::remove_sub(
+        sub_node_t *node,
+        std::list<request_t>::iterator it,
+        const remote_t *detaching)
     {
-        std::string ns = parse_namespace(path);
-        if(ns.empty()) {
-            // Data is in local store
-            std::string local_path = path;
-            if(!local_path.empty()) {
-                replace(local_path.begin(), local_path.end(), '.', '/');
-                local_path = '/' + local_path;
+        upstream_t *upstream = it->upstream;
+        if(upstream != nullptr && --upstream->refs == 0) {
+            // Last one out unsubscribes on the remote
+            if(upstream->remote != detaching) {
+                Message msg;
+                msg.type = "unsubscribe";
+                msg.uuid = upstream->msg.uuid;
+                msg.path = upstream->msg.path;
+
+                transmit(upstream->remote, msg);
             }
 
-            auto ptr = nlohmann::json::json_pointer(local_path);
+            m_upstreams.erase(upstream->key);
+        }
 
-            if(push) {
-                m_local_data[ptr].push_back(value);
-            }
-            else {
-                m_local_data[ptr] = value;
+        auto range = m_subs_by_uuid.equal_range(id_key(it->msg.uuid));
+        for(auto entry = range.first; entry != range.second; ++entry) {
+            if(entry->second == node) {
+                m_subs_by_uuid.erase(entry);
+                break;
             }
+        }
 
-            for(auto it = m_subs.begin(); it != m_subs.end(); ++it) {
-                request_t &sub = *it;
-                if(sub.remote)
-                    continue;
+        m_pending.erase(&*it);
 
-                std::string sub_path = sub.msg.path.at("path").get<std::string>();
-                if(path.rfind(sub_path, 0) != std::string::npos) {
-                    Message msg;
-                    msg.type = "event";
-                    msg.path = sub.msg.path.at("path");
-                    msg.value = m_local_data[sub.ptr];
-                    msg.uuid = sub.msg.path.at("uuid");
+        // The list may be walked by a fan-out further up the stack
+        if(m_fanout_depth > 0) {
+            it->dead = true;
+            m_swept.push_back(node);
+            return std::next(it);
+        }
+
+        return node->subs.erase(it);
+    }
+
+    void Datastore::start_mirror(remote_t *remote)
+    {
+        generate_id(remote->mirror_uuid);
+        remote->mirror = nullptr;
+        remote->mirror_ready = false;
+        m_mirrors += 1;
+
+        // The snapshot and patches arrive as events on this uuid
+        Message msg;
+        msg.type = "subscribe";
+        msg.uuid = remote->mirror_uuid;
+        msg.path = {
+            {"path", ""},
+            {"uuid", remote->mirror_uuid}
+        };
+        msg.params = {{"delta", true}};
+
+        transmit(remote, msg);
+    }
+
+    void Datastore::stop_mirror(remote_t *remote)
+    {
+        if(remote->mirror_uuid.empty())
+            return;
+
+        Message msg;
+        msg.type = "unsubscribe";
+        msg.uuid = remote->mirror_uuid;
+        msg.path = {
+            {"path", ""},
+            {"uuid", remote->mirror_uuid}
+        };
+
+        transmit(remote, msg);
+
+        remote->mirror_uuid.clear();
+        remote->mirror = nullptr;
+        remote->mirror_ready = false;
+        m_mirrors -= 1;
+    }
+
+    void Datastore::remove_subs(const remote_t *remote)
+    {
+        // Parents are listed before their children
+        std::vector<sub_node_t*> nodes;
+        nodes.push_back(&m_subs);
+        for(size_t i = 0; i < nodes.size(); ++i) {
+            for(auto &child : nodes[i]->children)
+                nodes.push_back(child.second.get());
+        }
 
-                    sub.callback(msg, sub.callback_ctx);
+        std::vector<sub_node_t*> emptied;
+        for(sub_node_t *node : nodes) {
+            bool removed = false;
+            for(auto it = node->subs.begin(); it != node->subs.end();) {
+                if(!it->dead && (it->remote == remote || it->origin == remote)) {
+                    it = remove_sub(node, it, remote);
+                    removed = true;
+                }
+                else {
+                    ++it;
                 }
             }
-        }
-        else {
-            // Data is in remote store
-            Message msg;
-            msg.type = (push) ? "push" : "set";
-            msg.path = path.substr(ns.size()+1, path.size()-ns.size()-1);
-            msg.value = value;
 
-            remote_t *remote = &m_remotes[ns];
-            transmit(remote, msg);
+            if(removed)
+                emptied.push_back(node);
         }
+
+        // Prune ancestors first so that a freed node is never revisited
+        for(sub_node_t *node : emptied)
+            prune(node);
     }
 
-    void Datastore::subscribe(
-        std::string path,
-        void (*callback)(const Message &msg, void *ctx),
-        void *callback_ctx,
-        std::string uuid)
+    void Datastore::prune(sub_node_t *node)
     {
-        assert(callback != nullptr);
+        if(m_fanout_depth > 0) {
+            m_swept.push_back(node);
+            return;
+        }
 
-        if(uuid.empty())
-            uuid = get_uuidstring();
+        while(node->parent != nullptr && node->subs.empty() && node->children.empty()) {
+            sub_node_t *parent = node->parent;
+            parent->children.erase(node->key);
+            node = parent;
+        }
+    }
 
-        request_t sub;
-        sub.msg.type = "subscribe";
-        sub.callback = callback;
-        sub.callback_ctx = callback_ctx;
+    void Datastore::sweep()
+    {
+        std::vector<sub_node_t*> nodes;
+        std::swap(nodes, m_swept);
 
-        std::string ns = parse_namespace(path);
-        if(ns.empty()) {
-            // Data is in local store
-            std::string local_path = path;
-            if(!local_path.empty()) {
-                replace(local_path.begin(), local_path.end(), '.', '/');
-                local_path = '/' + local_path;
-            }
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
 
-            sub.remote = nullptr;
-            sub.ptr = nlohmann::json::json_pointer(local_path);
-            sub.msg.path = {
-                {"path", path},
-                {"uuid", uuid}
-            };
+        for(sub_node_t *node : nodes) {
+            node->subs.remove_if([](const request_t &sub) { return sub.dead; });
         }
-        else {
-            // Data is in remote store
-            sub.remote = &m_remotes[ns];
-            sub.msg.path = {
-                {"path", path.substr(ns.size()+1, path.size()-ns.size()-1)},
-                {"uuid", uuid}
-            };
-            transmit(sub.remote, sub.msg);
+
+        // Prune ancestors first so that a freed node is never revisited
+        auto depth = [](const sub_node_t *node) {
+            size_t count = 0;
+            for(; node->parent != nullptr; node = node->parent)
+                count += 1;
+            return count;
+        };
+
+        std::sort(nodes.begin(), nodes.end(), [&](sub_node_t *a, sub_node_t *b) {
+            return depth(a) < depth(b);
+        });
+
+        for(sub_node_t *node : nodes)
+            prune(node);
+    }
+
+    void Datastore::collect(
+        const Path &path,
+        std::vector<sub_node_t*> &nodes,
+        std::unordered_set<sub_node_t*> *seen,
+        unsigned long stamp)
+    {
+        auto add = [&](sub_node_t *node) {
+            if(seen == nullptr || seen->insert(node).second)
+                nodes.push_back(node);
+        };
+
+        // Subscriptions on the path and its ancestors
+        const std::vector<std::string> &segments = path.segments();
+        sub_node_t *node = &m_subs;
+        for(size_t i = 0; node != nullptr; ++i) {
+            add(node);
+            if(i == segments.size())
+                break;
+
+            auto child = node->children.find(segments[i]);
+            node = (child != node->children.end()) ? child->second.get() : nullptr;
         }
 
-        m_subs.push_back(sub);
+        // Subscriptions beneath the path, their values were replaced
+        if(node != nullptr) {
+            std::vector<sub_node_t*> stack;
+            for(auto &child : node->children)
+                stack.push_back(child.second.get());
+
+            while(!stack.empty()) {
+                node = stack.back();
+                stack.pop_back();
+
+                // Unchanged nodes may still have changed children
+                if(stamp == 0 || node->stamp == stamp)
+                    add(node);
+
+                for(auto &child : node->children)
+                    stack.push_back(child.second.get());
+            }
+        }
     }
 
-    int Datastore::unsubscribe(std::string path, std::string uuid)
+    bool Datastore::assign(
+        nlohmann::json &dst, const nlohmann::json &src, sub_node_t *node, unsigned long stamp)
     {
-        int count = 0;
-        std::string ns = parse_namespace(path);
-
-        m_subs.erase(std::remove_if(
-            m_subs.begin(), m_subs.end(),
-            [&](const request_t &sub) {
-                if(!uuid.empty()) {
-                    if(uuid != sub.msg.uuid) {
-                        // Ignore subscriptions that don't match UUID
-                        return false;
-                    }
-                    else if(path.empty()) {
-                        // Remove all subscriptions matching UUID
-                        return true;
-                    }
+        if(node == nullptr)
+            return overwrite(dst, src);
+
+        bool changed = false;
+        if(node->children.empty() || dst.type() != src.type() || !(src.is_object() || src.is_array())) {
+            // Nothing beneath to tell apart
+            changed = overwrite(dst, src);
+            if(changed)
+                stamp_all(node, stamp);
+
+            return changed;
+        }
+
+        auto child_of = [&](const std::string &key) -> sub_node_t* {
+            auto child = node->children.find(key);
+            return (child != node->children.end()) ? child->second.get() : nullptr;
+        };
+
+        if(src.is_object()) {
+            nlohmann::json::object_t &to = *dst.get_ptr<nlohmann::json::object_t*>();
+            const nlohmann::json::object_t &from = *src.get_ptr<const nlohmann::json::object_t*>();
+            for(auto it = to.begin(); it != to.end();) {
+                if(from.count(it->first) == 0) {
+                    if(sub_node_t *child = child_of(it->first))
+                        stamp_all(child, stamp);
+
+                    it = to.erase(it);
+                    changed = true;
                 }
+                else {
+                    ++it;
+                }
+            }
 
-                if(ns.empty()) {
-                    // Data is in local store
-                    std::string sub_path = sub.msg.path.at("path").get<std::string>();
-                    if(path.rfind(sub_path, 0) != std::string::npos) {
-                        count += 1;
-                        return true;
-                    }
+            for(const auto &entry : from) {
+                auto it = to.find(entry.first);
+                if(it == to.end()) {
+                    if(sub_node_t *child = child_of(entry.first))
+                        stamp_all(child, stamp);
+
+                    to.emplace(entry.first, entry.second);
+                    changed = true;
                 }
                 else {
-                    // Data is in remote store
-                    std::string sub_path = sub.msg.path.at("path").get<std::string>();
-                    if(sub.remote && path.rfind(ns + '.' + sub_path, 0) != std::string::npos) {
-                        Message msg;
-                        msg.type = "unsubscribe";
-                        msg.uuid = sub.msg.uuid;
-                        msg.path = sub.msg.path;
-
-                        transmit(sub.remote, msg);
-                        count += 1;
-                        return true;
-                    }
+                    changed |= assign(it->second, entry.second, child_of(entry.first), stamp);
                 }
-                return false;
-            }),
-            m_subs.end()
-        );
+            }
+        }
+        else {
+            nlohmann::json::array_t &to = *dst.get_ptr<nlohmann::json::array_t*>();
+            const nlohmann::json::array_t &from = *src.get_ptr<const nlohmann::json::array_t*>();
+            size_t common = std::min(to.size(), from.size());
+            for(size_t i = 0; i < common; ++i)
+                changed |= assign(to[i], from[i], child_of(std::to_string(i)), stamp);
 
-        return count;
-    }
+            // Elements added or removed at the end
+            for(size_t i = common; i < std::max(to.size(), from.size()); ++i) {
+                if(sub_node_t *child = child_of(std::to_string(i)))
+                    stamp_all(child, stamp);
+            }
 
-    void Datastore::attach(
-        std::string name, void (*handler)(const Message &msg, void *ctx), void *ctx)
-    {
-        assert(handler != nullptr);
+            if(to.size() != from.size()) {
+                to.resize(common);
+                to.insert(to.end(), from.begin() + common, from.end());
+                changed = true;
+            }
+        }
 
-        remote_t remote;
-        remote.name = name;
-        remote.handler = handler;
-        remote.handler_ctx = ctx;
+        if(changed)
+            node->stamp = stamp;
 
-        m_remotes[name] = remote;
+        return changed;
     }
 
-    void Datastore::detach(std::string name)
+    void Datastore::stamp_all(sub_node_t *node, unsigned long stamp)
     {
-        m_remotes.erase(name);
+        node->stamp = stamp;
+        for(auto &child : node->children)
+            stamp_all(child.second.get(), stamp);
     }
 
-    void Datastore::receive(const Message &msg, std::string name)
+    void Datastore::notify_path(const Path &path, bool push, unsigned long stamp)
     {
-        if(msg.type == "set") {
-            set(msg.path, msg.value);
+        if(m_batch_depth > 0) {
+            m_batch_paths.push_back(path);
+            return;
         }
-        else if(msg.type == "push") {
-            push(msg.path, msg.value);
+
+        fanout_t fanout(this);
+        scratch_t &scratch = claim_scratch();
+        collect(path, scratch.nodes, nullptr, stamp);
+
+#ifdef ENTANGLD_STATS
+        clock::time_point start = clock::now();
+#endif
+
+        for(sub_node_t *node : scratch.nodes)
+            notify(node, &path, 1, push, scratch.event);
+
+#ifdef ENTANGLD_STATS
+        if(!scratch.nodes.empty()) {
+            uint64_t ns = elapsed_ns(start);
+            std::lock_guard<std::mutex> lock(m_counters->lock);
+            m_counters->fanout_latency.record(ns);
         }
-        else if(msg.type == "get") {
-            get(
-                msg.path,
-                [](const Message &msg, void *ctx) {
-                    Message resp;
-                    resp.type = "value";
-                    resp.path = msg.path;
-                    resp.uuid = msg.uuid;
-                    resp.value = msg.value;
-
-                    remote_t *remote = static_cast<remote_t*>(ctx);
-                    transmit(remote, resp);
-                },
-                &m_remotes[name],
-                msg.uuid
-            );
+#endif
+
+        release_scratch();
+    }
+
+    Datastore::scratch_t &Datastore::claim_scratch()
+    {
+        if(m_scratch_depth == m_scratch.size())
+            m_scratch.emplace_back(new scratch_t);
+
+        scratch_t &scratch = *m_scratch[m_scratch_depth++];
+        scratch.nodes.clear();
+        return scratch;
+    }
+
+    void Datastore::release_scratch()
+    {
+        assert(m_scratch_depth > 0);
+        m_scratch_depth -= 1;
+    }
+
+    void Datastore::send(remote_t *remote, Message &&msg)
+    {
+        if(m_batch_depth == 0) {
+            transmit(remote, msg);
+            return;
         }
-        else if(msg.type == "value") {
-            try {
-                request_t request = m_requests.at(msg.uuid);
-                if(request.callback)
-                    request.callback(msg, request.callback_ctx);
 
-                m_requests.erase(msg.uuid);
-            }
-            catch(std::out_of_range &e) {
-                fprintf(stderr, "Could not find mapped request: %s\n", e.what());
+        auto it = std::find_if(m_batch_msgs.begin(), m_batch_msgs.end(),
+            [&](const std::pair<remote_t*, std::vector<Message>> &entry) {
+                return entry.first == remote;
+            });
+
+        if(it == m_batch_msgs.end())
+            it = m_batch_msgs.insert(it, std::make_pair(remote, std::vector<Message>()));
+
+        it->second.push_back(std::move(msg));
+    }
+
+    void Datastore::notify(sub_node_t *node, const Path *changed, size_t count, bool push, Message &msg)
+    {
+        // Build the event once and share it between every subscriber
+        bool built = false;
+        std::shared_ptr<Message> shared;
+        nlohmann::json patch;
+        clock::time_point now;
+        for(request_t &sub : node->subs) {
+            if(sub.remote || sub.dead)
+                continue;
+
+            if(!admit(sub, now)) {
+                sub.synced = false;
+                continue;
             }
-        }
-        else if(msg.type == "event") {
-            for(auto it = m_subs.begin(); it != m_subs.end(); ++it) {
-                const request_t &sub = *it;
-                if(sub.remote && sub.remote->name == name) {
-                    std::string msg_path = msg.path.get<std::string>();
-                    std::string sub_path = sub.msg.path.at("path").get<std::string>();
-                    if(msg_path.rfind(sub_path, 0) != std::string::npos) {
-                        sub.callback(msg, sub.callback_ctx);
-                    }
+
+            if(sub.policy.delta) {
+                if(!sub.synced) {
+                    sub.synced = true;
+                    deliver_patch(sub, snapshot(sub));
+                    continue;
                 }
+
+                if(patch.is_null())
+                    patch = make_patch(node, changed, count, push);
+
+                if(!patch.empty())
+                    deliver_patch(sub, patch);
+
+                continue;
+            }
+
+            if(!built) {
+                built = true;
+                msg.type = "event";
+                overwrite(msg.path, sub.msg.path.at("path"));
+                overwrite(msg.value, lookup(m_local_data, sub.ptr));
+                msg.revision = revision_of(msg.path.get_ref<const std::string&>());
             }
+
+            dispatch(sub.callback, msg, shared, sub.msg.uuid);
         }
-        else if(msg.type == "subscribe") {
-            subscribe(
-                msg.path.at("path"),
-                [](const Message &msg, void *ctx) {
-                    remote_t *remote = static_cast<remote_t*>(ctx);
-                    transmit(remote, msg);
-                },
-                &m_remotes[name],
-                msg.path.at("uuid")
-            );
+    }
+
+    bool Datastore::admit(request_t &sub, clock::time_point &now)
+    {
+        const policy_t &policy = sub.policy;
+        if(policy.every > 1) {
+            // Deliver the first change, then every Nth after it
+            unsigned int count = sub.count;
+            sub.count = (count + 1) % policy.every;
+            if(count != 0)
+                return false;
         }
-        else if(msg.type == "unsubscribe") {
-            if(msg.path.is_string()) {
-                // Path is a string
-                unsubscribe(msg.path.get<std::string>(), msg.uuid);
+
+        if(policy.interval.count() > 0) {
+            if(now == clock::time_point())
+                now = clock::now();
+
+            if(sub.last != clock::time_point() && now - sub.last < policy.interval) {
+                // Coalesce into a single trailing delivery
+                if(policy.trailing)
+                    m_pending.insert(&sub);
+
+                return false;
+            }
+
+            sub.last = now;
+            m_pending.erase(&sub);
+        }
+
+        return true;
+    }
+
+    nlohmann::json Datastore::make_patch(sub_node_t *node, const Path *changed, size_t count, bool push)
+    {
+        // Segments of the node, the root of the patch
+        std::vector<std::string> root;
+        for(sub_node_t *n = node; n->parent != nullptr; n = n->parent)
+            root.push_back(n->key);
+
+        std::reverse(root.begin(), root.end());
+
+        nlohmann::json patch = nlohmann::json::array();
+        for(size_t c = 0; c < count; ++c) {
+            const std::vector<std::string> &segments = changed[c].segments();
+
+            size_t shared = 0;
+            while(shared < root.size() && shared < segments.size() && root[shared] == segments[shared])
+                shared += 1;
+
+            // Writes beside the node did not change it
+            if(shared < root.size() && shared < segments.size())
+                continue;
+
+            const nlohmann::json &data = m_local_data;
+            if(segments.size() < root.size() || (segments.size() == root.size() && !push)) {
+                // The whole value was replaced, nothing else in the patch matters
+                std::string ptr;
+                append_pointer(ptr, root, 0);
+
+                patch = nlohmann::json::array({{
+                    {"op", "replace"},
+                    {"path", ""},
+                    {"value", lookup(data, nlohmann::json::json_pointer(ptr))}
+                }});
+                break;
+            }
+
+            std::string pointer;
+            append_pointer(pointer, segments, root.size());
+
+            const nlohmann::json &target = lookup(data, changed[c].pointer());
+            if(push && target.is_array() && !target.empty()) {
+                patch.push_back({
+                    {"op", "add"},
+                    {"path", pointer + "/-"},
+                    {"value", target.back()}
+                });
             }
             else {
-                // Path is an object containing path and uuid
-                unsubscribe(msg.path.value("path", ""), msg.path.value("uuid", ""));
+                patch.push_back({
+                    {"op", "replace"},
+                    {"path", pointer},
+                    {"value", target}
+                });
             }
         }
+
+        return patch;
+    }
+
+    nlohmann::json Datastore::snapshot(const request_t &sub) const
+    {
+        return nlohmann::json::array({{
+            {"op", "replace"},
+            {"path", ""},
+            {"value", lookup(m_local_data, sub.ptr)}
+        }});
+    }
+
+    void Datastore::deliver_patch(const request_t &sub, nlohmann::json patch)
+    {
+        Message msg;
+        msg.type = "event";
+        msg.path = sub.msg.path.at("path");
+        msg.uuid = sub.msg.uuid;
+        msg.params = {{"patch", std::move(patch)}};
+        msg.revision = revision_of(msg.path.get_ref<const std::string&>());
+
+        if(sub.origin == nullptr)
+            msg.value = lookup(m_local_data, sub.ptr);
+
+        dispatch(sub.callback, std::move(msg));
+    }
+
+    void Datastore::deliver(request_t &sub)
+    {
+        if(sub.policy.delta) {
+            sub.synced = true;
+            deliver_patch(sub, snapshot(sub));
+            return;
+        }
+
+        Message msg;
+        msg.type = "event";
+        msg.path = sub.msg.path.at("path");
+        msg.value = lookup(m_local_data, sub.ptr);
+        msg.uuid = sub.msg.uuid;
+        msg.revision = revision_of(msg.path.get_ref<const std::string&>());
+
+        dispatch(sub.callback, std::move(msg));
+    }
+
+    uint32_t Datastore::acquire_slot()
+    {
+        uint32_t index;
+        if(m_free_slots.empty()) {
+            index = m_slots.size();
+            m_slots.emplace_back();
+            m_slots.back().serial = 0;
+        }
+        else {
+            index = m_free_slots.back();
+            m_free_slots.pop_back();
+        }
+
+        m_slots[index].active = true;
+        m_slots[index].named = false;
+        return index;
+    }
+
+    void Datastore::release_slot(uint32_t index)
+    {
+        slot_t &slot = m_slots[index];
+        slot.active = false;
+        slot.serial += 1;
+        slot.request.remote = nullptr;
+        slot.request.msg.value = nullptr;
+        m_free_slots.push_back(index);
+
+        if(!slot.key.empty()) {
+            m_inflight.erase(slot.key);
+            slot.key.clear();
+        }
+
+        // A later request may have reused the uuid
+        if(slot.named) {
+            auto it = m_named_slots.find(slot.request.msg.uuid);
+            if(it != m_named_slots.end() && it->second == index)
+                m_named_slots.erase(it);
+
+            slot.named = false;
+        }
+
+        if(m_free_slots.size() == m_slots.size())
+            m_deadlines.clear();
+    }
+
+    void Datastore::generate_id(std::string &out, long slot)
+    {
+        if(m_request_opts.ids == id_format_t::UUID) {
+            format_uuid(out, slot);
+        }
+        else {
+            // Layout is pppppppp-cccccccccccccccc, get requests use the
+            // low 32 bits of the counter for the slot
+            uint64_t counter = ++m_id_counter;
+            if(slot >= 0)
+                counter = (counter << 32) | static_cast<uint32_t>(slot);
+
+            char buffer[25];
+            to_hex(m_id_prefix, buffer, 8);
+            buffer[8] = '-';
+            to_hex(counter, buffer + 9, 16);
+            out.assign(buffer, sizeof(buffer));
+        }
+    }
+
+    uint64_t Datastore::id_key(const std::string &uuid)
+    {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ULL;
+        for(char c : uuid) {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ULL;
+        }
+
+        return hash;
     }
 
-    std::string Datastore::parse_namespace(std::string path)
+    long Datastore::find_slot(const std::string &uuid) const
     {
-        if(!path.empty()) {
-            for(auto it = m_remotes.begin(); it != m_remotes.end(); ++it) {
-                if(path.rfind(it->first + '.', 0) != std::string::npos)
-                    return it->first;
+        uint64_t index;
+        if(uuid.size() >= SLOT_DIGITS
+        && from_hex(&uuid[uuid.size() - SLOT_DIGITS], SLOT_DIGITS, index)
+        && index < m_slots.size()) {
+            const slot_t &slot = m_slots[index];
+            if(slot.active && slot.request.msg.uuid == uuid)
+                return index;
+        }
+
+        // Late and duplicate replies to generated uuids end here
+        if(m_named_slots.empty())
+            return -1;
+
+        auto it = m_named_slots.find(uuid);
+        return (it != m_named_slots.end()) ? long(it->second) : -1;
+    }
+
+    void Datastore::expire_slot(uint32_t index)
+    {
+        const request_t &request = m_slots[index].request;
+
+        Message msg;
+        msg.type = "timeout";
+        msg.path = request.msg.path;
+        msg.uuid = request.msg.uuid;
+
+        finish_slot(index, msg);
+    }
+
+    void Datastore::finish_slot(uint32_t index, const Message &msg)
+    {
+        // Callbacks may make new requests, so release the slot first
+        callback_t callback;
+        std::swap(callback, m_slots[index].request.callback);
+
+        std::vector<std::pair<callback_t, std::string>> followers;
+        std::swap(followers, m_slots[index].followers);
+
+        release_slot(index);
+
+        if(callback)
+            dispatch(callback, msg);
+
+        for(auto &follower : followers) {
+            if(follower.second.empty() || follower.second == msg.uuid) {
+                dispatch(follower.first, msg);
+                continue;
             }
+
+            Message copy = msg;
+            copy.uuid = follower.second;
+            dispatch(follower.first, std::move(copy));
         }
-        return "";
     }
 }
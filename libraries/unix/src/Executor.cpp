@@ -0,0 +1,112 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Executor.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <cstdio>
+#include <exception>
+
+#include "Executor.h"
+
+/** Runs a task on an executor thread, where an exception has nowhere to go. */
+static void run_task(entangld::Executor::task_t &task)
+{
+    try {
+        task();
+    }
+    catch(std::exception &e) {
+        fprintf(stderr, "Executor task failed: %s\n", e.what());
+    }
+    catch(...) {
+        fprintf(stderr, "Executor task failed\n");
+    }
+}
+
+namespace entangld
+{
+    void InlineExecutor::post(task_t &&task, const void*)
+    {
+        task();
+    }
+
+    ThreadExecutor::ThreadExecutor()
+    : m_thread(&ThreadExecutor::run, this) {}
+
+    ThreadExecutor::~ThreadExecutor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+
+        m_ready.notify_one();
+        m_thread.join();
+    }
+
+    void ThreadExecutor::post(task_t &&task, const void*)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.push_back(std::move(task));
+        }
+
+        m_ready.notify_one();
+    }
+
+    void ThreadExecutor::run()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for(;;) {
+            m_ready.wait(lock, [this]() { return m_stop || !m_tasks.empty(); });
+            if(m_tasks.empty())
+                return;
+
+            task_t task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+
+            lock.unlock();
+            run_task(task);
+            lock.lock();
+        }
+    }
+
+    void PoolExecutor::post(task_t &&task, const void *key)
+    {
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::deque<task_t> &strand = m_strands[key];
+            idle = strand.empty();
+            strand.push_back(std::move(task));
+        }
+
+        // A running strand picks the task up itself
+        if(idle)
+            m_submit([this, key]() { run(key); });
+    }
+
+    void PoolExecutor::run(const void *key)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        // Rehashing keeps references valid, and only this job erases the strand
+        std::deque<task_t> &strand = m_strands[key];
+        for(;;) {
+            // The moved-from task stays at the front to mark the strand busy
+            task_t task = std::move(strand.front());
+
+            // The strand must keep draining, or its key would stall for good
+            lock.unlock();
+            run_task(task);
+            lock.lock();
+
+            strand.pop_front();
+            if(strand.empty()) {
+                m_strands.erase(key);
+                return;
+            }
+        }
+    }
+}
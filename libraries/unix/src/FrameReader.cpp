@@ -0,0 +1,111 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file FrameReader.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+#include "FrameReader.h"
+
+/** Initial size of the buffer. */
+static const size_t INITIAL_SIZE = 4096;
+
+namespace entangld
+{
+    FrameReader::FrameReader(Format format, size_t max_frame)
+    : m_format(format), m_max_frame(max_frame) {}
+
+    uint8_t *FrameReader::prepare(size_t size)
+    {
+        if(m_buffer.size() - m_end >= size)
+            return m_buffer.data() + m_end;
+
+        // Move the undecoded bytes to the front before growing
+        if(m_start > 0) {
+            memmove(m_buffer.data(), m_buffer.data() + m_start, m_end - m_start);
+            m_end -= m_start;
+            m_start = 0;
+        }
+
+        if(m_buffer.size() - m_end < size)
+            m_buffer.resize(std::max(m_end + size, std::max(m_buffer.size() * 2, INITIAL_SIZE)));
+
+        return m_buffer.data() + m_end;
+    }
+
+    void FrameReader::commit(size_t count)
+    {
+        assert(m_end + count <= m_buffer.size());
+        m_end += count;
+    }
+
+    void FrameReader::append(const uint8_t *data, size_t size)
+    {
+        memcpy(prepare(size), data, size);
+        commit(size);
+    }
+
+    bool FrameReader::next(Message &msg)
+    {
+        for(;;) {
+            const uint8_t *data = m_buffer.data() + m_start;
+            size_t size = m_end - m_start;
+            size_t payload = 0;
+            size_t length = 0;
+            size_t count = 0;
+
+            if(m_format == Format::JSON) {
+                // Only search bytes that arrived since the last call
+                const void *end = memchr(data + m_scanned, '\n', size - m_scanned);
+                if(end != nullptr) {
+                    length = static_cast<const uint8_t*>(end) - data;
+                    count = length + 1;
+                }
+                else {
+                    m_scanned = size;
+                    length = size;
+                }
+            }
+            else {
+                count = next_frame(data, size, m_format, payload, length);
+                if(count == 0 && size >= 4) {
+                    length = (size_t(data[0]) << 24) | (size_t(data[1]) << 16)
+                        | (size_t(data[2]) << 8) | size_t(data[3]);
+                }
+            }
+
+            if(length > m_max_frame)
+                throw std::length_error("frame exceeds max_frame");
+
+            if(count == 0) {
+                // Start over at the front once everything was decoded
+                if(size == 0)
+                    m_start = m_end = 0;
+
+                return false;
+            }
+
+            m_start += count;
+            m_scanned = 0;
+
+            // Skip blank lines between JSON frames
+            if(length == 0)
+                continue;
+
+            decode(data + payload, length, m_format, msg);
+            return true;
+        }
+    }
+
+    void FrameReader::clear()
+    {
+        m_start = 0;
+        m_end = 0;
+        m_scanned = 0;
+    }
+}
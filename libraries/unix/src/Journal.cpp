@@ -0,0 +1,558 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Journal.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Codec.h"
+#include "Journal.h"
+
+/** Marks a write log, "ENTL". */
+static const uint32_t LOG_MAGIC = 0x454e544c;
+
+/** Marks a compacted snapshot, "ENTC". */
+static const uint32_t SNAPSHOT_MAGIC = 0x454e5443;
+
+/** File format version, bumped when the layout changes. */
+static const uint32_t FORMAT_VERSION = 1;
+
+/** Log header: magic, version and the sequence number of the first record. */
+static const size_t LOG_HEADER = 16;
+
+/** Snapshot header: magic, version, sequence number and payload size. */
+static const size_t SNAPSHOT_HEADER = 24;
+
+/** Bytes around each record: its length before it and checksum after it. */
+static const size_t RECORD_OVERHEAD = 8;
+
+static void put_u32(std::vector<uint8_t> &out, uint32_t value)
+{
+    for(int shift = 24; shift >= 0; shift -= 8)
+        out.push_back(static_cast<uint8_t>(value >> shift));
+}
+
+static void put_u64(std::vector<uint8_t> &out, uint64_t value)
+{
+    put_u32(out, static_cast<uint32_t>(value >> 32));
+    put_u32(out, static_cast<uint32_t>(value));
+}
+
+static uint32_t get_u32(const uint8_t *in)
+{
+    return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | in[3];
+}
+
+static uint64_t get_u64(const uint8_t *in)
+{
+    return (uint64_t(get_u32(in)) << 32) | get_u32(in + 4);
+}
+
+/** Builds the lookup table for crc32(). */
+static std::vector<uint32_t> crc32_table()
+{
+    std::vector<uint32_t> table(256);
+    for(uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for(int k = 0; k < 8; ++k)
+            c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+
+        table[i] = c;
+    }
+
+    return table;
+}
+
+/** Returns the CRC-32 (IEEE 802.3) of a buffer. */
+static uint32_t crc32(const uint8_t *data, size_t size)
+{
+    static const std::vector<uint32_t> table = crc32_table();
+
+    uint32_t crc = 0xffffffff;
+    for(size_t i = 0; i < size; ++i)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+    return crc ^ 0xffffffff;
+}
+
+/** Appends a CBOR head for a major type and length. */
+static void put_cbor_head(std::vector<uint8_t> &out, uint8_t major, uint64_t size)
+{
+    if(size < 24) {
+        out.push_back(major | static_cast<uint8_t>(size));
+    }
+    else if(size <= 0xff) {
+        out.push_back(major | 24);
+        out.push_back(static_cast<uint8_t>(size));
+    }
+    else if(size <= 0xffff) {
+        out.push_back(major | 25);
+        out.push_back(static_cast<uint8_t>(size >> 8));
+        out.push_back(static_cast<uint8_t>(size));
+    }
+    else if(size <= 0xffffffff) {
+        out.push_back(major | 26);
+        put_u32(out, static_cast<uint32_t>(size));
+    }
+    else {
+        out.push_back(major | 27);
+        put_u64(out, size);
+    }
+}
+
+/** Appends a CBOR text string. */
+static void put_cbor_text(std::vector<uint8_t> &out, const std::string &text)
+{
+    put_cbor_head(out, 0x60, text.size());
+    out.insert(out.end(), text.begin(), text.end());
+}
+
+/** Writes a whole buffer. Returns 0 or a negative errno. */
+static int write_all(int fd, const uint8_t *data, size_t size)
+{
+    while(size > 0) {
+        ssize_t count = ::write(fd, data, size);
+        if(count < 0) {
+            if(errno == EINTR)
+                continue;
+
+            return -errno;
+        }
+
+        data += count;
+        size -= count;
+    }
+
+    return 0;
+}
+
+/** Flushes a directory, so that renames within it are durable. */
+static int sync_dir(const std::string &dir)
+{
+    int fd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(fd < 0)
+        return -errno;
+
+    int result = (fsync(fd) < 0) ? -errno : 0;
+    ::close(fd);
+    return result;
+}
+
+/** Writes a file next to its destination, then renames it into place. */
+static int replace_file(const std::string &dir, const std::string &name, const std::vector<uint8_t> &data, int *keep_fd)
+{
+    std::string path = dir + "/" + name;
+    std::string temp = path + ".tmp";
+
+    int fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0)
+        return -errno;
+
+    int result = write_all(fd, data.data(), data.size());
+    if(result == 0 && fsync(fd) < 0)
+        result = -errno;
+
+    if(result == 0 && rename(temp.c_str(), path.c_str()) < 0)
+        result = -errno;
+
+    if(result == 0)
+        result = sync_dir(dir);
+
+    if(result == 0 && keep_fd != nullptr) {
+        *keep_fd = fd;
+        return 0;
+    }
+
+    ::close(fd);
+    if(result < 0)
+        unlink(temp.c_str());
+
+    return result;
+}
+
+namespace entangld
+{
+    Journal::~Journal()
+    {
+        close();
+    }
+
+    int Journal::open(const std::string &dir, Datastore &store, const opts_t &opts)
+    {
+        if(is_open())
+            return -EBUSY;
+
+        if(mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST)
+            return -errno;
+
+        m_dir = dir;
+        m_store = &store;
+        m_opts = opts;
+        m_pending.clear();
+        m_writing = false;
+        m_requested = false;
+        m_stop = false;
+        m_error = 0;
+
+        uint64_t seq = 0;
+        int result = load_snapshot(seq);
+        if(result == 0)
+            result = replay_log(seq);
+
+        if(result < 0) {
+            if(m_fd >= 0)
+                ::close(m_fd);
+
+            m_fd = -1;
+            m_store = nullptr;
+            return result;
+        }
+
+        m_durable = m_seq;
+        m_thread = std::thread(&Journal::run, this);
+        store.set_write_hook(on_write, this);
+        return 0;
+    }
+
+    bool Journal::is_open() const
+    {
+        return m_store != nullptr;
+    }
+
+    int Journal::flush()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        uint64_t target = m_seq;
+        m_requested = true;
+        m_wake.notify_one();
+        m_written.wait(lock, [&]{ return m_durable >= target || m_error < 0 || m_stop; });
+        return m_error;
+    }
+
+    int Journal::compact()
+    {
+        if(!is_open())
+            return -EBADF;
+
+        // Copy the data and note where the log is, writes are held up meanwhile
+        nlohmann::json data;
+        uint64_t seq = 0;
+        size_t offset = 0;
+        m_store->visit([&](const nlohmann::json &local) {
+            data = local;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            seq = m_seq;
+            offset = m_log_size;
+        });
+
+        std::vector<uint8_t> payload;
+        nlohmann::json::to_cbor(data, payload);
+        data = nullptr;
+
+        std::vector<uint8_t> snapshot;
+        snapshot.reserve(SNAPSHOT_HEADER + payload.size());
+        put_u32(snapshot, SNAPSHOT_MAGIC);
+        put_u32(snapshot, FORMAT_VERSION);
+        put_u64(snapshot, seq);
+        put_u64(snapshot, payload.size());
+        snapshot.insert(snapshot.end(), payload.begin(), payload.end());
+        payload = std::vector<uint8_t>();
+
+        // The old log still covers everything, so a crash here loses nothing
+        int result = replace_file(m_dir, "snapshot", snapshot, nullptr);
+        if(result < 0)
+            return result;
+
+        snapshot = std::vector<uint8_t>();
+
+        // Start the new log with the records made since the copy
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_written.wait(lock, [&]{ return !m_writing; });
+
+        result = write_all(m_fd, m_pending.data(), m_pending.size());
+        if(result < 0)
+            return result;
+
+        m_pending.clear();
+
+        std::vector<uint8_t> tail(m_log_size - offset);
+        if(!tail.empty() && pread(m_fd, tail.data(), tail.size(), offset) != static_cast<ssize_t>(tail.size()))
+            return -EIO;
+
+        result = create_log(seq, tail.data(), tail.size());
+        if(result < 0)
+            return result;
+
+        m_durable = m_seq;
+        m_written.notify_all();
+        return 0;
+    }
+
+    size_t Journal::log_size() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_log_size;
+    }
+
+    void Journal::close()
+    {
+        if(!is_open())
+            return;
+
+        m_store->set_write_hook(nullptr);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+            m_wake.notify_one();
+        }
+
+        m_thread.join();
+        ::close(m_fd);
+        m_fd = -1;
+        m_store = nullptr;
+    }
+
+    void Journal::on_write(
+        const Path &path, const nlohmann::json &value, bool push, size_t limit, void *ctx)
+    {
+        Journal *journal = static_cast<Journal*>(ctx);
+        std::lock_guard<std::mutex> lock(journal->m_mutex);
+
+        // A Message as a CBOR map, written directly to avoid copying value
+        std::vector<uint8_t> &out = journal->m_pending;
+        size_t start = out.size();
+        put_u32(out, 0);
+
+        // A bounded push keeps its limit rather than logging the window
+        bool bounded = push && limit > 0;
+        put_cbor_head(out, 0xa0, (bounded) ? 4 : 3);
+        put_cbor_text(out, "type");
+        put_cbor_text(out, (push) ? "push" : "set");
+        put_cbor_text(out, "path");
+        put_cbor_text(out, path.str());
+        put_cbor_text(out, "value");
+        nlohmann::json::to_cbor(value, out);
+
+        if(bounded) {
+            put_cbor_text(out, "params");
+            put_cbor_head(out, 0xa0, 1);
+            put_cbor_text(out, "limit");
+            put_cbor_head(out, 0x00, limit);
+        }
+
+        size_t length = out.size() - start - 4;
+        for(int i = 0; i < 4; ++i)
+            out[start + i] = static_cast<uint8_t>(length >> (24 - 8 * i));
+
+        put_u32(out, crc32(out.data() + start + 4, length));
+
+        journal->m_seq += 1;
+        journal->m_log_size += length + RECORD_OVERHEAD;
+    }
+
+    void Journal::run()
+    {
+        std::vector<uint8_t> group;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for(;;) {
+            m_wake.wait_for(lock, m_opts.flush_interval, [this]{ return m_stop || m_requested; });
+            m_requested = false;
+
+            if(m_pending.empty()) {
+                // Wake flush() callers that had nothing left to wait for
+                m_written.notify_all();
+                if(m_stop)
+                    break;
+
+                continue;
+            }
+
+            std::swap(group, m_pending);
+            uint64_t seq = m_seq;
+            int fd = m_fd;
+            m_writing = true;
+
+            // Writes keep being journaled while this group is written
+            lock.unlock();
+            int result = write_all(fd, group.data(), group.size());
+            if(result == 0 && m_opts.sync && fdatasync(fd) < 0)
+                result = -errno;
+
+            group.clear();
+            lock.lock();
+
+            m_writing = false;
+            if(result < 0 && m_error == 0) {
+                fprintf(stderr, "Journal write failed: %s\n", strerror(-result));
+                m_error = result;
+            }
+
+            m_durable = seq;
+            m_written.notify_all();
+        }
+    }
+
+    int Journal::load_snapshot(uint64_t &seq)
+    {
+        std::string path = m_dir + "/snapshot";
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+            return (errno == ENOENT) ? 0 : -errno;
+
+        struct stat st;
+        if(fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(SNAPSHOT_HEADER)) {
+            ::close(fd);
+            return -EINVAL;
+        }
+
+        // Decode straight from the mapping rather than reading it into a buffer
+        size_t size = st.st_size;
+        void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(map == MAP_FAILED)
+            return -errno;
+
+        madvise(map, size, MADV_SEQUENTIAL);
+
+        const uint8_t *data = static_cast<const uint8_t*>(map);
+        int result = 0;
+        uint64_t length = get_u64(data + 16);
+        if(get_u32(data) != SNAPSHOT_MAGIC || get_u32(data + 4) != FORMAT_VERSION
+        || length > size - SNAPSHOT_HEADER) {
+            result = -EINVAL;
+        }
+        else {
+            try {
+                nlohmann::json value = nlohmann::json::from_cbor(
+                    data + SNAPSHOT_HEADER, data + SNAPSHOT_HEADER + length);
+
+                seq = get_u64(data + 8);
+                m_store->set("", std::move(value));
+            }
+            catch(const nlohmann::json::exception &e) {
+                fprintf(stderr, "Invalid snapshot %s: %s\n", path.c_str(), e.what());
+                result = -EINVAL;
+            }
+        }
+
+        munmap(map, size);
+        return result;
+    }
+
+    int Journal::replay_log(uint64_t seq)
+    {
+        std::string path = m_dir + "/log";
+        int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+        if(fd < 0 && errno == ENOENT)
+            return create_log(seq, nullptr, 0);
+
+        if(fd < 0)
+            return -errno;
+
+        m_fd = fd;
+
+        struct stat st;
+        if(fstat(fd, &st) < 0)
+            return -errno;
+
+        size_t size = st.st_size;
+        std::vector<uint8_t> data(size);
+        if(size > 0 && pread(fd, data.data(), size, 0) != static_cast<ssize_t>(size))
+            return -EIO;
+
+        if(size < LOG_HEADER || get_u32(data.data()) != LOG_MAGIC || get_u32(data.data() + 4) != FORMAT_VERSION) {
+            fprintf(stderr, "Invalid log %s\n", path.c_str());
+            return -EINVAL;
+        }
+
+        // A log always starts at or before the snapshot it follows
+        uint64_t base = get_u64(data.data() + 8);
+        if(base > seq) {
+            fprintf(stderr, "Log %s does not follow its snapshot\n", path.c_str());
+            return -EINVAL;
+        }
+
+        size_t offset = LOG_HEADER;
+        m_seq = base;
+        while(offset < size) {
+            size_t payload, length;
+            size_t count = next_frame(data.data() + offset, size - offset, Format::CBOR, payload, length);
+            if(count == 0 || offset + count + 4 > size)
+                break;
+
+            const uint8_t *record = data.data() + offset + payload;
+            if(crc32(record, length) != get_u32(data.data() + offset + count))
+                break;
+
+            Message msg;
+            try {
+                msg = decode(record, length, Format::CBOR);
+            }
+            catch(const nlohmann::json::exception&) {
+                break;
+            }
+
+            // Records before the snapshot are already part of it
+            if(m_seq >= seq) {
+                if(msg.type == "push") {
+                    size_t limit = (msg.params.is_object()) ? msg.params.value("limit", size_t(0)) : 0;
+                    m_store->push(msg.path.get<std::string>(), std::move(msg.value), limit);
+                }
+                else
+                    m_store->set(msg.path.get<std::string>(), std::move(msg.value));
+            }
+
+            m_seq += 1;
+            offset += count + 4;
+        }
+
+        // Drop a record torn by a crash, and anything after it
+        if(offset < size) {
+            fprintf(stderr, "Discarding %zu bytes at the end of %s\n", size - offset, path.c_str());
+            if(ftruncate(fd, offset) < 0)
+                return -errno;
+        }
+
+        if(m_seq < seq)
+            m_seq = seq;
+
+        if(lseek(fd, offset, SEEK_SET) < 0)
+            return -errno;
+
+        m_log_size = offset;
+        return 0;
+    }
+
+    int Journal::create_log(uint64_t base, const uint8_t *records, size_t size)
+    {
+        std::vector<uint8_t> data;
+        data.reserve(LOG_HEADER + size);
+        put_u32(data, LOG_MAGIC);
+        put_u32(data, FORMAT_VERSION);
+        put_u64(data, base);
+        data.insert(data.end(), records, records + size);
+
+        int fd = -1;
+        int result = replace_file(m_dir, "log", data, &fd);
+        if(result < 0)
+            return result;
+
+        if(m_fd >= 0)
+            ::close(m_fd);
+
+        m_fd = fd;
+        m_log_size = data.size();
+        return 0;
+    }
+}
@@ -0,0 +1,62 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Path.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include "Path.h"
+
+namespace entangld
+{
+    Path::Path(const std::string &path)
+    : m_path(path)
+    {
+        std::string pointer;
+        if(!m_path.empty()) {
+            size_t start = 0;
+            while(true) {
+                size_t end = m_path.find('.', start);
+                if(end == std::string::npos)
+                    end = m_path.size();
+
+                m_segments.push_back(m_path.substr(start, end-start));
+                if(end == m_path.size())
+                    break;
+
+                start = end + 1;
+            }
+
+            // Escape reference tokens per RFC 6901
+            pointer.reserve(m_path.size() + 1);
+            for(const std::string &segment : m_segments) {
+                pointer += '/';
+                for(char c : segment) {
+                    if(c == '~')
+                        pointer += "~0";
+                    else if(c == '/')
+                        pointer += "~1";
+                    else
+                        pointer += c;
+                }
+            }
+        }
+
+        m_ptr = nlohmann::json::json_pointer(pointer);
+    }
+
+    std::string Path::relative(size_t depth) const
+    {
+        if(depth == 0)
+            return m_path;
+
+        if(depth >= m_segments.size())
+            return "";
+
+        size_t offset = 0;
+        for(size_t i = 0; i < depth; ++i)
+            offset += m_segments[i].size() + 1;
+
+        return m_path.substr(offset);
+    }
+}
@@ -0,0 +1,490 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Server.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Server.h"
+
+/** Initial size of a client's input buffer. */
+static const size_t INPUT_SIZE = 4096;
+
+/** Input buffers larger than this are released once empty. */
+static const size_t INPUT_RETAIN = 1 << 20;
+
+/** Maximum number of buffers passed to a single writev. */
+static const int MAX_IOV = 64;
+
+/** Maximum number of events handled per epoll_wait. */
+static const int MAX_EVENTS = 64;
+
+/** Sets O_NONBLOCK on a descriptor. */
+static int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if(flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+        return -errno;
+
+    return 0;
+}
+
+namespace entangld
+{
+    Server::Server(Datastore *store, const opts_t &opts)
+    : m_store(store), m_opts(opts)
+    {
+        m_opts.remote.format = m_opts.format;
+        m_opts.remote.on_disconnect = disconnected;
+        m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+
+    Server::~Server()
+    {
+        while(!m_clients.empty())
+            drop_client(m_clients.begin()->second.get());
+
+        for(int fd : m_listeners)
+            close(fd);
+
+        if(m_epoll_fd >= 0)
+            close(m_epoll_fd);
+    }
+
+    int Server::add_listener(int fd)
+    {
+        if(m_epoll_fd < 0) {
+            close(fd);
+            return -EBADF;
+        }
+
+        int status = set_nonblocking(fd);
+        if(status < 0) {
+            close(fd);
+            return status;
+        }
+
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+
+        if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            status = -errno;
+            close(fd);
+            return status;
+        }
+
+        m_listeners.push_back(fd);
+        return 0;
+    }
+
+    int Server::poll(int timeout_ms)
+    {
+        struct epoll_event events[MAX_EVENTS];
+        int count = epoll_wait(m_epoll_fd, events, MAX_EVENTS, timeout_ms);
+        if(count < 0) {
+            if(errno != EINTR)
+                return -errno;
+
+            count = 0;
+        }
+
+        for(int i = 0; i < count; ++i) {
+            int fd = events[i].data.fd;
+            if(std::find(m_listeners.begin(), m_listeners.end(), fd) != m_listeners.end()) {
+                accept_clients(fd);
+                continue;
+            }
+
+            // May have been dropped by an earlier event
+            auto it = m_clients.find(fd);
+            if(it == m_clients.end())
+                continue;
+
+            client_t *client = it->second.get();
+            if(events[i].events & EPOLLOUT)
+                write_client(client);
+
+            if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+                read_client(client);
+        }
+
+        // Send batched output and service timers
+        m_store->poll();
+
+        // Drop clients once nothing can be using them
+        std::vector<client_t*> closing;
+        for(auto &entry : m_clients) {
+            if(entry.second->closing)
+                closing.push_back(entry.second.get());
+        }
+
+        for(client_t *client : closing)
+            drop_client(client);
+
+        return 0;
+    }
+
+    std::vector<std::string> Server::names() const
+    {
+        std::vector<std::string> names;
+        for(const auto &entry : m_clients)
+            names.push_back(entry.second->name);
+
+        return names;
+    }
+
+    size_t Server::queued(const std::string &name) const
+    {
+        for(const auto &entry : m_clients) {
+            if(entry.second->name == name)
+                return entry.second->queued;
+        }
+
+        return 0;
+    }
+
+    void Server::disconnect(const std::string &name)
+    {
+        for(auto &entry : m_clients) {
+            if(entry.second->name == name) {
+                drop_client(entry.second.get());
+                return;
+            }
+        }
+    }
+
+    void Server::accept_clients(int listen_fd)
+    {
+        for(;;) {
+            int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if(fd < 0) {
+                if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    fprintf(stderr, "Could not accept client: %s\n", strerror(errno));
+
+                return;
+            }
+
+            std::unique_ptr<client_t> client(new client_t);
+            client->server = this;
+            client->fd = fd;
+            client->name = m_opts.prefix + std::to_string(m_next_id++);
+            client->input.resize(INPUT_SIZE);
+            client->received = 0;
+            client->scanned = 0;
+            client->offset = 0;
+            client->queued = 0;
+            client->paused = false;
+            client->closing = false;
+
+            struct epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.fd = fd;
+
+            if(epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+                fprintf(stderr, "Could not watch client: %s\n", strerror(errno));
+                close(fd);
+                continue;
+            }
+
+            m_store->attach(client->name, write_frames, client.get(), m_opts.remote);
+            m_clients[fd] = std::move(client);
+        }
+    }
+
+    void Server::read_client(client_t *client)
+    {
+        while(!client->paused && !client->closing) {
+            // Grow the buffer to fit large frames
+            if(client->received == client->input.size()) {
+                if(client->input.size() >= m_opts.max_frame) {
+                    fprintf(stderr, "Frame from %s is too large\n", client->name.c_str());
+                    client->closing = true;
+                    return;
+                }
+
+                client->input.resize(std::min(client->input.size() * 2, m_opts.max_frame));
+            }
+
+            ssize_t count = read(
+                client->fd,
+                client->input.data() + client->received,
+                client->input.size() - client->received
+            );
+
+            if(count == 0) {
+                client->closing = true;
+                return;
+            }
+
+            if(count < 0) {
+                if(errno == EINTR)
+                    continue;
+
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    client->closing = true;
+
+                return;
+            }
+
+            client->received += count;
+
+            // Only decode once a frame is complete, so large frames are not rescanned
+            bool complete = false;
+            if(m_opts.format == Format::JSON) {
+                const uint8_t *start = client->input.data() + client->scanned;
+                complete = memchr(start, '\n', client->received - client->scanned) != nullptr;
+                client->scanned = client->received;
+            }
+            else if(client->received >= 4) {
+                const uint8_t *p = client->input.data();
+                size_t length = (size_t(p[0]) << 24) | (size_t(p[1]) << 16) | (size_t(p[2]) << 8) | p[3];
+                complete = (client->received >= length + 4);
+            }
+
+            if(!complete)
+                continue;
+
+            size_t consumed = 0;
+            try {
+                consumed = m_store->receive(client->input.data(), client->received, client->name);
+            }
+            catch(nlohmann::json::exception &e) {
+                fprintf(stderr, "Malformed frame from %s: %s\n", client->name.c_str(), e.what());
+                client->closing = true;
+                return;
+            }
+
+            // Keep the incomplete tail, which never holds a frame end
+            client->received -= consumed;
+            memmove(client->input.data(), client->input.data() + consumed, client->received);
+            client->scanned = client->received;
+
+            if(client->received == 0 && client->input.size() > INPUT_RETAIN) {
+                client->input.resize(INPUT_SIZE);
+                client->input.shrink_to_fit();
+            }
+        }
+    }
+
+    void Server::write_client(client_t *client)
+    {
+        while(!client->output.empty()) {
+            struct iovec iov[MAX_IOV];
+            int count = 0;
+            for(auto it = client->output.begin(); it != client->output.end() && count < MAX_IOV; ++it) {
+                size_t skip = (count == 0) ? client->offset : 0;
+                iov[count].iov_base = it->data() + skip;
+                iov[count].iov_len = it->size() - skip;
+                count += 1;
+            }
+
+            // sendmsg is writev with MSG_NOSIGNAL, a closed socket must not raise SIGPIPE
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = count;
+
+            ssize_t written = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+            if(written < 0) {
+                if(errno == EINTR)
+                    continue;
+
+                if(errno != EAGAIN && errno != EWOULDBLOCK)
+                    client->closing = true;
+
+                break;
+            }
+
+            client->queued -= written;
+            size_t remaining = written;
+            while(remaining > 0) {
+                size_t left = client->output.front().size() - client->offset;
+                if(remaining < left) {
+                    client->offset += remaining;
+                    break;
+                }
+
+                remaining -= left;
+                client->offset = 0;
+                client->output.pop_front();
+            }
+        }
+
+        // Resume reading once half the queue has drained
+        if(client->paused && client->queued <= m_opts.max_queued / 2)
+            client->paused = false;
+
+        update_events(client);
+
+        if(!client->paused && !client->closing)
+            read_client(client);
+    }
+
+    void Server::update_events(client_t *client)
+    {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = 0;
+        event.data.fd = client->fd;
+
+        if(!client->paused)
+            event.events |= EPOLLIN;
+
+        if(!client->output.empty())
+            event.events |= EPOLLOUT;
+
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, client->fd, &event);
+    }
+
+    void Server::drop_client(client_t *client)
+    {
+        int fd = client->fd;
+        std::string name = client->name;
+
+        epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+
+        // Nothing may write to the client while it is detached
+        client->closing = true;
+        m_store->detach(name);
+        m_clients.erase(fd);
+    }
+
+    void Server::disconnected(const std::string &, void *ctx)
+    {
+        // Closed by poll() once the store is done with it
+        static_cast<client_t*>(ctx)->closing = true;
+    }
+
+    int Server::write_frames(const uint8_t *data, size_t size, void *ctx)
+    {
+        client_t *client = static_cast<client_t*>(ctx);
+        if(client->closing)
+            return -EPIPE;
+
+        // Write straight to the socket while nothing is queued
+        size_t written = 0;
+        if(client->output.empty()) {
+            while(written < size) {
+                ssize_t count = send(client->fd, data + written, size - written, MSG_NOSIGNAL);
+                if(count < 0) {
+                    if(errno == EINTR)
+                        continue;
+
+                    if(errno != EAGAIN && errno != EWOULDBLOCK) {
+                        client->closing = true;
+                        return -errno;
+                    }
+
+                    break;
+                }
+
+                written += count;
+            }
+
+            if(written == size)
+                return 0;
+        }
+
+        // A full queue leaves the rest to the store, which applies its overflow policy
+        Server *server = client->server;
+        if(client->queued >= server->m_opts.max_queued) {
+            client->paused = true;
+            server->update_events(client);
+            return static_cast<int>(size - written);
+        }
+
+        client->output.emplace_back(data + written, data + size);
+        client->queued += size - written;
+
+        // Stop reading from a client that does not keep up
+        if(client->queued > server->m_opts.max_queued)
+            client->paused = true;
+
+        server->update_events(client);
+        return 0;
+    }
+
+    int TcpServer::listen(uint16_t port, const std::string &host)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+            return -errno;
+
+        int flags = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flags, sizeof(flags));
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = INADDR_ANY;
+
+        if(!host.empty() && inet_pton(AF_INET, host.c_str(), &addr.sin_addr) <= 0) {
+            close(fd);
+            return -EINVAL;
+        }
+
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+        || ::listen(fd, SOMAXCONN) < 0) {
+            int status = -errno;
+            close(fd);
+            return status;
+        }
+
+        socklen_t length = sizeof(addr);
+        if(getsockname(fd, (struct sockaddr*)&addr, &length) == 0)
+            m_port = ntohs(addr.sin_port);
+
+        return add_listener(fd);
+    }
+
+    UnixSocketServer::~UnixSocketServer()
+    {
+        for(const std::string &path : m_paths)
+            unlink(path.c_str());
+    }
+
+    int UnixSocketServer::listen(const std::string &path)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+
+        if(path.size() >= sizeof(addr.sun_path))
+            return -ENAMETOOLONG;
+
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0)
+            return -errno;
+
+        unlink(path.c_str());
+        if(bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0
+        || ::listen(fd, SOMAXCONN) < 0) {
+            int status = -errno;
+            close(fd);
+            return status;
+        }
+
+        m_paths.push_back(path);
+        return add_listener(fd);
+    }
+}
@@ -0,0 +1,367 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file ShmTransport.cpp
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "ShmTransport.h"
+
+/** Marks a fully initialized object, "ENTS". */
+static const uint32_t SHM_MAGIC = 0x454e5453;
+
+/** Layout version, bumped when the shared structures change. */
+static const uint32_t SHM_VERSION = 1;
+
+/** Space reserved for the header, keeps the rings cache line aligned. */
+static const size_t HEADER_SIZE = 64;
+
+/** Smallest ring accepted. */
+static const size_t MIN_CAPACITY = 4096;
+
+/** Bytes read from the ring per pass in pump(). */
+static const size_t PUMP_CHUNK = 64 * 1024;
+
+typedef std::chrono::steady_clock steady_clock;
+
+/** Hints to the CPU that we are spinning. */
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/** Sleeps until the word no longer holds value, a wake, or the deadline. */
+static void futex_wait(std::atomic<uint32_t> *word, uint32_t value, bool forever, steady_clock::time_point deadline)
+{
+    struct timespec ts;
+    if(!forever) {
+        auto remaining = deadline - steady_clock::now();
+        if(remaining <= steady_clock::duration::zero())
+            return;
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+    }
+
+    // Not FUTEX_PRIVATE, the word is shared with another process
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, value,
+        (forever) ? nullptr : &ts, nullptr, 0);
+}
+
+/** Wakes threads sleeping on the word. */
+static void futex_wake(std::atomic<uint32_t> *word, int count)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, count, nullptr, nullptr, 0);
+}
+
+namespace entangld
+{
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain integers");
+
+    ShmTransport::~ShmTransport()
+    {
+        close();
+    }
+
+    int ShmTransport::create(const std::string &name, const opts_t &opts)
+    {
+        close();
+
+        // Rings are indexed by masking, so the capacity is a power of two
+        uint64_t capacity = MIN_CAPACITY;
+        while(capacity < opts.capacity)
+            capacity <<= 1;
+
+        size_t size = HEADER_SIZE + 2 * (sizeof(ring_t) + capacity);
+
+        shm_unlink(name.c_str());
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0600);
+        if(fd < 0)
+            return -errno;
+
+        // ftruncate zero fills, which is the initial state of both rings
+        if(ftruncate(fd, size) < 0) {
+            int status = -errno;
+            ::close(fd);
+            shm_unlink(name.c_str());
+            return status;
+        }
+
+        int status = map(fd, size, true);
+        ::close(fd);
+        if(status < 0) {
+            shm_unlink(name.c_str());
+            return status;
+        }
+
+        m_opts = opts;
+        m_name = name;
+        m_creator = true;
+
+        header_t *header = static_cast<header_t*>(m_base);
+        header->version = SHM_VERSION;
+        header->capacity = capacity;
+        header->closed.store(0, std::memory_order_relaxed);
+        header->magic.store(SHM_MAGIC, std::memory_order_release);
+        return 0;
+    }
+
+    int ShmTransport::open(const std::string &name, const opts_t &opts)
+    {
+        close();
+
+        int fd = shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+        if(fd < 0)
+            return -errno;
+
+        struct stat st;
+        if(fstat(fd, &st) < 0) {
+            int status = -errno;
+            ::close(fd);
+            return status;
+        }
+
+        // The creator may not have sized it yet
+        if(size_t(st.st_size) < HEADER_SIZE) {
+            ::close(fd);
+            return -EAGAIN;
+        }
+
+        int status = map(fd, st.st_size, false);
+        ::close(fd);
+        if(status < 0)
+            return status;
+
+        header_t *header = static_cast<header_t*>(m_base);
+        if(header->magic.load(std::memory_order_acquire) != SHM_MAGIC) {
+            close();
+            return -EAGAIN;
+        }
+
+        if(header->version != SHM_VERSION
+        || m_size != HEADER_SIZE + 2 * (sizeof(ring_t) + header->capacity)) {
+            close();
+            return -EPROTO;
+        }
+
+        m_opts = opts;
+        m_name = name;
+        m_creator = false;
+        return 0;
+    }
+
+    int ShmTransport::map(int fd, size_t size, bool creator)
+    {
+        void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(base == MAP_FAILED)
+            return -errno;
+
+        m_base = base;
+        m_size = size;
+        m_capacity = (size - HEADER_SIZE) / 2 - sizeof(ring_t);
+
+        // The creator writes to the first ring and reads from the second
+        uint8_t *first = static_cast<uint8_t*>(base) + HEADER_SIZE;
+        uint8_t *second = first + sizeof(ring_t) + m_capacity;
+        m_tx = reinterpret_cast<ring_t*>((creator) ? first : second);
+        m_rx = reinterpret_cast<ring_t*>((creator) ? second : first);
+        return 0;
+    }
+
+    void ShmTransport::close()
+    {
+        if(m_base == nullptr)
+            return;
+
+        header_t *header = static_cast<header_t*>(m_base);
+        if(header->magic.load(std::memory_order_acquire) == SHM_MAGIC) {
+            header->closed.store(1, std::memory_order_seq_cst);
+
+            // Wake both sides so nothing sleeps on a dead peer
+            for(ring_t *ring : {m_tx, m_rx}) {
+                ring->data_seq.fetch_add(1, std::memory_order_seq_cst);
+                ring->space_seq.fetch_add(1, std::memory_order_seq_cst);
+                futex_wake(&ring->data_seq, INT_MAX);
+                futex_wake(&ring->space_seq, INT_MAX);
+            }
+        }
+
+        munmap(m_base, m_size);
+        if(m_creator)
+            shm_unlink(m_name.c_str());
+
+        m_base = nullptr;
+        m_size = 0;
+        m_capacity = 0;
+        m_creator = false;
+        m_tx = nullptr;
+        m_rx = nullptr;
+        m_input.clear();
+    }
+
+    int ShmTransport::write(const uint8_t *data, size_t size, void *ctx)
+    {
+        ShmTransport *shm = static_cast<ShmTransport*>(ctx);
+        if(shm->m_base == nullptr)
+            return -ENOTCONN;
+
+        const header_t *header = static_cast<header_t*>(shm->m_base);
+        ring_t *ring = shm->m_tx;
+        uint8_t *buffer = shm->ring_data(ring);
+        const uint64_t capacity = shm->m_capacity;
+
+        bool forever = (shm->m_opts.write_timeout_ms < 0);
+        steady_clock::time_point deadline = steady_clock::now()
+            + std::chrono::milliseconds(std::max(shm->m_opts.write_timeout_ms, 0));
+
+        size_t written = 0;
+        unsigned int spins = 0;
+        // Part of a frame is already in the ring, so leave the rest to a retry
+        while(written < size) {
+            if(header->closed.load(std::memory_order_acquire))
+                return (written > 0) ? static_cast<int>(size - written) : -ENOTCONN;
+
+            uint64_t head = ring->head.load(std::memory_order_relaxed);
+            uint64_t tail = ring->tail.load(std::memory_order_acquire);
+            uint64_t space = capacity - (head - tail);
+
+            if(space == 0) {
+                // Wait for the reader to make room
+                if(spins++ < shm->m_opts.spin) {
+                    cpu_relax();
+                    continue;
+                }
+
+                if(!forever && steady_clock::now() >= deadline)
+                    return (written > 0) ? static_cast<int>(size - written) : -ETIMEDOUT;
+
+                uint32_t seq = ring->space_seq.load(std::memory_order_seq_cst);
+                ring->writers.fetch_add(1, std::memory_order_seq_cst);
+                if(ring->tail.load(std::memory_order_seq_cst) == tail)
+                    futex_wait(&ring->space_seq, seq, forever, deadline);
+                ring->writers.fetch_sub(1, std::memory_order_seq_cst);
+                continue;
+            }
+
+            // Copy in at most two pieces around the end of the ring
+            size_t count = std::min<uint64_t>(space, size - written);
+            size_t offset = head & (capacity - 1);
+            size_t first = std::min<size_t>(count, capacity - offset);
+            memcpy(buffer + offset, data + written, first);
+            memcpy(buffer, data + written + first, count - first);
+
+            ring->head.store(head + count, std::memory_order_release);
+            written += count;
+            spins = 0;
+
+            // The increment is ordered before the check, so a reader about to sleep sees it
+            ring->data_seq.fetch_add(1, std::memory_order_seq_cst);
+            if(ring->readers.load(std::memory_order_seq_cst) > 0)
+                futex_wake(&ring->data_seq, 1);
+        }
+
+        return 0;
+    }
+
+    long ShmTransport::read(uint8_t *data, size_t size, int timeout_ms)
+    {
+        if(m_base == nullptr)
+            return -ENOTCONN;
+
+        const header_t *header = static_cast<header_t*>(m_base);
+        ring_t *ring = m_rx;
+        const uint8_t *buffer = ring_data(ring);
+
+        bool forever = (timeout_ms < 0);
+        steady_clock::time_point deadline = steady_clock::now()
+            + std::chrono::milliseconds(std::max(timeout_ms, 0));
+
+        uint64_t head, tail;
+        unsigned int spins = 0;
+        for(;;) {
+            head = ring->head.load(std::memory_order_acquire);
+            tail = ring->tail.load(std::memory_order_relaxed);
+            if(head != tail)
+                break;
+
+            // Only report a close once everything sent before it was read
+            if(header->closed.load(std::memory_order_acquire))
+                return -ECONNRESET;
+
+            if(timeout_ms == 0)
+                return 0;
+
+            if(spins++ < m_opts.spin) {
+                cpu_relax();
+                continue;
+            }
+
+            if(!forever && steady_clock::now() >= deadline)
+                return 0;
+
+            uint32_t seq = ring->data_seq.load(std::memory_order_seq_cst);
+            ring->readers.fetch_add(1, std::memory_order_seq_cst);
+            if(ring->head.load(std::memory_order_seq_cst) == tail)
+                futex_wait(&ring->data_seq, seq, forever, deadline);
+            ring->readers.fetch_sub(1, std::memory_order_seq_cst);
+        }
+
+        size_t count = std::min<uint64_t>(size, head - tail);
+        size_t offset = tail & (m_capacity - 1);
+        size_t first = std::min<size_t>(count, m_capacity - offset);
+        memcpy(data, buffer + offset, first);
+        memcpy(data + first, buffer, count - first);
+
+        ring->tail.store(tail + count, std::memory_order_release);
+
+        ring->space_seq.fetch_add(1, std::memory_order_seq_cst);
+        if(ring->writers.load(std::memory_order_seq_cst) > 0)
+            futex_wake(&ring->space_seq, 1);
+
+        return count;
+    }
+
+    long ShmTransport::pump(Datastore &store, const std::string &name, int timeout_ms)
+    {
+        long total = 0;
+        for(;;) {
+            // Only the first read waits, then take whatever else is ready
+            size_t used = m_input.size();
+            m_input.resize(used + PUMP_CHUNK);
+            long count = read(m_input.data() + used, PUMP_CHUNK, (total == 0) ? timeout_ms : 0);
+            m_input.resize(used + std::max(count, 0L));
+
+            if(count < 0)
+                return (total > 0) ? total : count;
+
+            if(count == 0)
+                return total;
+
+            total += count;
+
+            size_t consumed = store.receive(m_input.data(), m_input.size(), name);
+            m_input.erase(m_input.begin(), m_input.begin() + consumed);
+
+            if(size_t(count) < PUMP_CHUNK)
+                return total;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+/** Entangld - Synchronized key-value stores with RPCs and pub/sub events.
+ *
+ * @file Trace.h
+ * @author Wilkins White
+ * @copyright 2019 Nova Dynamics LLC
+ */
+
+#ifndef _ENTANGLD_TRACE_H_
+#define _ENTANGLD_TRACE_H_
+
+/** USDT tracepoints in the "entangld" provider.
+ *
+ * Built with ENTANGLD_TRACEPOINTS the probes below can be attached to by
+ * perf, bpftrace, SystemTap or LTTng while the process runs, and cost a
+ * nop otherwise.  Strings are passed as const char pointers:
+ *
+ *     get__start, get__done             (path, 0)
+ *     set__start, set__done             (path, push)
+ *     receive__start, receive__done     (remote, type)
+ *     transmit__start, transmit__done   (remote, type)
+ *
+ * For example, bpftrace -e 'usdt:./libentangld.so:entangld:set__start { @[str(arg0)] = count(); }'
+ */
+#ifdef ENTANGLD_TRACEPOINTS
+#include <sys/sdt.h>
+
+#define ENTANGLD_TRACE1(name, a) DTRACE_PROBE1(entangld, name, a)
+#define ENTANGLD_TRACE2(name, a, b) DTRACE_PROBE2(entangld, name, a, b)
+
+/** Fires name__start now and name__done when the enclosing scope exits. */
+#define ENTANGLD_TRACE_SCOPE(name, a, b) \
+    struct trace_##name##_t { \
+        decltype(a) m_a; \
+        decltype(b) m_b; \
+        trace_##name##_t(decltype(a) a_, decltype(b) b_) : m_a(a_), m_b(b_) { ENTANGLD_TRACE2(name##__start, m_a, m_b); } \
+        ~trace_##name##_t() { ENTANGLD_TRACE2(name##__done, m_a, m_b); } \
+    } trace_##name(a, b)
+#else
+/* Arguments are not evaluated when tracepoints are compiled out */
+#define ENTANGLD_TRACE1(name, a) do {} while(0)
+#define ENTANGLD_TRACE2(name, a, b) do {} while(0)
+#define ENTANGLD_TRACE_SCOPE(name, a, b) do {} while(0)
+#endif
+
+#endif /* _ENTANGLD_TRACE_H_ */
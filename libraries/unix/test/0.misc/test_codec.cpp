@@ -0,0 +1,99 @@
+#include <cassert>
+#include "Datastore.h"
+
+using namespace entangld;
+
+Datastore *store_a = nullptr;
+Datastore *store_b = nullptr;
+int writes = 0;
+
+/** Codec test - Messages survive encoding and byte transports. */
+int main()
+{
+    // Round trip in every format
+    Message msg;
+    msg.type = "set";
+    msg.path = "a.b";
+    msg.value = {{"x", 1}, {"y", {true, "z"}}};
+
+    for(Format format : {Format::JSON, Format::CBOR, Format::MSGPACK}) {
+        std::vector<uint8_t> data = encode(msg, format);
+        Message out = decode(data.data(), data.size(), format);
+        assert(out.type == "set");
+        assert(out.path == "a.b");
+        assert(out.value == msg.value);
+
+        // Incomplete frames are left for later
+        std::vector<uint8_t> framed;
+        frame(msg, format, framed);
+        frame(msg, format, framed);
+
+        Message first;
+        assert(unframe(framed.data(), framed.size() / 2 - 1, format, first) == 0);
+        size_t count = unframe(framed.data(), framed.size(), format, first);
+        assert(count == framed.size() / 2);
+        assert(first.value == msg.value);
+    }
+
+    store_a = new Datastore;
+    store_b = new Datastore;
+
+    // Both stores speak CBOR, store_a writes up to 64 bytes at a time
+    store_a->attach(
+        "store_b",
+        [](const uint8_t *data, size_t size, void*) {
+            writes += 1;
+            assert(store_b->receive(data, size, "store_a") == size);
+            return 0;
+        },
+        nullptr,
+        Datastore::remote_opts_t(0, 64, Format::CBOR)
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const uint8_t *data, size_t size, void*) {
+            assert(store_a->receive(data, size, "store_b") == size);
+            return 0;
+        },
+        nullptr,
+        Datastore::remote_opts_t(0, 0, Format::CBOR)
+    );
+
+    // Held until the byte budget is reached
+    store_a->set("store_b.small", 1);
+    assert(writes == 0);
+
+    store_a->set("store_b.large", std::string(64, 'x'));
+    assert(writes == 1);
+
+    store_a->set("store_b.small", 2);
+    assert(writes == 1);
+    store_a->flush();
+    assert(writes == 2);
+
+    bool replied = false;
+    store_a->get("store_b.small", [](const Message &msg, void *ctx){
+        assert(msg.value == 2);
+        *static_cast<bool*>(ctx) = true;
+    }, &replied);
+
+    store_a->flush();
+    assert(replied);
+
+    // Bytes may arrive split anywhere
+    std::vector<uint8_t> framed;
+    frame(msg, Format::CBOR, framed);
+
+    size_t half = framed.size() / 2;
+    assert(store_b->receive(framed.data(), half, "store_a") == 0);
+    assert(store_b->receive(framed.data(), framed.size(), "store_a") == framed.size());
+
+    store_b->get("a.b.x", [](const Message &msg, void*){
+        assert(msg.value == 1);
+    });
+
+    delete store_a;
+    delete store_b;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+#include <atomic>
+#include <cassert>
+#include <thread>
+#include <vector>
+#include "Datastore.h"
+
+using namespace entangld;
+
+const int THREADS = 4;
+const int WRITES = 1000;
+
+std::atomic<int> events(0);
+std::atomic<int> values(0);
+std::atomic<int> frames(0);
+
+/** Concurrency test - a store shared by reader and writer threads. */
+int main()
+{
+    Datastore *store_a = new Datastore;
+    Datastore *store_b = new Datastore;
+
+    // Replies from store_b arrive on whichever thread drains its queue
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            frames += 1;
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+        },
+        store_b
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(nlohmann::json(msg).get<Message>(), "store_b");
+        },
+        store_a
+    );
+
+    store_a->subscribe("data", [](const Message&, void*){
+        events += 1;
+    });
+
+    std::vector<std::thread> threads;
+    for(int t = 0; t < THREADS; ++t) {
+        // Writers
+        threads.emplace_back([store_a, t]() {
+            Path path("data.writer" + std::to_string(t));
+            for(int i = 0; i < WRITES; ++i)
+                store_a->set(path, i);
+        });
+
+        // Local and remote readers
+        threads.emplace_back([store_a, t]() {
+            for(int i = 0; i < WRITES; ++i) {
+                store_a->get("data.writer" + std::to_string(t), [](const Message &msg, void*){
+                    assert(msg.type == "value");
+                    values += 1;
+                });
+
+                if(i % 10 == 0) {
+                    store_a->set("store_b.count", i);
+                    store_a->get("store_b.count", [](const Message &msg, void*){
+                        assert(msg.type == "value");
+                        values += 1;
+                    });
+                }
+            }
+        });
+    }
+
+    for(std::thread &thread : threads)
+        thread.join();
+
+    assert(events == THREADS * WRITES);
+    assert(values == THREADS * (WRITES + WRITES / 10));
+
+    // Every set is sent, gets in flight together share one request
+    assert(frames > THREADS * (WRITES / 10));
+    assert(frames <= THREADS * (WRITES / 10) * 2);
+    assert(store_a->pending_requests() == 0);
+
+    for(int t = 0; t < THREADS; ++t) {
+        store_a->get("data.writer" + std::to_string(t), [](const Message &msg, void*){
+            assert(msg.value == WRITES - 1);
+        });
+    }
+
+    delete store_a;
+    delete store_b;
+    return EXIT_SUCCESS;
+}
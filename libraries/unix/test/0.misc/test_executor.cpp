@@ -0,0 +1,204 @@
+#include <cassert>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "Datastore.h"
+
+using namespace entangld;
+
+std::mutex mutex;
+std::vector<int> received[2];
+
+/** Holds tasks until run() is called from the thread using the store. */
+class queue_executor_t : public Executor {
+    public:
+        void post(task_t &&task, const void*) override
+        {
+            tasks.push_back(std::move(task));
+        }
+
+        bool single_threaded() const override { return true; };
+
+        /** Runs tasks until none are left, including those they post. */
+        void run()
+        {
+            while(!tasks.empty()) {
+                std::vector<task_t> queued;
+                std::swap(queued, tasks);
+                for(task_t &task : queued)
+                    task();
+            }
+        }
+
+        std::vector<task_t> tasks;
+};
+
+/** Executor test - handlers run off the calling thread, in order per remote. */
+int main()
+{
+    // Callables can capture their context
+    {
+        Datastore store;
+        store.set("a", 1);
+
+        int value = 0;
+        store.get("a", [&value](const Message &msg) {
+            value = msg.value;
+        });
+        assert(value == 1);
+
+        int events = 0;
+        store.subscribe("a", [&events](const Message&) {
+            events += 1;
+        });
+        store.set("a", 2);
+        assert(events == 1);
+    }
+
+#ifdef ENTANGLD_CONCURRENT
+    // Dedicated dispatcher thread
+    {
+        Datastore store;
+        std::thread::id caller = std::this_thread::get_id();
+        std::thread::id handler;
+
+        {
+            ThreadExecutor executor;
+            store.set_executor(&executor);
+
+            store.attach("remote", [](const Message &msg, void *ctx) {
+                *static_cast<std::thread::id*>(ctx) = std::this_thread::get_id();
+                std::lock_guard<std::mutex> lock(mutex);
+                received[0].push_back(msg.value);
+            }, &handler);
+
+            for(int i = 0; i < 100; ++i)
+                store.set("remote.value", i);
+
+            // Runs what was posted before joining
+        }
+
+        store.set_executor(nullptr);
+        assert(handler != caller);
+        assert(received[0].size() == 100);
+        for(int i = 0; i < 100; ++i)
+            assert(received[0][i] == i);
+    }
+
+    // User thread pool, run out of order across several threads
+    {
+        received[0].clear();
+        std::vector<Executor::task_t> jobs;
+        PoolExecutor executor([&jobs](Executor::task_t &&job) {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(std::move(job));
+        });
+
+        Datastore store;
+        store.set_executor(&executor);
+
+        for(int r = 0; r < 2; ++r) {
+            store.attach("remote" + std::to_string(r), [](const Message &msg, void *ctx) {
+                std::vector<int> *list = static_cast<std::vector<int>*>(ctx);
+                std::lock_guard<std::mutex> lock(mutex);
+                list->push_back(msg.value);
+            }, &received[r]);
+        }
+
+        for(int i = 0; i < 50; ++i) {
+            store.set("remote0.value", i);
+            store.set("remote1.value", i);
+        }
+
+        // One job per idle strand
+        assert(jobs.size() == 2);
+
+        std::vector<std::thread> threads;
+        for(Executor::task_t &job : jobs)
+            threads.emplace_back(job);
+
+        for(std::thread &thread : threads)
+            thread.join();
+
+        for(int r = 0; r < 2; ++r) {
+            assert(received[r].size() == 50);
+            for(int i = 0; i < 50; ++i)
+                assert(received[r][i] == i);
+        }
+    }
+#else
+    // Without locking, tasks may not run on other threads
+    {
+        Datastore store;
+        ThreadExecutor executor;
+        assert(!store.set_executor(&executor));
+
+        InlineExecutor inline_executor;
+        assert(store.set_executor(&inline_executor));
+        assert(store.set_executor(nullptr));
+    }
+#endif
+
+    // A throwing task is reported, and later tasks still run
+    {
+        bool ran = false;
+        {
+            ThreadExecutor executor;
+            executor.post([]() { throw std::runtime_error("thread task"); }, nullptr);
+            executor.post([&ran]() { ran = true; }, nullptr);
+        }
+        assert(ran);
+
+        std::vector<Executor::task_t> jobs;
+        PoolExecutor executor([&jobs](Executor::task_t &&job) {
+            jobs.push_back(std::move(job));
+        });
+
+        int runs = 0;
+        executor.post([]() { throw std::runtime_error("pool task"); }, &runs);
+        executor.post([&runs]() { runs += 1; }, &runs);
+        assert(jobs.size() == 1);
+        jobs[0]();
+        assert(runs == 1);
+
+        // The strand was released, so the next task starts a new job
+        executor.post([&runs]() { runs += 1; }, &runs);
+        assert(jobs.size() == 2);
+        jobs[1]();
+        assert(runs == 2);
+    }
+
+    // Replies and events queued for a remote are dropped once it detaches
+    {
+        queue_executor_t executor;
+        Datastore store;
+        store.set("a", 1);
+        assert(store.set_executor(&executor));
+
+        int delivered = 0;
+        store.attach("remote", [](const Message&, void *ctx) {
+            *static_cast<int*>(ctx) += 1;
+        }, &delivered);
+
+        Message msg;
+        msg.path = "a";
+        msg.type = "subscribe";
+        msg.uuid = "event";
+        store.receive(msg, "remote");
+
+        msg.type = "get";
+        msg.uuid = "reply";
+        store.receive(msg, "remote");
+        store.set("a", 2);
+        assert(!executor.tasks.empty());
+
+        store.detach("remote");
+        executor.run();
+
+        store.set_executor(nullptr);
+        assert(delivered == 0);
+    }
+
+    return EXIT_SUCCESS;
+}
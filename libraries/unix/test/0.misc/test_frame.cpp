@@ -0,0 +1,172 @@
+#include <cassert>
+#include <stdexcept>
+#include <string>
+
+#include "FrameReader.h"
+
+using namespace entangld;
+
+/** Returns true if two Messages hold the same fields. */
+static bool same(const Message &a, const Message &b)
+{
+    return a.type == b.type && a.path == b.path && a.uuid == b.uuid && a.value == b.value
+        && a.params == b.params && a.every == b.every && a.revision == b.revision;
+}
+
+/** Checks that decode() reads text exactly as from_json(Message) does. */
+static void check_decode(const std::string &text)
+{
+    Message expected = nlohmann::json::parse(text).get<Message>();
+    Message decoded = decode(reinterpret_cast<const uint8_t*>(text.data()), text.size(), Format::JSON);
+    assert(same(decoded, expected));
+
+    for(Format format : {Format::CBOR, Format::MSGPACK}) {
+        std::vector<uint8_t> data = (format == Format::CBOR)
+            ? nlohmann::json::to_cbor(nlohmann::json::parse(text))
+            : nlohmann::json::to_msgpack(nlohmann::json::parse(text));
+
+        assert(same(decode(data.data(), data.size(), format), expected));
+    }
+}
+
+/** Returns true if decoding text throws. */
+static bool rejected(const std::string &text)
+{
+    try {
+        decode(reinterpret_cast<const uint8_t*>(text.data()), text.size(), Format::JSON);
+    }
+    catch(nlohmann::json::exception&) {
+        return true;
+    }
+
+    return false;
+}
+
+/** Frame reader test - streamed frames and the SAX decoder. */
+int main()
+{
+    // The SAX decoder matches the DOM decoder
+    check_decode(R"({"type":"get","path":"a.b","uuid":"1234","every":3,"revision":7})");
+    check_decode(R"({"type":"set","path":"a","value":{"x":[1,2.5,{"y":null}],"z":"w"}})");
+    check_decode(R"({"type":"subscribe","path":{"path":"a","uuid":"1"},"params":{"delta":true}})");
+    check_decode(R"({"type":"event","uuid":null,"every":null,"revision":-1,"value":false})");
+    check_decode(R"({"unknown":{"a":[1,{"b":2}]},"type":"value","value":[[],{}],"extra":3})");
+    check_decode(R"({"type":"set","uuid":"a","uuid":{"b":1},"value":1,"value":2})");
+    check_decode(R"([{"type":"set","path":"a","value":1},{"type":"set","path":"b","value":2}])");
+
+    // Errors are those of from_json(Message)
+    assert(rejected(R"({"path":"a"})"));
+    assert(rejected(R"({"type":1})"));
+    assert(rejected(R"({"type":{"a":1}})"));
+    assert(rejected(R"("set")"));
+    assert(rejected(R"({"type":"set")"));
+
+    // Reusing a Message clears the fields a frame does not carry
+    Message msg;
+    msg.params = {{"stale", true}};
+    msg.every = 4;
+    const std::string bare = R"({"type":"get","path":"a"})";
+    decode(reinterpret_cast<const uint8_t*>(bare.data()), bare.size(), Format::JSON, msg);
+    assert(msg.params.is_null());
+    assert(msg.every == 0);
+
+    // Frames split across every read, past the old 2 KB limit
+    Message large;
+    large.type = "set";
+    large.path = "blob";
+    large.uuid = "5678";
+    large.value = std::string(10000, 'x');
+
+    Message small;
+    small.type = "get";
+    small.path = "a";
+
+    for(Format format : {Format::JSON, Format::CBOR, Format::MSGPACK}) {
+        std::vector<uint8_t> stream;
+        frame(large, format, stream);
+        frame(small, format, stream);
+        if(format == Format::JSON)
+            stream.insert(stream.end(), {'\n', '\n'});
+        frame(large, format, stream);
+
+        FrameReader reader(format);
+        std::vector<Message> received;
+        for(uint8_t byte : stream) {
+            reader.append(&byte, 1);
+            while(reader.next(msg))
+                received.push_back(msg);
+        }
+
+        assert(received.size() == 3);
+        assert(same(received[0], large));
+        assert(same(received[1], small));
+        assert(same(received[2], large));
+        assert(reader.buffered() == 0);
+
+        // Reading straight into the buffer, a trailing partial frame is kept
+        std::vector<uint8_t> partial;
+        frame(small, format, partial);
+        frame(large, format, partial);
+        partial.resize(partial.size() - 10);
+
+        uint8_t *space = reader.prepare(partial.size());
+        std::copy(partial.begin(), partial.end(), space);
+        reader.commit(partial.size());
+
+        assert(reader.next(msg));
+        assert(same(msg, small));
+        assert(!reader.next(msg));
+        assert(reader.buffered() > 0);
+
+        reader.clear();
+        assert(reader.buffered() == 0);
+    }
+
+    // A malformed frame is skipped
+    FrameReader reader;
+    const std::string text = "{\"type\":\n{\"type\":\"get\",\"path\":\"a\"}\n";
+    reader.append(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+
+    bool thrown = false;
+    try {
+        reader.next(msg);
+    }
+    catch(nlohmann::json::exception&) {
+        thrown = true;
+    }
+
+    assert(thrown);
+    assert(reader.next(msg));
+    assert(msg.type == "get");
+
+    // Frames over max_frame are refused before they complete
+    FrameReader bounded(Format::JSON, 16);
+    const std::string endless(32, ' ');
+    bounded.append(reinterpret_cast<const uint8_t*>(endless.data()), endless.size());
+
+    thrown = false;
+    try {
+        bounded.next(msg);
+    }
+    catch(std::length_error&) {
+        thrown = true;
+    }
+
+    assert(thrown);
+
+    FrameReader binary(Format::CBOR, 16);
+    const uint8_t prefix[] = {0, 0, 1, 0};
+    binary.append(prefix, sizeof(prefix));
+
+    thrown = false;
+    try {
+        binary.next(msg);
+    }
+    catch(std::length_error&) {
+        thrown = true;
+    }
+
+    assert(thrown);
+
+    return EXIT_SUCCESS;
+}
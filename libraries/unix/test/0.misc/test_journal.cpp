@@ -0,0 +1,193 @@
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Datastore.h"
+#include "Journal.h"
+
+using namespace entangld;
+
+/** Returns the local data of a store. */
+nlohmann::json dump(Datastore &store)
+{
+    nlohmann::json data;
+    store.visit([&](const nlohmann::json &local){ data = local; });
+    return data;
+}
+
+/** Returns the size of a file. */
+size_t file_size(const std::string &path)
+{
+    struct stat st;
+    assert(stat(path.c_str(), &st) == 0);
+    return st.st_size;
+}
+
+/** Copies a file. */
+void copy_file(const std::string &from, const std::string &to)
+{
+    FILE *in = fopen(from.c_str(), "rb");
+    FILE *out = fopen(to.c_str(), "wb");
+    assert(in != nullptr && out != nullptr);
+
+    char buffer[4096];
+    size_t count;
+    while((count = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        fwrite(buffer, 1, count, out);
+
+    fclose(in);
+    fclose(out);
+}
+
+/** Journal test - restoring, compacting and recovering a store. */
+int main(int argc, char *argv[])
+{
+    char temp[] = "/tmp/entangld_journal_XXXXXX";
+    assert(mkdtemp(temp) != nullptr);
+    std::string dir = temp;
+    std::string log = dir + "/log";
+
+    nlohmann::json expected;
+    {
+        Datastore store({
+            {"name", "Bruce"},
+            {"occupation", "Batman"}
+        });
+
+        Journal journal;
+        assert(journal.open(dir, store) == 0);
+        assert(journal.open(dir, store) == -EBUSY);
+
+        store.set("name", "Batman");
+        store.set("gadgets.belt", {{"batarangs", 12}});
+        store.push("log", "patrol");
+        store.push("log", "rescue");
+
+        // A full window logs the pushed element, not the whole window
+        size_t record = 0;
+        for(int i = 0; i < 20; ++i) {
+            size_t before = journal.log_size();
+            store.push("window", i, 4);
+            if(i == 0)
+                record = journal.log_size() - before;
+
+            assert(journal.log_size() - before == record);
+        }
+        assert(dump(store).at("window") == nlohmann::json({16, 17, 18, 19}));
+        assert(journal.flush() == 0);
+        assert(file_size(log) == journal.log_size());
+
+        // Closing writes out whatever is still pending
+        store.set("gadgets.belt.batarangs", 11);
+        expected = dump(store);
+    }
+
+    // A new store is rebuilt from the log
+    {
+        Datastore store({
+            {"name", "Bruce"},
+            {"occupation", "Batman"}
+        });
+
+        Journal journal;
+        assert(journal.open(dir, store) == 0);
+        assert(dump(store) == expected);
+
+        // Compacting replaces the log with a snapshot
+        for(int i = 0; i < 100; ++i)
+            store.set("counter", i);
+
+        size_t before = journal.log_size();
+        assert(journal.compact() == 0);
+        assert(journal.log_size() < before);
+        assert(file_size(log) == journal.log_size());
+
+        store.push("log", "report");
+        expected = dump(store);
+        assert(journal.flush() == 0);
+    }
+
+    // The snapshot replaces what the store was constructed with
+    {
+        Datastore store({
+            {"name", "Alfred"},
+            {"occupation", "Butler"}
+        });
+
+        Journal journal;
+        assert(journal.open(dir, store) == 0);
+        assert(dump(store) == expected);
+        assert(dump(store).at("log").size() == 3);
+    }
+
+    // A torn record at the end of the log is discarded
+    size_t good = file_size(log);
+    {
+        FILE *file = fopen(log.c_str(), "ab");
+        assert(file != nullptr);
+        const unsigned char torn[] = {0x00, 0x00, 0x00, 0x40, 0xa3, 0x64, 't'};
+        fwrite(torn, 1, sizeof(torn), file);
+        fclose(file);
+
+        Datastore store;
+        Journal journal;
+        assert(journal.open(dir, store) == 0);
+        assert(dump(store) == expected);
+        assert(file_size(log) == good);
+
+        // Corrupt records fail their checksum
+        store.set("status", "idle");
+        store.set("status", "busy");
+        assert(journal.flush() == 0);
+        journal.close();
+
+        FILE *patch = fopen(log.c_str(), "r+b");
+        assert(patch != nullptr);
+        fseek(patch, -6, SEEK_END);
+        fputc('x', patch);
+        fclose(patch);
+    }
+
+    {
+        Datastore store;
+        Journal journal;
+        assert(journal.open(dir, store) == 0);
+        assert(dump(store).at("status") == "idle");
+    }
+
+    // A crash between writing a snapshot and the new log replays nothing twice
+    {
+        Datastore store;
+        Journal journal;
+        assert(journal.open(dir, store) == 0);
+        store.push("log", "before");
+        assert(journal.flush() == 0);
+
+        std::string saved = dir + "/log.saved";
+        copy_file(log, saved);
+
+        assert(journal.compact() == 0);
+        journal.close();
+        assert(rename(saved.c_str(), log.c_str()) == 0);
+
+        expected = dump(store);
+    }
+
+    {
+        Datastore store;
+        Journal journal;
+        assert(journal.open(dir, store) == 0);
+        assert(dump(store) == expected);
+    }
+
+    unlink((dir + "/snapshot").c_str());
+    unlink(log.c_str());
+    rmdir(dir.c_str());
+
+    return EXIT_SUCCESS;
+}
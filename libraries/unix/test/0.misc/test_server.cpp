@@ -0,0 +1,211 @@
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "Datastore.h"
+#include "Server.h"
+
+using namespace entangld;
+
+/** A store connected to the server over a socket. */
+struct client_t {
+    int fd;
+    Datastore store;
+    std::string outbox;
+    std::vector<uint8_t> inbox;
+
+    client_t(int fd, const nlohmann::json &data) : fd(fd), store(data)
+    {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        store.attach("server", [](const uint8_t *data, size_t size, void *ctx) {
+            client_t *client = static_cast<client_t*>(ctx);
+            client->outbox.append((const char*)data, size);
+            return 0;
+        }, this);
+    }
+
+    ~client_t()
+    {
+        store.detach("server");
+        if(fd >= 0)
+            close(fd);
+    }
+
+    /** Writes what the socket accepts and processes what it received. */
+    void pump()
+    {
+        if(fd < 0)
+            return;
+
+        while(!outbox.empty()) {
+            ssize_t count = send(fd, outbox.data(), outbox.size(), MSG_NOSIGNAL);
+            if(count <= 0)
+                break;
+
+            outbox.erase(0, count);
+        }
+
+        uint8_t buffer[4096];
+        ssize_t count;
+        while((count = read(fd, buffer, sizeof(buffer))) > 0) {
+            inbox.insert(inbox.end(), buffer, buffer + count);
+            size_t consumed = store.receive(inbox.data(), inbox.size(), "server");
+            inbox.erase(inbox.begin(), inbox.begin() + consumed);
+        }
+    }
+};
+
+/** Services the servers and clients until done() or a second passes. */
+bool run(std::vector<Server*> servers, std::vector<client_t*> clients, std::function<bool()> done)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while(!done()) {
+        if(std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        for(client_t *client : clients)
+            client->pump();
+
+        for(Server *server : servers)
+            server->poll(1);
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    Datastore store({
+        {"name", "server"},
+        {"occupation", "Switchboard"}
+    });
+
+    TcpServer tcp_server(&store);
+    assert(tcp_server.listen(0, "127.0.0.1") == 0);
+    assert(tcp_server.port() != 0);
+
+    Server::opts_t opts;
+    opts.prefix = "local";
+    UnixSocketServer unix_server(&store, opts);
+
+    std::string path = "/tmp/entangld_test_" + std::to_string(getpid()) + ".sock";
+    assert(unix_server.listen(path) == 0);
+
+    std::vector<Server*> servers = {&tcp_server, &unix_server};
+
+    // Connect one client to each server
+    int tcp_fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in tcp_addr;
+    memset(&tcp_addr, 0, sizeof(tcp_addr));
+    tcp_addr.sin_family = AF_INET;
+    tcp_addr.sin_port = htons(tcp_server.port());
+    inet_pton(AF_INET, "127.0.0.1", &tcp_addr.sin_addr);
+    assert(connect(tcp_fd, (struct sockaddr*)&tcp_addr, sizeof(tcp_addr)) == 0);
+
+    int unix_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un unix_addr;
+    memset(&unix_addr, 0, sizeof(unix_addr));
+    unix_addr.sun_family = AF_UNIX;
+    strncpy(unix_addr.sun_path, path.c_str(), sizeof(unix_addr.sun_path) - 1);
+    assert(connect(unix_fd, (struct sockaddr*)&unix_addr, sizeof(unix_addr)) == 0);
+
+    client_t *alfred = new client_t(tcp_fd, {{"name", "Alfred"}, {"occupation", "Butler"}});
+    client_t *bruce = new client_t(unix_fd, {{"name", "Bruce"}, {"occupation", "Batman"}});
+    std::vector<client_t*> clients = {alfred, bruce};
+
+    assert(run(servers, clients, [&]{ return tcp_server.clients() == 1 && unix_server.clients() == 1; }));
+    assert(tcp_server.names() == std::vector<std::string>{"client1"});
+    assert(unix_server.names() == std::vector<std::string>{"local1"});
+
+    // Get from the server
+    std::string name;
+    alfred->store.get("server.name", [&](const Message &msg){ name = msg.value; });
+    assert(run(servers, clients, [&]{ return name == "server"; }));
+
+    // Get from another client through the server
+    name.clear();
+    alfred->store.get("server.local1.name", [&](const Message &msg){ name = msg.value; });
+    assert(run(servers, clients, [&]{ return name == "Bruce"; }));
+
+    // Subscribe to another client through the server
+    std::string status;
+    alfred->store.subscribe("server.local1.status", [&](const Message &msg){ status = msg.value; });
+
+    // A get takes the same path, so its reply means the subscription arrived
+    name.clear();
+    alfred->store.get("server.local1.name", [&](const Message &msg){ name = msg.value; });
+    assert(run(servers, clients, [&]{ return name == "Bruce"; }));
+
+    bruce->store.set("status", "ok");
+    assert(run(servers, clients, [&]{ return status == "ok"; }));
+
+    // Frames larger than a socket read are reassembled
+    std::string blob(200 * 1024, 'x');
+    bruce->store.set("server.blob", blob);
+
+    size_t received = 0;
+    assert(run(servers, clients, [&]{
+        store.get("blob", [&](const Message &msg){
+            if(msg.value.is_string())
+                received = msg.value.get<std::string>().size();
+        });
+        return received == blob.size();
+    }));
+
+    // Disconnecting one client only detaches its namespace
+    close(bruce->fd);
+    bruce->fd = -1;
+    assert(run(servers, clients, [&]{ return unix_server.clients() == 0; }));
+    assert(tcp_server.clients() == 1);
+
+    name.clear();
+    alfred->store.get("server.name", [&](const Message &msg){ name = msg.value; });
+    assert(run(servers, clients, [&]{ return name == "server"; }));
+
+    // A client the store disconnects for overflowing is closed
+    Server::opts_t slow_opts;
+    slow_opts.prefix = "slow";
+    slow_opts.remote.max_queue = 1;
+    slow_opts.remote.overflow = Datastore::overflow_t::DISCONNECT;
+    UnixSocketServer slow_server(&store, slow_opts);
+
+    std::string slow_path = path + ".slow";
+    assert(slow_server.listen(slow_path) == 0);
+
+    int slow_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    strncpy(unix_addr.sun_path, slow_path.c_str(), sizeof(unix_addr.sun_path) - 1);
+    assert(connect(slow_fd, (struct sockaddr*)&unix_addr, sizeof(unix_addr)) == 0);
+
+    client_t *selina = new client_t(slow_fd, {{"name", "Selina"}});
+    clients.push_back(selina);
+    servers.push_back(&slow_server);
+
+    assert(run(servers, clients, [&]{ return slow_server.clients() == 1; }));
+
+    store.set_blocked("slow1", true);
+    store.set("slow1.x", 1);
+    store.set("slow1.y", 2);
+
+    // Requests still arriving from the peer do not keep it open
+    selina->store.get("server.name", [](const Message&){});
+    assert(run(servers, clients, [&]{ return slow_server.clients() == 0; }));
+    assert(store.queue_stats("slow1").dropped == 0);
+    assert(tcp_server.clients() == 1);
+
+    delete alfred;
+    delete bruce;
+    delete selina;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "Datastore.h"
+#include "ShmTransport.h"
+
+using namespace entangld;
+
+/** Pumps the transport until done() or a second passes. */
+bool run(ShmTransport &shm, Datastore &store, std::function<bool()> done)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while(!done()) {
+        if(std::chrono::steady_clock::now() > deadline)
+            return false;
+
+        if(shm.pump(store, "child", 10) < 0)
+            return false;
+    }
+
+    return true;
+}
+
+/** Serves a store to the parent until it sets quit. */
+int child_main(const std::string &name)
+{
+    ShmTransport shm;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while(shm.open(name) < 0) {
+        if(std::chrono::steady_clock::now() > deadline)
+            return EXIT_FAILURE;
+
+        usleep(1000);
+    }
+
+    Datastore store({
+        {"name", "Bruce"},
+        {"occupation", "Batman"}
+    });
+
+    store.attach("parent", ShmTransport::write, &shm, Datastore::remote_opts_t(0, 0, Format::CBOR));
+
+    bool quit = false;
+    store.subscribe("quit", [&](const Message&){ quit = true; });
+
+    while(!quit) {
+        if(shm.pump(store, "parent", 100) < 0)
+            return EXIT_FAILURE;
+    }
+
+    // Tell the parent everything before the quit was handled
+    store.set("parent.done", true);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string name = "/entangld_test_" + std::to_string(getpid());
+
+    // Small rings, so large frames have to wrap and be split
+    ShmTransport shm;
+    assert(shm.create(name, ShmTransport::opts_t(16 * 1024)) == 0);
+    assert(shm.is_open());
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if(pid == 0)
+        _exit(child_main(name));
+
+    Datastore store({
+        {"name", "Alfred"},
+        {"occupation", "Butler"}
+    });
+
+    store.attach("child", ShmTransport::write, &shm, Datastore::remote_opts_t(0, 0, Format::CBOR));
+
+    // Get from the other process
+    std::string value;
+    store.get("child.name", [&](const Message &msg){ value = msg.value; });
+    assert(run(shm, store, [&]{ return value == "Bruce"; }));
+
+    // Subscribe to the other process
+    std::string status;
+    store.subscribe("child.status", [&](const Message &msg){ status = msg.value; });
+    store.set("child.status", "ready");
+    assert(run(shm, store, [&]{ return status == "ready"; }));
+
+    // Frames larger than the ring are written as it drains
+    std::string blob(100 * 1024, 'x');
+    store.set("child.blob", blob);
+
+    size_t received = 0;
+    store.get("child.blob", [&](const Message &msg){ received = msg.value.get<std::string>().size(); });
+    assert(run(shm, store, [&]{ return received == blob.size(); }));
+
+    bool done = false;
+    store.subscribe("done", [&](const Message&){ done = true; });
+    store.set("child.quit", true);
+    assert(run(shm, store, [&]{ return done; }));
+
+    int wstatus = 0;
+    assert(waitpid(pid, &wstatus, 0) == pid);
+    assert(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_SUCCESS);
+
+    // Closing the other side is reported once its data was read
+    uint8_t byte;
+    assert(shm.read(&byte, 1, 0) == -ECONNRESET);
+
+    // A write that times out part way reports the bytes it did not write
+    ShmTransport writer;
+    ShmTransport reader;
+    assert(writer.create(name + "_partial", ShmTransport::opts_t(4096, 0, 0)) == 0);
+    assert(reader.open(name + "_partial") == 0);
+
+    std::vector<uint8_t> frame(10000, 'y');
+    assert(ShmTransport::write(frame.data(), frame.size(), &writer) == int(frame.size() - 4096));
+    assert(ShmTransport::write(frame.data(), 1, &writer) == -ETIMEDOUT);
+
+    std::vector<uint8_t> drained(4096);
+    assert(reader.read(drained.data(), drained.size(), 0) == 4096);
+    assert(ShmTransport::write(frame.data(), 1000, &writer) == 0);
+
+    return EXIT_SUCCESS;
+}
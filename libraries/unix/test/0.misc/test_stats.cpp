@@ -0,0 +1,151 @@
+#include <cassert>
+#include <thread>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Statistics test - counters, traffic and latency histograms. */
+int main()
+{
+    Datastore *store_a = new Datastore({
+        {"name", "Alfred"},
+        {"occupation", "Butler"}
+    });
+
+    Datastore *store_b = new Datastore({
+        {"name", "Bruce"},
+        {"occupation", "Batman"},
+    });
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(msg, "store_a");
+        },
+        store_b
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(msg, "store_b");
+        },
+        store_a
+    );
+
+    // Histogram buckets double from 1us
+    Datastore::histogram_t histogram;
+    assert(histogram.percentile(50) == 0);
+    histogram.record(500);
+    histogram.record(1500);
+    histogram.record(3000);
+    histogram.record(uint64_t(60) * 1000 * 1000 * 1000);
+    assert(histogram.count == 4);
+    assert(histogram.buckets[0] == 1);
+    assert(histogram.buckets[1] == 1);
+    assert(histogram.buckets[2] == 1);
+    assert(histogram.buckets[Datastore::histogram_t::BUCKETS - 1] == 1);
+    assert(histogram.max_ns == uint64_t(60) * 1000 * 1000 * 1000);
+    assert(histogram.percentile(0) == 1000);
+    assert(histogram.percentile(50) == 4000);
+    assert(histogram.percentile(100) == histogram.max_ns);
+
+    Datastore::stats_t stats = store_a->stats();
+    assert(stats.gets == 0);
+    assert(stats.sets == 0);
+    assert(stats.remotes.empty());
+
+    // Local subscriptions time their callbacks per path
+    store_a->subscribe("name", [](const Message&){
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    });
+    store_a->subscribe("occupation", [](const Message&){});
+
+    store_a->set("name", "Jarvis");
+    store_a->set("occupation", "AI");
+    store_a->set("occupation", "Assistant");
+    store_a->push("list", 1);
+
+    int values = 0;
+    store_a->get("name", [&](const Message &msg){
+        assert(msg.value == "Jarvis");
+        values += 1;
+    });
+    assert(values == 1);
+
+    stats = store_a->stats();
+    assert(stats.gets == 1);
+    assert(stats.sets == 3);
+    assert(stats.pushes == 1);
+    assert(stats.events == 3);
+    assert(stats.subscriptions == 2);
+    assert(stats.callback_latency.count == 4);
+    assert(stats.callback_latency.max_ns >= 2000000);
+    assert(stats.fanout_latency.count == 4);
+
+    assert(stats.subscribers.size() == 2);
+    assert(stats.subscribers[0].path == "name");
+    assert(stats.subscribers[0].latency.count == 1);
+    assert(stats.subscribers[1].path == "occupation");
+    assert(stats.subscribers[1].latency.count == 2);
+
+    // Remote traffic is counted on both sides
+    store_a->set("store_b.name", "Dick");
+    store_a->get("store_b.name", [&](const Message &msg){
+        assert(msg.value == "Dick");
+        values += 1;
+    });
+    assert(values == 2);
+
+    stats = store_a->stats();
+    assert(stats.transmitted == 2);
+    assert(stats.received == 1);
+    assert(stats.remotes.size() == 1);
+    assert(stats.remotes[0].name == "store_b");
+    assert(stats.remotes[0].msgs_out == 2);
+    assert(stats.remotes[0].msgs_in == 1);
+    assert(stats.pending_requests == 0);
+
+    stats = store_b->stats();
+    assert(stats.received == 2);
+    assert(stats.transmitted == 1);
+    assert(stats.sets == 1);
+    assert(stats.remotes[0].name == "store_a");
+
+    // Framed traffic counts bytes
+    Datastore *store_c = new Datastore();
+    store_c->attach(
+        "store_b",
+        [](const uint8_t *data, size_t size, void *ctx) {
+            Datastore *store_c = static_cast<Datastore*>(ctx);
+            assert(store_c->receive(data, size, "store_b") == size);
+            return 0;
+        },
+        store_c
+    );
+    store_c->set("store_b.name", "Tim");
+
+    stats = store_c->stats();
+    assert(stats.remotes.size() == 1);
+    assert(stats.remotes[0].bytes_out > 0);
+    assert(stats.remotes[0].bytes_in == stats.remotes[0].bytes_out);
+
+    // Resetting zeroes everything but the live gauges
+    store_a->reset_stats();
+    stats = store_a->stats();
+    assert(stats.gets == 0);
+    assert(stats.events == 0);
+    assert(stats.callback_latency.count == 0);
+    assert(stats.remotes.empty());
+    assert(stats.subscribers.empty());
+    assert(stats.subscriptions == 2);
+
+    delete store_a;
+    delete store_b;
+    delete store_c;
+
+    return EXIT_SUCCESS;
+}
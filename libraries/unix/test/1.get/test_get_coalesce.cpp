@@ -0,0 +1,93 @@
+#include <cassert>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Messages held back on the way to store_b. */
+std::vector<Message> outbox;
+
+/** Coalesced 'get' test - identical remote gets share one request. */
+int main()
+{
+    Datastore *store_a = new Datastore({
+        {"name", "Alfred"},
+        {"occupation", "Butler"}
+    }, Datastore::request_opts_t(std::chrono::milliseconds(10)));
+
+    Datastore *store_b = new Datastore({
+        {"name", "Bruce"},
+        {"occupation", "Batman"},
+    });
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void*) { outbox.push_back(msg); }
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(msg, "store_b");
+        },
+        store_a
+    );
+
+    auto deliver = [&]() {
+        std::vector<Message> msgs;
+        std::swap(msgs, outbox);
+        for(const Message &msg : msgs)
+            store_b->receive(msg, "store_a");
+    };
+
+    // Ten identical gets send a single request
+    int replies = 0;
+    for(int i = 0; i < 10; ++i) {
+        store_a->get("store_b.name", [&](const Message &msg){
+            assert(msg.type == "value");
+            assert(msg.value == "Bruce");
+            replies += 1;
+        });
+    }
+
+    // Gets copy the uuid they were given
+    std::string uuid;
+    store_a->get("store_b.name", [&](const Message &msg){ uuid = msg.uuid; }, "my-get");
+
+    // Other paths are separate requests
+    store_a->get("store_b.occupation", [&](const Message &msg){
+        assert(msg.value == "Batman");
+        replies += 1;
+    });
+
+    assert(outbox.size() == 2);
+    assert(store_a->pending_requests() == 2);
+
+    deliver();
+    assert(replies == 11);
+    assert(uuid == "my-get");
+    assert(store_a->pending_requests() == 0);
+
+    // The next get is a new request
+    store_a->get("store_b.name", [&](const Message &msg){ replies += 1; });
+    assert(outbox.size() == 1);
+    deliver();
+    assert(replies == 12);
+
+    // Coalesced gets share the timeout
+    int timeouts = 0;
+    for(int i = 0; i < 3; ++i)
+        store_a->get("store_b.name", [&](const Message &msg){ timeouts += (msg.type == "timeout"); });
+
+    assert(outbox.size() == 1);
+    store_a->poll(Datastore::clock::now() + std::chrono::milliseconds(20));
+    assert(timeouts == 3);
+    assert(store_a->pending_requests() == 0);
+
+    delete store_a;
+    delete store_b;
+
+    return EXIT_SUCCESS;
+}
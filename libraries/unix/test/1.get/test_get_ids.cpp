@@ -0,0 +1,81 @@
+#include <cassert>
+#include <set>
+#include "Datastore.h"
+
+using namespace entangld;
+
+std::set<std::string> ids;
+int values = 0;
+size_t id_length = 0;
+
+/** Identifier test - generated request ids are unique and route replies. */
+int main()
+{
+    for(Datastore::id_format_t format : {Datastore::id_format_t::UUID, Datastore::id_format_t::COUNTER}) {
+        Datastore *store_a = new Datastore(
+            nlohmann::json::object(),
+            Datastore::request_opts_t(std::chrono::milliseconds(0), 0, format)
+        );
+        Datastore *store_b = new Datastore;
+
+        store_a->attach(
+            "store_b",
+            [](const Message &msg, void *ctx) {
+                Datastore *store_b = static_cast<Datastore*>(ctx);
+                store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+            },
+            store_b
+        );
+
+        store_b->attach(
+            "store_a",
+            [](const Message &msg, void *ctx) {
+                Datastore *store_a = static_cast<Datastore*>(ctx);
+                store_a->receive(nlohmann::json(msg).get<Message>(), "store_b");
+            },
+            store_a
+        );
+
+        store_b->set("value", 1);
+        id_length = (format == Datastore::id_format_t::UUID) ? 36 : 25;
+
+        ids.clear();
+        for(int i = 0; i < 100; ++i) {
+            store_a->get("store_b.value", [](const Message &msg, void*){
+                assert(msg.value == 1);
+                assert(msg.uuid.size() == id_length);
+
+                ids.insert(msg.uuid);
+                values += 1;
+            });
+        }
+
+        assert(ids.size() == 100);
+        assert(store_a->pending_requests() == 0);
+
+        // Supplied uuids route replies too
+        std::string supplied;
+        store_a->get("store_b.value", [&supplied](const Message &msg) {
+            supplied = msg.uuid;
+        }, "supplied");
+        assert(supplied == "supplied");
+        assert(store_a->pending_requests() == 0);
+
+        // Local ids are unique too
+        store_a->subscribe("a", [](const Message&, void*){});
+        store_a->subscribe("a", [](const Message&, void*){});
+        store_a->get("a", [](const Message &msg, void*){ ids.insert(msg.uuid); });
+        assert(ids.size() == 101);
+
+        // Subscriptions are found by id
+        store_a->subscribe("b", [](const Message&, void*){}, nullptr, "sub");
+        assert(store_a->unsubscribe("", "sub") == 1);
+        assert(store_a->unsubscribe("a") == 2);
+
+        delete store_a;
+        delete store_b;
+    }
+
+    assert(values == 200);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#include <cassert>
+#include <thread>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Messages sent over the link in each direction. */
+int wire_gets = 0;
+int wire_events = 0;
+
+/** Mirror 'get' test - remote values served from a local copy. */
+int main()
+{
+    Datastore *store_a = new Datastore({
+        {"name", "Alfred"},
+        {"occupation", "Butler"}
+    });
+
+    Datastore *store_b = new Datastore({
+        {"name", "Bruce"},
+        {"occupation", "Batman"},
+        {"config", {{"rate", 1}}}
+    });
+
+    // Attach store_a to store_b, so it can answer the mirror subscription
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            wire_events += (msg.type == "event");
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(nlohmann::json(msg).get<Message>(), "store_b");
+        },
+        store_a
+    );
+
+    // Attach store_b to store_a as a mirror
+    auto handler = [](const Message &msg, void *ctx) {
+        wire_gets += (msg.type == "get");
+        Datastore *store_b = static_cast<Datastore*>(ctx);
+        store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+    };
+
+    store_a->attach("store_b", handler, store_b, Datastore::remote_opts_t(0, 0, Format::JSON, true));
+    assert(wire_events == 1);
+
+    // Served locally
+    std::string name;
+    store_a->get("store_b.name", [&](const Message &msg){ name = msg.value; });
+    assert(name == "Bruce");
+    assert(wire_gets == 0);
+
+    // Remote changes arrive as patches
+    int rate = 0;
+    store_b->set("config.rate", 5);
+    store_a->get("store_b.config.rate", [&](const Message &msg){ rate = msg.value; });
+    assert(rate == 5);
+    assert(wire_gets == 0);
+
+    // Writes are visible immediately
+    store_a->set("store_b.name", "Batman");
+    store_a->get("store_b.name", [&](const Message &msg){ name = msg.value; });
+    assert(name == "Batman");
+    store_b->get("name", [&](const Message &msg){ name = msg.value; });
+    assert(name == "Batman");
+
+    // Missing values are null
+    bool missing = false;
+    store_a->get("store_b.config.gain", [&](const Message &msg){ missing = msg.value.is_null(); });
+    assert(missing);
+    assert(wire_gets == 0);
+
+    // A stale mirror falls back to the remote until it hears from it again
+    store_a->attach("store_b", handler, store_b,
+        Datastore::remote_opts_t(0, 0, Format::JSON, true, std::chrono::milliseconds(20)));
+
+    store_a->get("store_b.name", [&](const Message &msg){ name = msg.value; });
+    assert(wire_gets == 0);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(40));
+    store_a->get("store_b.name", [&](const Message &msg){ name = msg.value; });
+    assert(wire_gets == 1);
+    assert(name == "Batman");
+
+    store_a->get("store_b.name", [&](const Message &msg){ name = msg.value; });
+    assert(wire_gets == 1);
+
+    // Detaching ends the mirror subscription
+    store_a->detach("store_b");
+    int before = wire_events;
+    store_b->set("config.rate", 10);
+    assert(wire_events == before);
+
+    delete store_a;
+    delete store_b;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,81 @@
+#include <cassert>
+#include <string>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Requests sent to a remote. */
+struct remote_log_t {
+    std::vector<std::string> paths;
+};
+
+/** Records the path of every request. */
+void record(const Message &msg, void *ctx)
+{
+    static_cast<remote_log_t*>(ctx)->paths.push_back(msg.path.get<std::string>());
+}
+
+/** Namespace 'get' test - requests route to the longest attached namespace. */
+int main()
+{
+    Datastore *hub = new Datastore({
+        {"name", "Alfred"},
+        {"occupation", "Butler"}
+    });
+
+    // Many remotes, one per device
+    std::vector<remote_log_t> devices(300);
+    for(size_t i = 0; i < devices.size(); ++i)
+        hub->attach("device_" + std::to_string(i), record, &devices[i]);
+
+    for(size_t i = 0; i < devices.size(); ++i)
+        hub->get("device_" + std::to_string(i) + ".status", [](const Message&){});
+
+    for(size_t i = 0; i < devices.size(); ++i) {
+        assert(devices[i].paths.size() == 1);
+        assert(devices[i].paths[0] == "status");
+    }
+
+    // Nested namespaces prefer the longest match, whatever the attach order
+    remote_log_t cave, computer;
+    hub->attach("cave.computer", record, &computer);
+    hub->attach("cave", record, &cave);
+
+    hub->get("cave.computer.status", [](const Message&){});
+    hub->get("cave.lights", [](const Message&){});
+    assert(computer.paths.size() == 1 && computer.paths[0] == "status");
+    assert(cave.paths.size() == 1 && cave.paths[0] == "lights");
+
+    // Names that only share a string prefix are separate namespaces
+    remote_log_t cavern;
+    hub->attach("cavern", record, &cavern);
+    hub->get("cavern.depth", [](const Message&){});
+    assert(cavern.paths.size() == 1 && cavern.paths[0] == "depth");
+    assert(cave.paths.size() == 1);
+
+    // Detaching the nested namespace falls back to its parent
+    hub->detach("cave.computer");
+    hub->get("cave.computer.status", [](const Message&){});
+    assert(computer.paths.size() == 1);
+    assert(cave.paths.size() == 2 && cave.paths[1] == "computer.status");
+
+    // Detaching the parent leaves the paths local
+    hub->detach("cave");
+    hub->set("cave.lights", "on");
+    std::string lights;
+    hub->get("cave.lights", [&](const Message &msg){ lights = msg.value; });
+    assert(lights == "on");
+    assert(cave.paths.size() == 2);
+
+    // A path naming only the namespace is local
+    bool local = false;
+    hub->get("cavern", [&](const Message &msg){ local = msg.value.is_null(); });
+    assert(local);
+    assert(cavern.paths.size() == 1);
+
+    delete hub;
+
+    return EXIT_SUCCESS;
+}
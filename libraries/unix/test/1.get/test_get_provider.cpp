@@ -0,0 +1,93 @@
+#include <cassert>
+#include <thread>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Provider test - computed values are only refreshed when read or watched. */
+int main()
+{
+    Datastore *store = new Datastore({
+        {"name", "Alfred"},
+        {"occupation", "Butler"}
+    });
+
+    const std::chrono::milliseconds ttl(50);
+    int computed = 0;
+    store->set_provider("system.load", [&]() {
+        computed += 1;
+        return nlohmann::json(computed);
+    }, ttl);
+
+    nlohmann::json value;
+    auto capture = [&](const Message &msg) { value = msg.value; };
+
+    // Nothing is computed until it is read
+    Datastore::clock::time_point start = Datastore::clock::now();
+    store->poll(start + ttl * 2);
+    assert(computed == 0);
+
+    store->get("system.load", capture);
+    assert(computed == 1);
+    assert(value == 1);
+
+    // Reads within the ttl are served from the cache
+    store->get("system.load", capture);
+    store->get("system", capture);
+    assert(computed == 1);
+    assert(value["load"] == 1);
+
+    // Unrelated paths never run the provider
+    store->get("name", capture);
+    assert(value == "Alfred");
+    assert(computed == 1);
+
+    // Parents of the provider see a fresh value once it expires
+    std::this_thread::sleep_for(ttl);
+    store->get("system", capture);
+    assert(computed == 2);
+    assert(value["load"] == 2);
+
+    // Unwatched values are not polled
+    store->poll(Datastore::clock::now() + ttl * 2);
+    assert(computed == 2);
+
+    std::vector<nlohmann::json> events;
+    store->subscribe("system", [&](const Message &msg){ events.push_back(msg.value); });
+
+    // poll keeps watched values current, once per ttl
+    Datastore::clock::time_point later = Datastore::clock::now() + ttl * 2;
+    store->poll(later);
+    assert(computed == 3);
+    store->poll(later + ttl / 2);
+    assert(computed == 3);
+    store->poll(later + ttl * 2);
+    assert(computed == 4);
+    assert(events.size() == 2);
+    assert(events.back()["load"] == 4);
+
+    // Unchanged values do not notify
+    store->set_provider("system.name", []() { return nlohmann::json("Wayne Manor"); }, ttl);
+    store->poll(later + ttl * 4);
+    assert(events.size() == 4);
+    store->poll(later + ttl * 6);
+    assert(events.size() == 5);
+    assert(events.back()["name"] == "Wayne Manor");
+
+    // Without subscribers polling stops again
+    store->unsubscribe("system");
+    store->poll(later + ttl * 8);
+    assert(computed == 6);
+
+    // Removed providers leave their last value
+    store->set_provider("system.load", nullptr);
+    store->get("system.load", capture);
+    assert(value == 6);
+    assert(computed == 6);
+
+    delete store;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+#include <cassert>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Revision 'get' test - subtree revisions and conditional gets. */
+int main()
+{
+    Datastore *store_a = new Datastore();
+    Datastore *store_b = new Datastore({
+        {"name", "Bruce"},
+        {"address", {{"city", "Gotham"}, {"street", "Mountain Drive"}}}
+    });
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(msg, "store_a");
+        },
+        store_b
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(msg, "store_b");
+        },
+        store_a
+    );
+
+    // Initial data has never been written
+    assert(store_b->revision("") == 0);
+    assert(store_b->revision("address.city") == 0);
+
+    // A write bumps the path and its parents, but not its siblings
+    store_b->set("address.city", "Bludhaven");
+    assert(store_b->revision("address.city") == 1);
+    assert(store_b->revision("address") == 1);
+    assert(store_b->revision("") == 1);
+    assert(store_b->revision("address.street") == 0);
+    assert(store_b->revision("name") == 0);
+
+    // A write to a parent bumps its children
+    store_b->set("address", {{"city", "Gotham"}});
+    assert(store_b->revision("address.city") == 2);
+    assert(store_b->revision("address.street") == 2);
+    assert(store_b->revision("name") == 0);
+
+    store_b->push("vehicles", "Batmobile");
+    assert(store_b->revision("vehicles") == 3);
+    assert(store_b->revision("") == 3);
+    assert(store_b->revision("address") == 2);
+
+    // Local values carry their revision
+    Message reply;
+    auto capture = [&](const Message &msg) { reply = msg; };
+    auto not_modified = [&]() {
+        return reply.params.is_object() && reply.params.value("not_modified", false);
+    };
+
+    store_b->get("address", capture);
+    assert(reply.revision == 2);
+    assert(reply.value["city"] == "Gotham");
+
+    // Matching revisions are not modified
+    store_b->get("address", capture, "", Datastore::get_opts_t(0, {}, false, 2));
+    assert(reply.type == "value");
+    assert(reply.revision == 2);
+    assert(reply.value.is_null());
+    assert(not_modified());
+
+    store_b->get("address", capture, "", Datastore::get_opts_t(0, {}, false, 1));
+    assert(reply.revision == 2);
+    assert(reply.value["city"] == "Gotham");
+    assert(!not_modified());
+
+    // Remotes answer conditional gets
+    store_a->get("store_b.address", capture);
+    assert(reply.revision == 2);
+    assert(reply.value["city"] == "Gotham");
+
+    store_a->get("store_b.address", capture, "", Datastore::get_opts_t(0, {}, false, 2));
+    assert(reply.revision == 2);
+    assert(reply.value.is_null());
+    assert(not_modified());
+
+    store_a->set("store_b.address.city", "Bludhaven");
+    store_a->get("store_b.address", capture, "", Datastore::get_opts_t(0, {}, false, 2));
+    assert(reply.revision == 4);
+    assert(reply.value["city"] == "Bludhaven");
+
+    // Mirrors are bypassed by conditional gets, revisions survive serialization
+    Datastore *store_c = new Datastore();
+    store_b->attach(
+        "store_c",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_c = static_cast<Datastore*>(ctx);
+            store_c->receive(nlohmann::json(msg).get<Message>(), "store_b");
+        },
+        store_c
+    );
+
+    store_c->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json(msg).get<Message>(), "store_c");
+        },
+        store_b,
+        Datastore::remote_opts_t(0, 0, Format::JSON, true)
+    );
+
+    store_c->get("store_b.address", capture, "", Datastore::get_opts_t(0, {}, false, 4));
+    assert(reply.revision == 4);
+    assert(reply.value.is_null());
+    assert(not_modified());
+
+    // Events carry the revision of the subscribed path
+    uint64_t revision = 0;
+    store_b->subscribe("address", [&](const Message &msg) {
+        revision = msg.revision;
+    });
+
+    store_b->set("address.street", "Wayne Manor");
+    assert(revision == 5);
+
+    store_b->set("address.street", "Wayne Tower");
+    assert(revision == 6);
+    assert(store_b->revision("name") == 0);
+
+    delete store_a;
+    delete store_b;
+    delete store_c;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,110 @@
+#include <cassert>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Messages held back on the way to store_b. */
+std::vector<Message> outbox;
+
+/** RPC test - procedures called locally, remotely and through get. */
+int main()
+{
+    Datastore *store_a = new Datastore({
+        {"name", "Alfred"},
+        {"occupation", "Butler"}
+    }, Datastore::request_opts_t(std::chrono::milliseconds(10)));
+
+    Datastore *store_b = new Datastore({
+        {"name", "Bruce"},
+        {"occupation", "Batman"},
+    });
+
+    // Local calls pass the arguments straight to the handler
+    store_b->set_rpc("math.add", [](const nlohmann::json &args, Datastore::reply_t reply) {
+        reply(args.is_array() ? args[0].get<int>() + args[1].get<int>() : 0);
+    });
+
+    nlohmann::json result;
+    store_b->call("math.add", {2, 3}, [&](const Message &msg){
+        assert(msg.type == "value");
+        assert(msg.path == "math.add");
+        result = msg.value;
+    });
+    assert(result == 5);
+
+    // A get runs the procedure without arguments
+    store_b->get("math.add", [&](const Message &msg){ result = msg.value; });
+    assert(result == 0);
+
+    // Paths without a procedure answer with their value
+    store_b->call("name", {1, 2}, [&](const Message &msg){ result = msg.value; });
+    assert(result == "Bruce");
+
+    // Handlers may reply later
+    Datastore::reply_t later;
+    store_b->set_rpc("slow", [&](const nlohmann::json&, Datastore::reply_t reply) {
+        later = reply;
+    });
+
+    int replies = 0;
+    store_b->call("slow", nullptr, [&](const Message &msg){
+        assert(msg.value == "done");
+        replies += 1;
+    }, "my-call");
+    assert(replies == 0);
+    later("done");
+    assert(replies == 1);
+
+    // Remote calls are sent with their arguments and never coalesced
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void*) { outbox.push_back(msg); }
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(msg, "store_b");
+        },
+        store_a
+    );
+
+    std::vector<nlohmann::json> sums;
+    store_a->call("store_b.math.add", {1, 1}, [&](const Message &msg){ sums.push_back(msg.value); });
+    store_a->call("store_b.math.add", {1, 1}, [&](const Message &msg){ sums.push_back(msg.value); });
+    store_a->call("store_b.math.add", {20, 22}, [&](const Message &msg){ sums.push_back(msg.value); });
+    store_a->get("store_b.math.add", [&](const Message &msg){ sums.push_back(msg.value); });
+    assert(outbox.size() == 4);
+    assert(outbox[0].type == "call");
+    assert(outbox[0].path == "math.add");
+    assert(outbox[0].params == nlohmann::json({1, 1}));
+    assert(store_a->pending_requests() == 4);
+
+    std::vector<Message> msgs;
+    std::swap(msgs, outbox);
+    for(const Message &msg : msgs)
+        store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+
+    assert(sums == std::vector<nlohmann::json>({2, 2, 42, 0}));
+    assert(store_a->pending_requests() == 0);
+
+    // Unanswered calls time out
+    std::string type;
+    store_a->call("store_b.slow", nullptr, [&](const Message &msg){ type = msg.type; });
+    store_a->poll(Datastore::clock::now() + std::chrono::milliseconds(20));
+    assert(type == "timeout");
+    outbox.clear();
+
+    // Removed procedures fall back to the data
+    store_b->set_rpc("math.add", nullptr);
+    store_b->get("math.add", [&](const Message &msg){ result = msg.value; });
+    assert(result.is_null());
+
+    delete store_a;
+    delete store_b;
+
+    return EXIT_SUCCESS;
+}
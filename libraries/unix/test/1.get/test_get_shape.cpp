@@ -0,0 +1,115 @@
+#include <cassert>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Messages sent to store_b. */
+std::vector<Message> outbox;
+
+/** Shaped 'get' test - depth limits, field masks and key listings. */
+int main()
+{
+    nlohmann::json data = {
+        {"name", "Bruce"},
+        {"address", {
+            {"city", "Gotham"},
+            {"street", {{"name", "Mountain Drive"}, {"number", 1007}}}
+        }},
+        {"vehicles", {"Batmobile", "Batwing"}}
+    };
+
+    Datastore *store_a = new Datastore();
+    Datastore *store_b = new Datastore(data);
+
+    nlohmann::json value;
+    auto capture = [&](const Message &msg) {
+        assert(msg.type == "value");
+        value = msg.value;
+    };
+
+    // Depth one returns the children without their contents
+    store_b->get("", capture, "", Datastore::get_opts_t(1));
+    assert(value == nlohmann::json({
+        {"name", "Bruce"},
+        {"address", nlohmann::json::object()},
+        {"vehicles", nlohmann::json::array()}
+    }));
+
+    store_b->get("address", capture, "", Datastore::get_opts_t(1));
+    assert(value["city"] == "Gotham");
+    assert(value["street"] == nlohmann::json::object());
+
+    store_b->get("", capture, "", Datastore::get_opts_t(2));
+    assert(value["address"]["city"] == "Gotham");
+    assert(value["address"]["street"] == nlohmann::json::object());
+    assert(value["vehicles"] == data["vehicles"]);
+
+    // Fields keep their place in the value
+    store_b->get("", capture, "", Datastore::get_opts_t(0, {"name", "address.street.number", "missing"}));
+    assert(value == nlohmann::json({
+        {"name", "Bruce"},
+        {"address", {{"street", {{"number", 1007}}}}}
+    }));
+
+    // Depth is counted from the requested path
+    store_b->get("", capture, "", Datastore::get_opts_t(2, {"address"}));
+    assert(value["address"]["city"] == "Gotham");
+    assert(value["address"]["street"] == nlohmann::json::object());
+
+    // Keys only
+    store_b->get("", capture, "", Datastore::get_opts_t(0, {}, true));
+    assert(value == nlohmann::json({"address", "name", "vehicles"}));
+
+    store_b->get("vehicles", capture, "", Datastore::get_opts_t(0, {}, true));
+    assert(value == nlohmann::json({0, 1}));
+
+    store_b->get("name", capture, "", Datastore::get_opts_t(0, {}, true));
+    assert(value == nlohmann::json::array());
+
+    // Plain gets are unchanged
+    store_b->get("address.street", capture);
+    assert(value == data["address"]["street"]);
+
+    // Remote gets send their options and are answered by the remote
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void*) { outbox.push_back(msg); }
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(msg, "store_b");
+        },
+        store_a
+    );
+
+    nlohmann::json shallow, keys, whole;
+    store_a->get("store_b.address", [&](const Message &msg){ shallow = msg.value; }, "", Datastore::get_opts_t(1));
+    store_a->get("store_b.address", [&](const Message &msg){ keys = msg.value; }, "", Datastore::get_opts_t(0, {}, true));
+    store_a->get("store_b.address", [&](const Message &msg){ whole = msg.value; });
+
+    // Different shapes are not coalesced
+    assert(outbox.size() == 3);
+    assert(outbox[0].params["max_depth"] == 1);
+    assert(outbox[1].params["keys_only"] == true);
+    assert(outbox[2].params.is_null());
+
+    std::vector<Message> msgs;
+    std::swap(msgs, outbox);
+    for(const Message &msg : msgs)
+        store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+
+    assert(shallow["street"] == nlohmann::json::object());
+    assert(keys == nlohmann::json({"city", "street"}));
+    assert(whole == data["address"]);
+    assert(store_a->pending_requests() == 0);
+
+    delete store_a;
+    delete store_b;
+
+    return EXIT_SUCCESS;
+}
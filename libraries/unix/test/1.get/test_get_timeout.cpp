@@ -0,0 +1,86 @@
+#include <cassert>
+#include <vector>
+#include "Datastore.h"
+
+using namespace entangld;
+
+std::vector<Message> sent;
+int timeouts = 0;
+int values = 0;
+
+void on_reply(const Message &msg, void*)
+{
+    if(msg.type == "timeout")
+        timeouts += 1;
+    else if(msg.type == "value")
+        values += 1;
+}
+
+/** Timeout test - requests that are never answered expire. */
+int main()
+{
+    Datastore *store_a = new Datastore(
+        nlohmann::json::object(),
+        Datastore::request_opts_t(std::chrono::milliseconds(100), 2)
+    );
+
+    // A remote that never answers
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void*) {
+            sent.push_back(msg);
+        }
+    );
+
+    Datastore::clock::time_point start = Datastore::clock::now();
+    store_a->get("store_b.a", on_reply);
+    store_a->get("store_b.b", on_reply);
+    assert(store_a->pending_requests() == 2);
+
+    // The table is full
+    store_a->get("store_b.c", on_reply);
+    assert(timeouts == 1);
+    assert(sent.size() == 2);
+
+    store_a->poll(start);
+    assert(timeouts == 1);
+
+    store_a->poll(start + std::chrono::milliseconds(200));
+    assert(timeouts == 3);
+    assert(store_a->pending_requests() == 0);
+
+    // A late reply is ignored
+    Message late;
+    late.type = "value";
+    late.path = "a";
+    late.uuid = sent[0].uuid;
+    late.value = 1;
+    store_a->receive(late, "store_b");
+    assert(values == 0);
+
+    // Replies still find their request once slots are reused
+    store_a->get("store_b.d", on_reply);
+    Message reply;
+    reply.type = "value";
+    reply.path = "d";
+    reply.uuid = sent.back().uuid;
+    reply.value = 2;
+    store_a->receive(reply, "store_b");
+    assert(values == 1);
+    assert(store_a->pending_requests() == 0);
+
+    // User supplied uuids work too
+    store_a->get("store_b.e", on_reply, nullptr, "my-request");
+    reply.uuid = "my-request";
+    store_a->receive(reply, "store_b");
+    assert(values == 2);
+
+    // Detaching fails the requests waiting on the remote
+    store_a->get("store_b.f", on_reply);
+    store_a->detach("store_b");
+    assert(timeouts == 4);
+    assert(store_a->pending_requests() == 0);
+
+    delete store_a;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,78 @@
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Heap allocations made by the process. */
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+    allocations += 1;
+    void *ptr = std::malloc(size ? size : 1);
+    if(ptr == nullptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+/** Allocation 'set' test - steady writes reuse the storage in the store. */
+int main()
+{
+    Datastore *store = new Datastore({
+        {"name", "Wayne Enterprises"},
+        {"status", "online"}
+    });
+
+    Path path("sensors.thermal");
+    nlohmann::json reading = {
+        {"label", "thermal camera, north facing wall"},
+        {"samples", {21.5, 21.7, 21.6, 21.9}},
+        {"unit", "celsius"}
+    };
+
+    double last = 0;
+    store->subscribe(path, [&](const Message &msg){
+        last = msg.value.at("samples").back();
+    });
+
+    // The first write builds the tree and the scratch buffers
+    store->set(path, reading);
+
+    nlohmann::json &sample = reading["samples"][3];
+    size_t before = allocations;
+    for(int i = 0; i < 100; ++i) {
+        sample = 22.0 + i;
+        store->set(path, reading);
+    }
+
+#ifndef ENTANGLD_CONCURRENT
+    // Callbacks see the shared event, nothing is copied to a queue
+    assert(allocations == before);
+#else
+    (void)before;
+#endif
+    assert(last == 121.0);
+
+    // Changing the shape still writes the new value
+    reading["samples"] = {1.0, 2.0};
+    reading.erase("unit");
+    store->set(path, reading);
+    assert(last == 2.0);
+
+    nlohmann::json stored;
+    store->get(path, [&](const Message &msg){ stored = msg.value; });
+    assert(stored == reading);
+
+    delete store;
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,104 @@
+#include <cassert>
+#include "Datastore.h"
+
+using namespace entangld;
+
+int events[2] = {0, 0};
+int messages = 0;
+
+/** Batch test - one event per subscription and one message per remote. */
+int main()
+{
+    Datastore *store_a = new Datastore;
+    Datastore *store_b = new Datastore;
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            messages += 1;
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+        },
+        store_b
+    );
+
+    store_a->subscribe("status", [](const Message &msg, void*){
+        assert(msg.value.size() == 40);
+        events[0] += 1;
+    });
+
+    store_b->subscribe("status", [](const Message &msg, void*){
+        assert(msg.value.size() == 40);
+        events[1] += 1;
+    });
+
+    store_a->begin();
+    for(int i = 0; i < 40; ++i) {
+        std::string key = "field" + std::to_string(i);
+        store_a->set("status." + key, i);
+        store_a->set("store_b.status." + key, i);
+    }
+
+    // Nothing is delivered until commit
+    assert(events[0] == 0);
+    assert(messages == 0);
+
+    store_a->commit();
+    assert(events[0] == 1);
+    assert(events[1] == 1);
+    assert(messages == 1);
+
+    // Local reads see writes made inside the batch
+    store_a->begin();
+    store_a->set("status.field0", "changed");
+    store_a->get("status.field0", [](const Message &msg, void*){
+        assert(msg.value == "changed");
+    });
+    store_a->commit();
+    assert(events[0] == 2);
+
+    // A malformed batch is rejected whole and leaves no batch open
+    Message batch;
+    batch.type = "batch";
+    batch.value = nlohmann::json::array();
+    batch.value.push_back({{"type", "set"}, {"path", "status.field1"}, {"value", "lost"}});
+    batch.value.push_back(42);
+
+    bool thrown = false;
+    try {
+        store_a->receive(batch, "store_b");
+    }
+    catch(nlohmann::json::exception&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    store_a->get("status.field1", [](const Message &msg, void*){
+        assert(msg.value == 1);
+    });
+
+    // An element failing part way through still closes the batch
+    batch.value = nlohmann::json::array();
+    batch.value.push_back({{"type", "set"}, {"path", "status.field1"}, {"value", "kept"}});
+    batch.value.push_back({{"type", "set"}, {"path", 7}, {"value", "bad path"}});
+
+    thrown = false;
+    try {
+        store_a->receive(batch, "store_b");
+    }
+    catch(nlohmann::json::exception&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(events[0] == 3);
+
+    messages = 0;
+    store_a->set("status.field2", "after");
+    store_a->set("store_b.status.field2", "after");
+    assert(events[0] == 4);
+    assert(messages == 1);
+
+    delete store_a;
+    delete store_b;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+#include <cassert>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Bytes the transport accepts before it would block. */
+size_t budget = SIZE_MAX;
+
+/** Bytes that made it through the transport. */
+std::vector<uint8_t> wire;
+
+/** Messages delivered to store_f. */
+int delivered = 0;
+
+/** Flow control test - blocked remotes hold their Messages under an overflow policy. */
+int main()
+{
+    // A writer that would block reports the bytes it did not take
+    Datastore *store_a = new Datastore();
+    Datastore *store_b = new Datastore();
+    store_a->attach(
+        "store_b",
+        [](const uint8_t *data, size_t size, void*) {
+            size_t taken = std::min(size, budget);
+            wire.insert(wire.end(), data, data + taken);
+            budget -= taken;
+            return static_cast<int>(size - taken);
+        },
+        nullptr,
+        Datastore::remote_opts_t(0, 0, Format::JSON, false, std::chrono::milliseconds(0), 2)
+    );
+
+    budget = 10;
+    store_a->set("store_b.a", 1);
+
+    Datastore::queue_stats_t stats = store_a->queue_stats("store_b");
+    assert(stats.blocked);
+    assert(stats.queued == 0);
+    assert(stats.pending_bytes > 0);
+    assert(wire.size() == 10);
+
+    // The oldest held Message makes room
+    store_a->set("store_b.b", 2);
+    store_a->set("store_b.c", 3);
+    store_a->set("store_b.d", 4);
+
+    stats = store_a->queue_stats("store_b");
+    assert(stats.queued == 2);
+    assert(stats.dropped == 1);
+
+    // Retried by poll, the retry may only run once the lock is released
+    budget = SIZE_MAX;
+    store_a->poll();
+    store_a->poll();
+
+    stats = store_a->queue_stats("store_b");
+    assert(!stats.blocked);
+    assert(stats.queued == 0);
+    assert(stats.pending_bytes == 0);
+
+    assert(store_b->receive(wire.data(), wire.size(), "store_a") == wire.size());
+    store_b->visit([](const nlohmann::json &data) {
+        assert(data == nlohmann::json({{"a", 1}, {"c", 3}, {"d", 4}}));
+    });
+
+    // Message handlers block through set_blocked, events are coalesced per subscription
+    Datastore *store_c = new Datastore();
+    Datastore *store_d = new Datastore({{"value", 0}, {"list", nlohmann::json::array()}});
+
+    store_c->attach(
+        "store_d",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_d = static_cast<Datastore*>(ctx);
+            store_d->receive(msg, "store_c");
+        },
+        store_d
+    );
+
+    store_d->attach(
+        "store_c",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_c = static_cast<Datastore*>(ctx);
+            store_c->receive(nlohmann::json(msg).get<Message>(), "store_d");
+        },
+        store_c,
+        Datastore::remote_opts_t(0, 0, Format::JSON, false, std::chrono::milliseconds(0),
+            4, Datastore::overflow_t::COALESCE)
+    );
+
+    int events = 0;
+    nlohmann::json value;
+    store_c->subscribe("store_d.value", [&](const Message &msg) {
+        events += 1;
+        value = msg.value;
+    });
+
+    nlohmann::json list;
+    Datastore::policy_t delta(0, std::chrono::milliseconds(0), true, true);
+    store_c->subscribe("store_d.list", [&](const Message &msg) {
+        list = msg.value;
+    }, "", delta);
+    assert(list == nlohmann::json::array());
+
+    store_d->set_blocked("store_c", true);
+    store_d->set("value", 1);
+    store_d->set("value", 2);
+    store_d->set("value", 3);
+    store_d->push("list", 1);
+    store_d->push("list", 2);
+
+    bool replied = false;
+    store_c->get("store_d.value", [&](const Message &msg) {
+        assert(msg.value == 3);
+        replied = true;
+    });
+
+    stats = store_d->queue_stats("store_c");
+    assert(stats.blocked);
+    assert(stats.queued == 3);
+    assert(stats.coalesced == 3);
+    assert(stats.dropped == 0);
+    assert(events == 0);
+    assert(!replied);
+
+    // Merged patches rebuild every push
+    store_d->set_blocked("store_c", false);
+    assert(events == 1);
+    assert(value == 3);
+    assert(list == nlohmann::json({1, 2}));
+    assert(replied);
+    assert(store_d->queue_stats("store_c").queued == 0);
+
+    // Overflowing with DISCONNECT detaches the remote
+    int closed = 0;
+    Datastore *store_e = new Datastore();
+    store_e->attach(
+        "store_f",
+        [](const Message&, void*) { delivered += 1; },
+        &closed,
+        Datastore::remote_opts_t(0, 0, Format::JSON, false, std::chrono::milliseconds(0),
+            1, Datastore::overflow_t::DISCONNECT,
+            [](const std::string &name, void *ctx) {
+                assert(name == "store_f");
+                *static_cast<int*>(ctx) += 1;
+            })
+    );
+
+    std::string type;
+    store_e->set_blocked("store_f", true);
+    store_e->get("store_f.x", [&](const Message &msg) { type = msg.type; });
+    store_e->set("store_f.y", 1);
+    store_e->set("store_f.z", 1);
+
+    stats = store_e->queue_stats("store_f");
+    assert(stats.queued == 0);
+    assert(stats.dropped == 3);
+    assert(type.empty());
+
+    store_e->poll();
+    assert(type == "timeout");
+    assert(delivered == 0);
+    assert(store_e->queue_stats("store_f").dropped == 0);
+    assert(closed == 1);
+
+    // A peer that keeps sending is no longer answered
+    Message late;
+    late.path = "y";
+    late.uuid = "late";
+    for(const char *type : {"get", "call", "subscribe"}) {
+        late.type = type;
+        store_e->receive(late, "store_f");
+    }
+
+    store_e->set("y", 2);
+    store_e->poll();
+    assert(delivered == 0);
+    assert(closed == 1);
+    assert(store_e->queue_stats("store_f").queued == 0);
+
+    delete store_a;
+    delete store_b;
+    delete store_c;
+    delete store_d;
+    delete store_e;
+
+    return EXIT_SUCCESS;
+}
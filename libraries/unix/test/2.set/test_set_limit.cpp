@@ -0,0 +1,107 @@
+#include <cassert>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Writes observed by the write hook. */
+std::vector<std::pair<nlohmann::json, size_t>> writes;
+
+/** Bounded 'push' test - arrays keep a window of the latest values. */
+int main()
+{
+    Datastore *store_a = new Datastore({
+        {"name", "Alfred"},
+        {"history", nlohmann::json::array()}
+    });
+
+    Datastore *store_b = new Datastore({
+        {"name", "Bruce"},
+        {"history", nlohmann::json::array()}
+    });
+
+    auto get = [](Datastore *store, const std::string &path) {
+        nlohmann::json value;
+        store->get(path, [&](const Message &msg){ value = msg.value; });
+        return value;
+    };
+
+    store_a->set_write_hook([](const Path&, const nlohmann::json &value, bool push, size_t limit, void*) {
+        assert(push);
+        writes.emplace_back(value, limit);
+    });
+
+    std::vector<nlohmann::json> events;
+    store_a->subscribe("history", [&](const Message &msg){ events.push_back(msg.value); });
+
+    std::vector<nlohmann::json> patches;
+    store_a->subscribe("history", [&](const Message &msg){
+        if(msg.params.is_object())
+            patches.push_back(msg.params["patch"]);
+    }, "", Datastore::policy_t(0, std::chrono::milliseconds(0), true, true));
+
+    // Pushes append until the window is full
+    for(int i = 0; i < 3; ++i)
+        store_a->push("history", i, 3);
+
+    assert(get(store_a, "history") == nlohmann::json({0, 1, 2}));
+    assert(events.back() == nlohmann::json({0, 1, 2}));
+    assert(writes.back().first == 2);
+    assert(writes.back().second == 3);
+    assert(patches.back()[0]["op"] == "add");
+
+    size_t capacity = 0;
+    store_a->visit([&](const nlohmann::json &data){
+        capacity = data["history"].get_ptr<const nlohmann::json::array_t*>()->capacity();
+    });
+
+    // Then drop the oldest, in order, without reallocating
+    for(int i = 3; i < 100; ++i)
+        store_a->push("history", nlohmann::json(i), 3);
+
+    assert(get(store_a, "history") == nlohmann::json({97, 98, 99}));
+    assert(events.size() == 100);
+    assert(events.back() == nlohmann::json({97, 98, 99}));
+
+    store_a->visit([&](const nlohmann::json &data){
+        assert(data["history"].get_ptr<const nlohmann::json::array_t*>()->capacity() == capacity);
+    });
+
+    // Write observers still see a bounded push, subscribers the window replaced
+    assert(writes.size() == 100);
+    assert(writes.back().first == 99);
+    assert(writes.back().second == 3);
+    assert(patches.back()[0]["op"] == "replace");
+    assert(patches.back()[0]["value"] == nlohmann::json({97, 98, 99}));
+
+    // A smaller limit shrinks the window, no limit grows it again
+    store_a->push("history", 100, 2);
+    assert(get(store_a, "history") == nlohmann::json({99, 100}));
+
+    store_a->push("history", 101);
+    assert(get(store_a, "history") == nlohmann::json({99, 100, 101}));
+
+    // Remote pushes carry the limit
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            assert(msg.type == "push");
+            assert(msg.params["limit"] == 2);
+
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+        },
+        store_b
+    );
+
+    for(int i = 0; i < 5; ++i)
+        store_a->push("store_b.history", i, 2);
+
+    assert(get(store_b, "history") == nlohmann::json({3, 4}));
+
+    delete store_a;
+    delete store_b;
+
+    return EXIT_SUCCESS;
+}
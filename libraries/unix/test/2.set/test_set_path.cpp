@@ -0,0 +1,45 @@
+#include <cassert>
+#include "Datastore.h"
+
+using namespace entangld;
+
+int remote_count = 0;
+
+/** Pre-parsed path test - reuse a Path across calls and namespace changes. */
+int main()
+{
+    Datastore *store = new Datastore;
+
+    Path path("telemetry.voltage");
+    assert(path.segments().size() == 2);
+    assert(path.relative(1) == "voltage");
+
+    for(int i = 0; i < 10; ++i)
+        store->set(path, i);
+
+    store->get(path, [](const Message &msg, void*){
+        assert(msg.path == "telemetry.voltage");
+        assert(msg.value == 9);
+    });
+
+    // Attaching a namespace must invalidate the cached resolution
+    store->attach("telemetry", [](const Message &msg, void*){
+        assert(msg.type == "set");
+        assert(msg.path == "voltage");
+        remote_count += 1;
+    });
+
+    store->set(path, 10);
+    assert(remote_count == 1);
+
+    store->detach("telemetry");
+    store->set(path, 11);
+    assert(remote_count == 1);
+
+    store->get("telemetry.voltage", [](const Message &msg, void*){
+        assert(msg.value == 11);
+    });
+
+    delete store;
+    return EXIT_SUCCESS;
+}
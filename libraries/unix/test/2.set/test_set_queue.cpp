@@ -0,0 +1,57 @@
+#include <cassert>
+#include "Datastore.h"
+
+using namespace entangld;
+
+int frames = 0;
+
+/** Outbound queue test - Messages are coalesced into batch frames. */
+int main()
+{
+    Datastore *store_a = new Datastore;
+    Datastore *store_b = new Datastore;
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            frames += 1;
+
+            // Round trip through text, as a socket transport would
+            std::string frame = nlohmann::json(msg).dump();
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json::parse(frame).get<Message>(), "store_a");
+        },
+        store_b,
+        Datastore::remote_opts_t(4)
+    );
+
+    // Held until flush
+    for(int i = 0; i < 3; ++i)
+        store_a->set("store_b.value" + std::to_string(i), i);
+
+    assert(frames == 0);
+    store_a->flush();
+    assert(frames == 1);
+
+    // Sent as soon as the queue is full
+    for(int i = 0; i < 4; ++i)
+        store_a->set("store_b.value" + std::to_string(i), i * 2);
+
+    assert(frames == 2);
+    store_b->get("value3", [](const Message &msg, void*){
+        assert(msg.value == 6);
+    });
+
+    // A bare array is read as a batch frame
+    store_b->receive(nlohmann::json::parse(
+        R"([{"type":"set","path":"a","value":1},{"type":"set","path":"b","value":2}])"
+    ).get<Message>(), "store_a");
+
+    store_b->get("b", [](const Message &msg, void*){
+        assert(msg.value == 2);
+    });
+
+    delete store_a;
+    delete store_b;
+    return EXIT_SUCCESS;
+}
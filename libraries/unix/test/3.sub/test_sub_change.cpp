@@ -0,0 +1,95 @@
+#include <cassert>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Writes observed by the write hook. */
+int writes = 0;
+
+/** Change detection test - writes that change nothing are not delivered. */
+int main()
+{
+    nlohmann::json registers = {
+        {"pump", {{"speed", 1200}, {"running", true}}},
+        {"valve", {{"open", false}, {"position", 0}}},
+        {"alarms", {"none", "none"}}
+    };
+
+    Datastore *store = new Datastore({
+        {"name", "Alfred"},
+        {"registers", registers}
+    });
+
+    store->set_write_hook([](const Path&, const nlohmann::json&, bool, size_t, void*) { writes += 1; });
+
+    int all = 0, speed = 0, valve = 0, alarm = 0, name = 0;
+    store->subscribe("registers", [&](const Message&){ all += 1; });
+    store->subscribe("registers.pump.speed", [&](const Message&){ speed += 1; });
+    store->subscribe("registers.valve", [&](const Message&){ valve += 1; });
+    store->subscribe("registers.alarms.1", [&](const Message&){ alarm += 1; });
+    store->subscribe("name", [&](const Message&){ name += 1; });
+
+    // Without change detection every write notifies
+    store->set("registers", registers);
+    assert(all == 1 && speed == 1 && valve == 1 && alarm == 1);
+    assert(writes == 1);
+
+    store->set_change_detection(true);
+
+    // Rewriting the same values is dropped
+    for(int i = 0; i < 10; ++i) {
+        store->set("registers", registers);
+        store->set("name", "Alfred");
+        store->set("registers.pump.speed", 1200);
+    }
+    assert(all == 1 && speed == 1 && valve == 1 && alarm == 1 && name == 0);
+    assert(writes == 1);
+
+    // Only subscriptions whose part changed are called
+    registers["pump"]["speed"] = 1500;
+    store->set("registers", registers);
+    assert(all == 2 && speed == 2 && valve == 1 && alarm == 1);
+    assert(writes == 2);
+
+    registers["valve"]["position"] = 10;
+    store->set("registers", nlohmann::json(registers));
+    assert(all == 3 && speed == 2 && valve == 2 && alarm == 1);
+
+    // Elements of arrays, and removed keys
+    registers["alarms"][1] = "overpressure";
+    store->set("registers", registers);
+    assert(all == 4 && speed == 2 && valve == 2 && alarm == 2);
+
+    registers["alarms"] = {"none"};
+    store->set("registers", registers);
+    assert(all == 5 && alarm == 3);
+
+    registers["pump"].erase("speed");
+    store->set("registers", registers);
+    assert(all == 6 && speed == 3 && valve == 2);
+
+    nlohmann::json stored;
+    store->get("registers", [&](const Message &msg){ stored = msg.value; });
+    assert(stored == registers);
+
+    // Types that change always count
+    store->set("registers.valve.open", 0);
+    assert(valve == 3);
+    store->set("name", "Jarvis");
+    assert(name == 1);
+
+    // Pushes always notify
+    store->push("registers.alarms", "none");
+    assert(all == 8);
+
+    // Turning it off restores every write
+    store->set_change_detection(false);
+    store->set("name", "Jarvis");
+    assert(name == 2);
+
+    delete store;
+
+    return EXIT_SUCCESS;
+}
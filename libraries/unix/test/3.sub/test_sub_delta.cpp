@@ -0,0 +1,131 @@
+#include <cassert>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Events sent from store_b to store_a. */
+std::vector<Message> wire;
+
+/** Delta subscription test - snapshot, patches and remote mirrors. */
+int main(int argc, char *argv[])
+{
+    Datastore *store_a = new Datastore;
+    Datastore *store_b = new Datastore({
+        {"config", {
+            {"name", "Bruce"},
+            {"gains", {{"p", 1.0}, {"i", 0.1}}},
+            {"log", nlohmann::json::array()}
+        }},
+        {"status", "idle"}
+    });
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+        },
+        store_b
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Message copy = nlohmann::json(msg).get<Message>();
+            if(copy.type == "event")
+                wire.push_back(copy);
+
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(copy, "store_b");
+        },
+        store_a
+    );
+
+    // Local delta subscriptions get the patch and the current value
+    std::vector<Message> local;
+    store_b->subscribe("config", [&](const Message &msg){ local.push_back(msg); },
+        "", Datastore::policy_t(0, std::chrono::milliseconds(0), true, true));
+
+    assert(local.size() == 1);
+    assert(local[0].params.at("patch").size() == 1);
+    assert(local[0].params.at("patch")[0].at("path") == "");
+    assert(local[0].value.at("name") == "Bruce");
+
+    store_b->set("config.gains.p", 2.0);
+    assert(local.size() == 2);
+    assert(local[1].params.at("patch") == nlohmann::json::parse(
+        R"([{"op": "replace", "path": "/gains/p", "value": 2.0}])"));
+    assert(local[1].value.at("gains").at("p") == 2.0);
+
+    // Writes beside the subscription do not notify it
+    store_b->set("status", "busy");
+    assert(local.size() == 2);
+
+    // Remote delta subscriptions rebuild the value from patches
+    nlohmann::json mirror;
+    store_a->subscribe("store_b.config", [&](const Message &msg){ mirror = msg.value; },
+        "", Datastore::policy_t(0, std::chrono::milliseconds(0), true, true));
+
+    assert(wire.size() == 1);
+    assert(mirror.at("gains").at("p") == 2.0);
+
+    store_b->set("config.gains.i", 0.5);
+    assert(wire.size() == 2);
+    assert(wire[1].value.is_null());
+    assert(wire[1].params.at("patch")[0].at("path") == "/gains/i");
+    assert(mirror.at("gains").at("i") == 0.5);
+    assert(mirror.at("name") == "Bruce");
+
+    // Pushes only carry the new element
+    store_b->push("config.log", "started");
+    store_b->push("config.log", "running");
+    assert(wire[3].params.at("patch")[0].at("op") == "add");
+    assert(wire[3].params.at("patch")[0].at("path") == "/log/-");
+    assert(wire[3].params.at("patch")[0].at("value") == "running");
+    assert(mirror.at("log") == nlohmann::json::parse(R"(["started", "running"])"));
+
+    // Parents created by a set are created in the mirror
+    store_b->set("config.limits.max", 10);
+    assert(mirror.at("limits").at("max") == 10);
+
+    // A batch sends one patch holding every change
+    size_t before = wire.size();
+    store_b->begin();
+    store_b->set("config.name", "Batman");
+    store_b->set("config.gains.p", 3.0);
+    store_b->commit();
+    assert(wire.size() == before + 1);
+    assert(wire.back().params.at("patch").size() == 2);
+    assert(mirror.at("name") == "Batman");
+    assert(mirror.at("gains").at("p") == 3.0);
+
+    // Replacing the subscribed path sends a snapshot
+    store_b->set("config", {{"name", "Alfred"}, {"gains", nullptr}});
+    assert(wire.back().params.at("patch")[0].at("path") == "");
+    nlohmann::json config;
+    store_b->get("config", [&](const Message &msg){ config = msg.value; });
+    assert(mirror == config);
+
+    // Skipped changes are followed by a snapshot
+    std::vector<Message> throttled;
+    store_b->subscribe("config", [&](const Message &msg){ throttled.push_back(msg); },
+        "", Datastore::policy_t(2, std::chrono::milliseconds(0), true, true));
+
+    store_b->set("config.name", "Bruce");
+    store_b->set("config.name", "Batman");
+    store_b->set("config.gains", {{"p", 4.0}});
+    assert(throttled.size() == 3);
+    assert(throttled[1].params.at("patch")[0].at("path") == "/name");
+    assert(throttled[2].params.at("patch")[0].at("path") == "");
+    assert(throttled[2].value.at("name") == "Batman");
+
+    store_b->get("config", [&](const Message &msg){ config = msg.value; });
+    assert(mirror == config);
+
+    delete store_a;
+    delete store_b;
+
+    return EXIT_SUCCESS;
+}
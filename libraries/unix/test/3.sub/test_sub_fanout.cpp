@@ -0,0 +1,96 @@
+#include <cassert>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+constexpr int SUBSCRIBERS = 30;
+
+/** Holds tasks until run() is called. */
+class queue_executor_t : public Executor {
+    public:
+        void post(task_t &&task, const void*) override
+        {
+            tasks.push_back(std::move(task));
+        }
+
+        bool single_threaded() const override { return true; };
+
+        void run()
+        {
+            for(task_t &task : tasks)
+                task();
+
+            tasks.clear();
+        }
+
+        std::vector<task_t> tasks;
+};
+
+int count = 0;
+const Message *event = nullptr;
+
+/** Fan-out test - subscribers on one path share a single event. */
+int main(int argc, char *argv[])
+{
+    Datastore *store = new Datastore;
+
+    for(int i = 0; i < SUBSCRIBERS; ++i) {
+        store->subscribe("robot.state", [](const Message &msg, void*){
+            assert(msg.value.at("mode") == "idle");
+            if(event == nullptr)
+                event = &msg;
+
+            assert(event == &msg);
+            count += 1;
+        });
+    }
+
+    store->set("robot.state.mode", "idle");
+    assert(count == SUBSCRIBERS);
+
+    // Reading a missing subtree must not create it
+    store->subscribe("robot.arm", [](const Message &msg, void*){
+        assert(msg.value == nullptr);
+    });
+
+    event = nullptr;
+    store->set("robot", {{"state", {{"mode", "idle"}}}});
+    assert(count == SUBSCRIBERS * 2);
+
+    store->get("robot", [](const Message &msg, void*){
+        assert(!msg.value.contains("arm"));
+    });
+
+    // Deferred calls share the event too, each with its own uuid
+    queue_executor_t executor;
+    assert(store->set_executor(&executor));
+
+    std::set<std::string> uuids;
+    const Message *deferred = nullptr;
+    for(int i = 0; i < SUBSCRIBERS; ++i) {
+        store->subscribe("robot.mode", [&](const Message &msg){
+            if(deferred == nullptr)
+                deferred = &msg;
+
+            assert(deferred == &msg);
+            assert(msg.value == "busy");
+            assert(msg.uuid == "deferred-" + std::to_string(uuids.size()));
+            uuids.insert(msg.uuid);
+        }, "deferred-" + std::to_string(i));
+    }
+
+    store->set("robot.mode", "busy");
+    assert(uuids.empty());
+
+    executor.run();
+
+    store->set_executor(nullptr);
+    assert(uuids.size() == SUBSCRIBERS);
+
+    delete store;
+    return EXIT_SUCCESS;
+}
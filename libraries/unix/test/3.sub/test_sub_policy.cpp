@@ -0,0 +1,75 @@
+#include <cassert>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+int count[3] = {0, 0, 0};
+int last = -1;
+
+/** Delivery policy test - every N and rate limited subscriptions. */
+int main(int argc, char *argv[])
+{
+    Datastore *store_a = new Datastore;
+    Datastore *store_b = new Datastore;
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+        },
+        store_b
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(nlohmann::json(msg).get<Message>(), "store_b");
+        },
+        store_a
+    );
+
+    // Every third change, starting with the first
+    store_a->subscribe("sensor", [](const Message &msg, void*){
+        count[0] += 1;
+    }, nullptr, "", Datastore::policy_t(3));
+
+    // At most once per minute, coalescing to the latest value
+    store_a->subscribe("sensor", [](const Message &msg, void*){
+        last = msg.value;
+        count[1] += 1;
+    }, nullptr, "", Datastore::policy_t(0, std::chrono::minutes(1)));
+
+    // Remote subscription, throttled by store_b
+    store_a->subscribe("store_b.sensor", [](const Message &msg, void*){
+        count[2] += 1;
+    }, nullptr, "", Datastore::policy_t(5));
+
+    for(int i = 0; i < 10; ++i) {
+        store_a->set("sensor", i);
+        store_b->set("sensor", i);
+    }
+
+    assert(count[0] == 4);
+    assert(count[1] == 1);
+    assert(last == 0);
+    assert(count[2] == 2);
+
+    // Nothing has expired yet
+    store_a->poll();
+    assert(count[1] == 1);
+
+    // Trailing flush delivers the latest value once
+    store_a->poll(Datastore::clock::now() + std::chrono::minutes(2));
+    assert(count[1] == 2);
+    assert(last == 9);
+
+    store_a->poll(Datastore::clock::now() + std::chrono::minutes(4));
+    assert(count[1] == 2);
+
+    delete store_a;
+    delete store_b;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,153 @@
+#include <cassert>
+#include <map>
+#include <string>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+/** Messages sent to store_b by type. */
+std::map<std::string, int> sent;
+
+/** Shared subscription test - identical remote subscriptions share one stream. */
+int main(int argc, char *argv[])
+{
+    Datastore *store_a = new Datastore;
+    Datastore *store_b = new Datastore({
+        {"name", "Bruce"},
+        {"occupation", "Batman"},
+        {"address", {{"city", "Gotham"}, {"street", "Mountain Drive"}}}
+    });
+
+    store_a->attach(
+        "store_b",
+        [](const Message &msg, void *ctx) {
+            sent[msg.type] += 1;
+            Datastore *store_b = static_cast<Datastore*>(ctx);
+            store_b->receive(nlohmann::json(msg).get<Message>(), "store_a");
+        },
+        store_b
+    );
+
+    store_b->attach(
+        "store_a",
+        [](const Message &msg, void *ctx) {
+            Datastore *store_a = static_cast<Datastore*>(ctx);
+            store_a->receive(nlohmann::json(msg).get<Message>(), "store_b");
+        },
+        store_a
+    );
+
+    // Three identical subscriptions send one subscribe
+    int count[4] = {0, 0, 0, 0};
+    store_a->subscribe("store_b.name", [&](const Message &msg){
+        assert(msg.uuid == "sub-0");
+        count[0] += 1;
+    }, "sub-0");
+    store_a->subscribe("store_b.name", [&](const Message &msg){
+        assert(msg.uuid == "sub-1");
+        count[1] += 1;
+    }, "sub-1");
+    store_a->subscribe("store_b.name", [&](const Message &msg){
+        assert(msg.uuid == "sub-2");
+        count[2] += 1;
+    }, "sub-2");
+    assert(sent["subscribe"] == 1);
+
+    // A different policy needs its own
+    store_a->subscribe("store_b.name", [&](const Message&){ count[3] += 1; }, "sub-3",
+        Datastore::policy_t(2));
+    assert(sent["subscribe"] == 2);
+
+    store_b->set("name", "Batman");
+    assert(count[0] == 1 && count[1] == 1 && count[2] == 1 && count[3] == 1);
+
+    // Only the last subscriber unsubscribes on the remote
+    store_a->unsubscribe("", "sub-0");
+    store_a->unsubscribe("", "sub-1");
+    assert(sent["unsubscribe"] == 0);
+
+    store_b->set("name", "Bruce");
+    assert(count[0] == 1 && count[1] == 1 && count[2] == 2);
+
+    assert(store_a->unsubscribe("store_b.name") == 2);
+    assert(sent["unsubscribe"] == 2);
+
+    store_b->set("name", "Batman");
+    assert(count[2] == 2);
+
+    // Joining a delta stream starts from its mirror
+    nlohmann::json values[2];
+    Datastore::policy_t delta(0, std::chrono::milliseconds(0), true, true);
+    store_a->subscribe("store_b.address", [&](const Message &msg){
+        assert(msg.uuid == "delta-0");
+        values[0] = msg.value;
+    }, "delta-0", delta);
+    store_b->set("address.city", "Bludhaven");
+    store_a->subscribe("store_b.address", [&](const Message &msg){
+        assert(msg.uuid == "delta-1");
+        values[1] = msg.value;
+    }, "delta-1", delta);
+    assert(sent["subscribe"] == 3);
+    assert(values[1].at("city") == "Bludhaven");
+
+    store_b->set("address.street", "Park Row");
+    assert(values[0] == values[1]);
+    assert(values[1].at("street") == "Park Row");
+
+    // Relays share one stream between their remotes, and restore each uuid
+    Datastore *client_1 = new Datastore;
+    Datastore *client_2 = new Datastore;
+    std::pair<Datastore*, std::string> links[2] = {
+        {store_a, "client_1"},
+        {store_a, "client_2"}
+    };
+
+    for(int i = 0; i < 2; ++i) {
+        Datastore *client = (i == 0) ? client_1 : client_2;
+        client->attach(
+            "relay",
+            [](const Message &msg, void *ctx) {
+                auto link = static_cast<std::pair<Datastore*, std::string>*>(ctx);
+                link->first->receive(nlohmann::json(msg).get<Message>(), link->second);
+            },
+            &links[i]
+        );
+
+        store_a->attach(
+            links[i].second,
+            [](const Message &msg, void *ctx) {
+                Datastore *client = static_cast<Datastore*>(ctx);
+                client->receive(nlohmann::json(msg).get<Message>(), "relay");
+            },
+            client
+        );
+    }
+
+    std::string occupations[2];
+    client_1->subscribe("relay.store_b.occupation", [&](const Message &msg){ occupations[0] = msg.value; });
+    client_2->subscribe("relay.store_b.occupation", [&](const Message &msg){ occupations[1] = msg.value; });
+    assert(sent["subscribe"] == 4);
+
+    store_b->set("occupation", "Vigilante");
+    assert(occupations[0] == "Vigilante");
+    assert(occupations[1] == "Vigilante");
+
+    // Detaching one client keeps the stream for the other
+    store_a->detach("client_1");
+    assert(sent["unsubscribe"] == 2);
+
+    store_b->set("occupation", "Batman");
+    assert(occupations[0] == "Vigilante");
+    assert(occupations[1] == "Batman");
+
+    store_a->detach("client_2");
+    assert(sent["unsubscribe"] == 3);
+
+    delete client_1;
+    delete client_2;
+    delete store_a;
+    delete store_b;
+
+    return EXIT_SUCCESS;
+}
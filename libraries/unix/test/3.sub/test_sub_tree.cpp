@@ -0,0 +1,49 @@
+#include <cassert>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+int count[3] = {0, 0, 0};
+
+/** Subscription index test - only related paths trigger callbacks. */
+int main(int argc, char *argv[])
+{
+    Datastore *store = new Datastore;
+
+    store->subscribe("name", [](const Message &msg, void*){
+        count[0] += 1;
+    });
+
+    store->subscribe("namespace", [](const Message &msg, void*){
+        count[1] += 1;
+    });
+
+    store->subscribe("name.first", [](const Message &msg, void*){
+        assert(msg.path == "name.first");
+        assert(msg.value == "Bruce");
+        count[2] += 1;
+    }, nullptr, "first-uuid");
+
+    // Sibling with a common prefix should not trigger "name"
+    store->set("namespace.key", "value");
+    assert(count[0] == 0);
+    assert(count[1] == 1);
+    assert(count[2] == 0);
+
+    // Writing a parent should trigger subscriptions beneath it
+    store->set("name", {{"first", "Bruce"}});
+    assert(count[0] == 1);
+    assert(count[1] == 1);
+    assert(count[2] == 1);
+
+    // Unsubscribe by uuid only
+    assert(store->unsubscribe("", "first-uuid") == 1);
+
+    store->set("name.first", "Bruce");
+    assert(count[0] == 2);
+    assert(count[2] == 1);
+
+    delete store;
+    return EXIT_SUCCESS;
+}
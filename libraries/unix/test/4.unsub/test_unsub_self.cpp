@@ -0,0 +1,80 @@
+#include <cassert>
+
+#include "Datastore.h"
+
+using namespace entangld;
+
+int main(int argc, char *argv[])
+{
+    Datastore *store = new Datastore;
+
+    int self = 0, sibling = 0, parent = 0, deep = 0;
+
+    // Unsubscribing during set() must not disturb the subscribers being called
+    store->subscribe("a.b", [&](const Message &msg){
+        self += 1;
+        assert(store->unsubscribe("a.b", "self") == 1);
+    }, "self");
+
+    store->subscribe("a.b", [&](const Message &msg){
+        sibling += 1;
+    }, "sibling");
+
+    store->subscribe("a", [&](const Message &msg){
+        parent += 1;
+    }, "parent");
+
+    store->set("a.b", 1);
+    assert(self == 1);
+    assert(sibling == 1);
+    assert(parent == 1);
+
+    store->set("a.b", 2);
+    assert(self == 1);
+    assert(sibling == 2);
+    assert(parent == 2);
+
+    // Removing a neighbour and then itself from its own callback
+    store->subscribe("a.b", [&](const Message &msg){
+        assert(store->unsubscribe("a.b", "sibling") == 1);
+        assert(store->unsubscribe("a.b", "all") == 1);
+    }, "all");
+
+    store->set("a.b", 3);
+    assert(sibling == 2 || sibling == 3);
+    assert(parent == 3);
+
+    int before = sibling;
+    store->set("a.b", 4);
+    assert(sibling == before);
+    assert(parent == 4);
+
+    // Unsubscribing a node that is then pruned, while it is still collected
+    store->subscribe("x.y.z", [&](const Message &msg){
+        deep += 1;
+    }, "deep");
+
+    store->subscribe("x", [&](const Message &msg){
+        store->unsubscribe("x.y.z", "deep");
+        store->unsubscribe("x", "outer");
+    }, "outer");
+
+    store->set("x.y.z", 1);
+    assert(deep <= 1);
+
+    before = deep;
+    store->set("x.y.z", 2);
+    assert(deep == before);
+
+    // Subscribing again to the pruned path still works
+    store->subscribe("x.y.z", [&](const Message &msg){
+        deep += 1;
+    }, "again");
+
+    store->set("x.y.z", 3);
+    assert(deep == before + 1);
+
+    delete store;
+
+    return EXIT_SUCCESS;
+}
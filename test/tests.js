@@ -1,4 +1,5 @@
 var Entangld=require("../lib/Datastore.js");
+var Entangld_Message=require("../lib/Message.js");
 var { partial_copy, dereferenced_copy } = require("../lib/utils.js");
 var assert=require("assert");
 
@@ -425,6 +426,24 @@ describe("Multiplexed stores",()=>{
         });
     });
 
+    it("Batch message applies every contained message", ()=>{
+
+        a.receive(Entangld_Message.batch([
+            Entangld_Message.setpush({tree: "batch.one", value: 1}),
+            Entangld_Message.setpush({tree: "batch.two", value: 2}),
+            Entangld_Message.setpush({tree: "batch.arr", value: []})
+        ]), s);
+
+        // Bare arrays are batch frames too
+        a.receive([ Entangld_Message.setpush({type: "push", tree: "batch.arr", value: 3}) ], s);
+
+        return a.get("batch").then((val)=>{
+
+            assert.deepStrictEqual(val, {one: 1, two: 2, arr: [3]});
+            return Promise.resolve();
+        });
+    });
+
     it("Setter visible in _deref_mode", ()=>{
 
         b.set("system.five",()=>5);